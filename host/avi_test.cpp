@@ -0,0 +1,169 @@
+// Checks the files main/avi.cpp writes by reading them back: the RIFF sizes, the header counts
+// and that every idx1 entry points at the 00dc chunk holding the frame that was written. Run by
+// ctest, exits non-zero if any of them is wrong.
+#include "avi.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+static int n_failed;
+
+#define CHECK(cond) \
+    do { if (!(cond)) { fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); ++n_failed; return; } } while (0)
+
+static uint32_t get32(const std::vector<uint8_t> &file, size_t pos)
+{
+    return file[pos] | file[pos + 1] << 8 | file[pos + 2] << 16 | (uint32_t)file[pos + 3] << 24;
+}
+
+static bool fourcc(const std::vector<uint8_t> &file, size_t pos, const char *code)
+{
+    return pos + 4 <= file.size() && memcmp(&file[pos], code, 4) == 0;
+}
+
+static std::vector<uint8_t> read_file(const std::string &path)
+{
+    std::vector<uint8_t> file;
+    FILE *f = fopen(path.c_str(), "rb");
+    if (f == nullptr)
+    {
+        return file;
+    }
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    {
+        file.insert(file.end(), buf, buf + n);
+    }
+    fclose(f);
+    return file;
+}
+
+// Frame i is its length's worth of a pattern that depends on i, odd lengths included to check
+// the padding
+static std::vector<uint8_t> make_frame(size_t i, size_t len)
+{
+    std::vector<uint8_t> frame(len);
+    for (size_t j = 0; j < len; ++j)
+    {
+        frame[j] = (uint8_t)(i * 31 + j * 7);
+    }
+    return frame;
+}
+
+static std::string temp_path(const char *name)
+{
+    const char *dir = getenv("TMPDIR");
+    return std::string(dir != nullptr ? dir : "/tmp") + "/" + name + "_" + std::to_string(getpid()) + ".avi";
+}
+
+// Writes n frames with a batch of batch_size and reads the whole file back
+static void check_file(const char *name, size_t n, size_t batch_size, size_t base_len)
+{
+    std::string path = temp_path(name);
+    avi_writer *w = avi_open(path.c_str(), 1024, 768, n, batch_size);
+    CHECK(w != nullptr);
+
+    std::vector<std::vector<uint8_t>> frames;
+    for (size_t i = 0; i < n; ++i)
+    {
+        frames.push_back(make_frame(i, base_len + i * 37 % 1001));
+        CHECK(avi_add_frame(w, frames.back().data(), frames.back().size(), 1000000 + i * 40000));
+    }
+    CHECK(avi_frame_count(w) == n);
+    CHECK(avi_full(w));
+    CHECK(!avi_add_frame(w, frames[0].data(), frames[0].size(), 0));
+    CHECK(avi_close(w));
+
+    std::vector<uint8_t> file = read_file(path);
+    unlink(path.c_str());
+
+    CHECK(fourcc(file, 0, "RIFF") && fourcc(file, 8, "AVI "));
+    CHECK(get32(file, 4) == file.size() - 8);
+    CHECK(fourcc(file, 24, "avih"));
+    CHECK(get32(file, 32) == (n > 1 ? 40000 : 100000));   // us per frame, from the timestamps when there are two
+    CHECK(get32(file, 32 + 16) == n);       // total frames
+    CHECK(get32(file, 32 + 32) == 1024 && get32(file, 32 + 36) == 768);
+    CHECK(fourcc(file, 212, "LIST") && fourcc(file, 220, "movi"));
+
+    size_t movi_end = 220 + get32(file, 216);
+    CHECK(fourcc(file, movi_end, "idx1"));
+    CHECK(get32(file, movi_end + 4) == 16 * n);
+    CHECK(movi_end + 8 + 16 * n == file.size());
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        size_t entry = movi_end + 8 + 16 * i;
+        CHECK(fourcc(file, entry, "00dc"));
+        size_t chunk = 220 + get32(file, entry + 8);
+        size_t len = get32(file, entry + 12);
+        CHECK(len == frames[i].size());
+        CHECK(fourcc(file, chunk, "00dc") && get32(file, chunk + 4) == len);
+        CHECK(chunk + 8 + len <= movi_end);
+        CHECK(memcmp(&file[chunk + 8], frames[i].data(), len) == 0);
+    }
+}
+
+// After avi_sync the file as it is on disk is a complete file of the frames written out so far,
+// without an index
+static void check_sync()
+{
+    std::string path = temp_path("sync");
+    const size_t batch_size = 4096;
+    avi_writer *w = avi_open(path.c_str(), 640, 480, 100, batch_size);
+    CHECK(w != nullptr);
+
+    for (size_t i = 0; i < 10; ++i)
+    {
+        std::vector<uint8_t> frame = make_frame(i, 1500 + i);
+        CHECK(avi_add_frame(w, frame.data(), frame.size(), i * 100000));
+    }
+    CHECK(avi_sync(w));
+
+    std::vector<uint8_t> file = read_file(path);
+    CHECK(file.size() % batch_size == 0);
+    CHECK(fourcc(file, 0, "RIFF"));
+    size_t frames = get32(file, 32 + 16);
+    size_t movi_end = 220 + get32(file, 216);
+    CHECK(frames > 0 && frames < 10);
+    CHECK(get32(file, 4) == movi_end - 8);
+    CHECK(movi_end <= file.size());
+    CHECK((get32(file, 32 + 12) & 0x10) == 0);  // no index yet
+
+    // walking the chunks from movi finds exactly the frames the header counts
+    size_t pos = 224;
+    size_t found = 0;
+    while (pos < movi_end)
+    {
+        CHECK(fourcc(file, pos, "00dc"));
+        pos += 8 + ((get32(file, pos + 4) + 1) & ~1u);
+        ++found;
+    }
+    CHECK(pos == movi_end && found == frames);
+
+    CHECK(avi_close(w));
+    unlink(path.c_str());
+}
+
+int main()
+{
+    // frames much smaller than, around and bigger than the batch
+    check_file("small", 200, 32 * 1024, 500);
+    check_file("batch", 40, 4096, 4000);
+    check_file("xga", 20, 32 * 1024, 120 * 1024);
+    check_file("one", 1, 4096, 1);
+    check_sync();
+
+    if (n_failed != 0)
+    {
+        fprintf(stderr, "%d checks failed\n", n_failed);
+        return 1;
+    }
+    printf("avi ok\n");
+    return 0;
+}
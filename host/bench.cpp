@@ -0,0 +1,657 @@
+// Benchmarks of the paths in main that run for every frame or event, on the host against the
+// stand-ins in include/ and stubs/. Results come out in Google Benchmark's formats, run with
+// --benchmark_out=results.json --benchmark_out_format=json to keep them, and the firmware
+// version is recorded in the context so runs of different versions can be compared.
+#include <benchmark/benchmark.h>
+
+#include "avi.h"
+#include "bufpool.h"
+#include "camera.h"
+#include "capture.h"
+#include "exif.h"
+#include "esp_timer.h"
+#include "freertos/timers.h"
+#include "host_camera.h"
+#include "host_httpd.h"
+#include "httpd_util.h"
+#include "img_converters.h"
+#include "lwip/sockets.h"
+#include "metrics.h"
+#include "motion.h"
+#include "rate.h"
+#include "replay.h"
+#include "scale.h"
+#include "session.h"
+#include "sse.h"
+#include "status.h"
+#include "stream.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#ifndef CAMERA_VERSION
+#define CAMERA_VERSION "unknown"
+#endif
+
+static httpd_handle_t server;
+
+// camera_bench is linked with --wrap for each of main's ways of sending, so what a frame costs in
+// calls into the network stack and bytes handed to it can be counted
+static std::atomic<unsigned long> n_sends;
+static std::atomic<unsigned long long> n_bytes_sent;
+
+extern "C" ssize_t __real_send(int fd, const void *buf, size_t len, int flags);
+extern "C" ssize_t __real_sendmsg(int fd, const struct msghdr *msg, int flags);
+
+static ssize_t count_send(ssize_t len)
+{
+    n_sends.fetch_add(1, std::memory_order_relaxed);
+    if (len > 0)
+    {
+        n_bytes_sent.fetch_add(len, std::memory_order_relaxed);
+    }
+    return len;
+}
+
+extern "C" ssize_t __wrap_send(int fd, const void *buf, size_t len, int flags)
+{
+    return count_send(__real_send(fd, buf, len, flags));
+}
+
+extern "C" ssize_t __wrap_sendmsg(int fd, const struct msghdr *msg, int flags)
+{
+    return count_send(__real_sendmsg(fd, msg, flags));
+}
+
+// As camera_main's, which is private to it
+static void server_close_fn(httpd_handle_t, int sockfd)
+{
+    session_closed(sockfd);
+    sse_remove_sink(sockfd);
+    stream_remove_sink(sockfd);
+    close(sockfd);
+}
+
+// A client at the other end of a socketpair that reads and throws away whatever it is sent
+struct client
+{
+    int server_fd;
+    int fd;
+    std::thread reader;
+};
+
+static client *connect(const char *uri)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+    {
+        return nullptr;
+    }
+    // room for a whole frame, as a TCP window would take
+    int size = 256 * 1024;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+    auto *c = new client{ fds[0], fds[1], {} };
+    c->reader = std::thread([fd = fds[1]]
+    {
+        static thread_local char buf[64 * 1024];
+        while (read(fd, buf, sizeof(buf)) > 0)
+        {
+        }
+    });
+    if (host_httpd_request(server, c->server_fd, uri) != ESP_OK)
+    {
+        c->reader.join();
+        close(c->fd);
+        delete c;
+        return nullptr;
+    }
+    return c;
+}
+
+static void disconnect(client *c)
+{
+    host_httpd_close(server, c->server_fd);
+    c->reader.join();
+    close(c->fd);
+    delete c;
+}
+
+// A camera frame for the benchmarks that decode one: the first of the CAMERA_REPLAY recording if
+// there is one, otherwise an XGA test card made with the host's encoder. Empty with no codec.
+static std::vector<uint8_t> test_jpeg;
+
+static size_t append_jpeg(void *arg, size_t, const void *data, size_t len)
+{
+    auto *jpeg = static_cast<std::vector<uint8_t> *>(arg);
+    jpeg->insert(jpeg->end(), static_cast<const uint8_t *>(data), static_cast<const uint8_t *>(data) + len);
+    return len;
+}
+
+static void load_test_jpeg(const char *replay_path)
+{
+    if (replay_path != nullptr)
+    {
+        replay_config config{};
+        config.path = replay_path;
+        config.fps = REPLAY_UNPACED;
+        if (replay_start(&config) == ESP_OK)
+        {
+            camera_fb_t *fb = replay_fb_get();
+            if (fb != nullptr)
+            {
+                test_jpeg.assign(fb->buf, fb->buf + fb->len);
+                replay_fb_return(fb);
+            }
+            replay_stop();
+        }
+        if (!test_jpeg.empty())
+        {
+            return;
+        }
+    }
+
+    // gradients and bars with some noise on top, which compresses about as much as a room does
+    const int width = 1024;
+    const int height = 768;
+    std::vector<uint8_t> bgr(width * height * 3);
+    uint32_t seed = 1;
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            seed = seed * 1664525 + 1013904223;
+            int noise = (seed >> 24) % 24;
+            int bar = x * 8 / width;
+            uint8_t *p = &bgr[(y * width + x) * 3];
+            p[0] = std::min(255, (bar & 1 ? 200 : 40) * y / height + noise + 20);
+            p[1] = std::min(255, (bar & 2 ? 200 : 40) + noise);
+            p[2] = std::min(255, (bar & 4 ? 160 : 30) + x * 64 / width + noise);
+        }
+    }
+    fmt2jpg_cb(bgr.data(), bgr.size(), width, height, PIXFORMAT_RGB888, 90, append_jpeg, &test_jpeg);
+}
+
+static bool setup()
+{
+    // periodic status and rate messages would land in the middle of what is measured
+    host_timers_enable(false);
+
+    if (trace_init() != ESP_OK || camera_init() != ESP_OK || capture_init() != ESP_OK || sse_init() != ESP_OK || stream_init() != ESP_OK || rate_init() != ESP_OK ||
+        replay_init() != ESP_OK || session_init() != ESP_OK)
+    {
+        return false;
+    }
+    // one frame at a time so none are dropped and every one is timed from the sensor on
+    host_camera_set_triggered(true);
+
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 0;
+    config.max_uri_handlers = 16;
+    config.max_open_sockets = SESSION_MAX_OPEN;
+    config.open_fn = session_open;
+    config.close_fn = server_close_fn;
+    if (httpd_start(&server, &config) != ESP_OK)
+    {
+        return false;
+    }
+
+    httpd_uri_t stream{};
+    stream.uri = "/stream";
+    stream.method = HTTP_GET;
+    stream.handler = stream_handler;
+    httpd_register_uri_handler(server, &stream);
+
+    httpd_uri_t events{};
+    events.uri = "/events";
+    events.method = HTTP_GET;
+    events.handler = sse_handler;
+    httpd_register_uri_handler(server, &events);
+
+    httpd_uri_t metrics{};
+    metrics.uri = "/metrics";
+    metrics.method = HTTP_GET;
+    metrics.handler = metrics_handler;
+    httpd_register_uri_handler(server, &metrics);
+    return true;
+}
+
+// From the sensor handing over a frame to the last of the clients' sockets taking all of it:
+// capture, the exif header, the part headers and the sends. Arguments are the number of clients
+// and the frame size in KB. Also counts the send calls and bytes each client's part took.
+static void BM_StreamFrame(benchmark::State &state)
+{
+    int n_clients = state.range(0);
+    size_t frame_len = state.range(1) * 1024;
+    host_camera_set_test_image(frame_len, 800, 600);
+
+    std::vector<client *> clients;
+    for (int i = 0; i < n_clients; ++i)
+    {
+        client *c = connect("/stream");
+        if (c == nullptr)
+        {
+            state.SkipWithError("stream request failed");
+            return;
+        }
+        clients.push_back(c);
+    }
+
+    n_sends.store(0);
+    n_bytes_sent.store(0);
+    for (auto _ : state)
+    {
+        unsigned int expected = metrics_frames_sent.load() + n_clients;
+        host_camera_trigger();
+        while (metrics_frames_sent.load() < expected)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    double parts = static_cast<double>(state.iterations()) * n_clients;
+    state.counters["sends_per_part"] = n_sends.load() / parts;
+    state.counters["bytes_per_part"] = n_bytes_sent.load() / parts;
+
+    for (client *c : clients)
+    {
+        disconnect(c);
+    }
+    state.SetItemsProcessed(state.iterations() * n_clients);
+    state.SetBytesProcessed(state.iterations() * n_clients * frame_len);
+    state.counters["clients"] = n_clients;
+}
+BENCHMARK(BM_StreamFrame)->ArgsProduct({ { 1, 2, 4, 8 }, { 16, 64 } })->ArgNames({ "clients", "kb" })->UseRealTime();
+
+// The baseline for BM_StreamFrame: a part sent as the stream did before it went out in one vectored
+// send, the chunk and part headers, the exif header, the body and the closing CRLF each with a
+// socket_send_all of its own. Same clients, frame sizes and counters, so the sends and bytes a part
+// of the two can be read side by side. The parts are made here rather than by the stream task.
+static void BM_StreamFramePieces(benchmark::State &state)
+{
+    int n_clients = state.range(0);
+    size_t frame_len = state.range(1) * 1024;
+    // the image less the SOI and JFIF header the exif one stands in for
+    std::vector<uint8_t> body(frame_len - 20, 0x55);
+    exif_header exif;
+    exif_init(&exif);
+
+    std::vector<client *> clients;
+    for (int i = 0; i < n_clients; ++i)
+    {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        {
+            state.SkipWithError("socketpair failed");
+            break;
+        }
+        int size = 256 * 1024;
+        setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        clients.push_back(new client{ fds[0], fds[1], std::thread([fd = fds[1]]
+        {
+            static thread_local char buf[64 * 1024];
+            while (read(fd, buf, sizeof(buf)) > 0)
+            {
+            }
+        }) });
+    }
+
+    n_sends.store(0);
+    n_bytes_sent.store(0);
+    uint32_t seq = 0;
+    for (auto _ : state)
+    {
+        ++seq;
+        for (client *c : clients)
+        {
+            char part_buf[224];
+            int64_t now = capture_wall_time(esp_timer_get_time());
+            size_t image_len = EXIF_HEADER_LEN + body.size();
+            int part_len = snprintf(part_buf, sizeof(part_buf),
+                "\r\n--123456789000000000000987654321\r\nContent-Type: image/jpeg\r\nContent-Length: %u\r\nX-Frame-Seq: %lu\r\n"
+                "X-Capture-Time: %lld.%06lld\r\nX-Send-Time: %lld.%06lld\r\n\r\n",
+                (unsigned)image_len, (unsigned long)seq, now / 1000000, now % 1000000, now / 1000000, now % 1000000);
+            char header[256];
+            int header_len = snprintf(header, sizeof(header), "%x\r\n%.*s\r\n%x\r\n", part_len, part_len, part_buf, (unsigned)image_len);
+
+            if (socket_send_all(server, c->server_fd, header, header_len) != ESP_OK ||
+                socket_send_all(server, c->server_fd, (const char *)exif.data, EXIF_HEADER_LEN) != ESP_OK ||
+                socket_send_all(server, c->server_fd, (const char *)body.data(), body.size()) != ESP_OK ||
+                socket_send_all(server, c->server_fd, "\r\n", 2) != ESP_OK)
+            {
+                state.SkipWithError("send failed");
+                break;
+            }
+        }
+    }
+
+    double parts = static_cast<double>(state.iterations()) * n_clients;
+    state.counters["sends_per_part"] = n_sends.load() / parts;
+    state.counters["bytes_per_part"] = n_bytes_sent.load() / parts;
+
+    for (client *c : clients)
+    {
+        close(c->server_fd);
+        c->reader.join();
+        close(c->fd);
+        delete c;
+    }
+    state.SetItemsProcessed(state.iterations() * n_clients);
+    state.SetBytesProcessed(state.iterations() * n_clients * frame_len);
+    state.counters["clients"] = n_clients;
+}
+BENCHMARK(BM_StreamFramePieces)->ArgsProduct({ { 1, 2, 4, 8 }, { 16, 64 } })->ArgNames({ "clients", "kb" })->UseRealTime();
+
+// One status event queued for every events client and sent by the httpd task
+static void BM_SseBroadcast(benchmark::State &state)
+{
+    int n_sinks = state.range(0);
+    std::vector<client *> clients;
+    for (int i = 0; i < n_sinks; ++i)
+    {
+        client *c = connect("/events");
+        if (c == nullptr)
+        {
+            state.SkipWithError("events request failed");
+            return;
+        }
+        clients.push_back(c);
+    }
+
+    const char msg[] = "{ \"time\": \"2024:01:01-12:00:00\", \"frames\": 25, \"tempc\": 40 }";
+    for (auto _ : state)
+    {
+        sse_broadcast("status", msg, sizeof(msg) - 1);
+        host_httpd_wait_idle(server);
+    }
+
+    for (client *c : clients)
+    {
+        disconnect(c);
+    }
+    state.SetItemsProcessed(state.iterations() * n_sinks);
+    state.counters["sinks"] = n_sinks;
+}
+BENCHMARK(BM_SseBroadcast)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->ArgName("sinks")->UseRealTime();
+
+// Frames of a real recording, named by CAMERA_REPLAY, streamed to N clients. Paced as it was recorded
+// unless CAMERA_REPLAY_FPS says otherwise, "max" taking frames as fast as they go out.
+static void BM_ReplayStream(benchmark::State &state, const char *path)
+{
+    int n_clients = state.range(0);
+    replay_config config{};
+    config.path = path;
+    config.seed = 1;
+    config.loop = true;
+    const char *fps = getenv("CAMERA_REPLAY_FPS");
+    if (fps != nullptr)
+    {
+        config.fps = strcmp(fps, "max") == 0 ? REPLAY_UNPACED : atoi(fps);
+    }
+    if (replay_start(&config) != ESP_OK)
+    {
+        state.SkipWithError("no frames to replay");
+        return;
+    }
+    // let go of the capture task if it is still waiting on the stand-in sensor for a trigger
+    host_camera_set_triggered(false);
+
+    std::vector<client *> clients;
+    for (int i = 0; i < n_clients; ++i)
+    {
+        client *c = connect("/stream");
+        if (c == nullptr)
+        {
+            state.SkipWithError("stream request failed");
+            break;
+        }
+        clients.push_back(c);
+    }
+
+    unsigned int sent = metrics_frames_sent.load();
+    for (auto _ : state)
+    {
+        if (clients.size() < static_cast<size_t>(n_clients))
+        {
+            break;
+        }
+        sent += n_clients;
+        while (metrics_frames_sent.load() < sent)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    for (client *c : clients)
+    {
+        disconnect(c);
+    }
+    replay_stop();
+    host_camera_set_triggered(true);
+    state.SetItemsProcessed(state.iterations() * n_clients);
+    state.counters["clients"] = n_clients;
+}
+
+static char page[4096];
+static int page_len;
+
+static int page_printf(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(page + page_len, sizeof(page) - page_len, format, args);
+    va_end(args);
+    if (n > 0)
+    {
+        page_len = std::min<int>(page_len + n, sizeof(page) - 1);
+    }
+    return n;
+}
+
+// A substream frame made from the test frame, decoded at 1/2, 1/4 or 1/8 size and encoded again at
+// the substreams' quality. The argument is the scale as a shift.
+static void BM_ScaleJpeg(benchmark::State &state)
+{
+    int scale = state.range(0);
+    if (test_jpeg.empty())
+    {
+        state.SkipWithError("no JPEG codec");
+        return;
+    }
+
+    size_t out_len = 0;
+    for (auto _ : state)
+    {
+        // quality as stream.cpp uses for substreams
+        bufpool_buf *buf = scale_jpeg(test_jpeg.data(), test_jpeg.size(), scale, 60);
+        if (buf == nullptr)
+        {
+            state.SkipWithError("scale_jpeg failed");
+            return;
+        }
+        out_len = buf->len;
+        bufpool_put(buf);
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["in_bytes"] = test_jpeg.size();
+    state.counters["out_bytes"] = out_len;
+}
+BENCHMARK(BM_ScaleJpeg)->DenseRange(1, SCALE_MAX)->ArgName("scale");
+
+// Patching one frame's fields into an exif header, as every stream part and still does. The
+// argument is the frame rate the timestamps advance at: at 30 only one frame in 30 starts a new
+// second and has the date strings and name rewritten, at 1 every frame does.
+static void BM_ExifUpdate(benchmark::State &state)
+{
+    int64_t interval = 1000000 / state.range(0);
+    exif_header header;
+    exif_init(&header);
+    exif_fields fields{};
+    fields.when.tv_sec = 1700000000;
+    fields.exposure_us = 33000;
+    fields.iso = 200;
+    fields.name = "camera";
+
+    for (auto _ : state)
+    {
+        ++fields.seq;
+        fields.when.tv_usec += interval;
+        if (fields.when.tv_usec >= 1000000)
+        {
+            fields.when.tv_usec -= 1000000;
+            ++fields.when.tv_sec;
+        }
+        exif_update(&header, &fields);
+        benchmark::DoNotOptimize(header.data);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ExifUpdate)->Arg(30)->Arg(1)->ArgName("fps");
+
+// Motion detection on the test frame: the DC only luma decode, the comparison with the background
+// and the grouping into regions, without the copy the motion task makes first. Frames are timed
+// as five a second apart as the task takes them.
+static void BM_MotionDetect(benchmark::State &state)
+{
+    if (test_jpeg.empty())
+    {
+        state.SkipWithError("no test frame");
+        return;
+    }
+
+    uint32_t seq = 0;
+    int64_t timestamp = 0;
+    for (auto _ : state)
+    {
+        timestamp += 200000;
+        motion_look(++seq, timestamp, test_jpeg.data(), test_jpeg.size());
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * test_jpeg.size());
+}
+BENCHMARK(BM_MotionDetect);
+
+// The recorder's writes of XGA frames (the test frame, or 100KB without a codec) to an AVI file in
+// TMPDIR, with the batch size as the argument. A new file every 256 frames as the recorder would
+// every few minutes, so the index and header writes are counted too. The host's page cache makes
+// the figure an upper bound for the card, it shows what the writer itself costs.
+static void BM_AviWrite(benchmark::State &state)
+{
+    size_t batch_size = state.range(0) * 1024;
+    std::vector<uint8_t> frame = test_jpeg;
+    if (frame.empty())
+    {
+        frame.assign(100 * 1024, 0x55);
+    }
+    const char *dir = getenv("TMPDIR");
+    std::string path = std::string(dir != nullptr ? dir : "/tmp") + "/camera_bench_" + std::to_string(getpid()) + ".avi";
+
+    avi_writer *w = nullptr;
+    int64_t timestamp = 0;
+    for (auto _ : state)
+    {
+        if (w == nullptr || avi_full(w))
+        {
+            if (w != nullptr)
+            {
+                avi_close(w);
+            }
+            w = avi_open(path.c_str(), 1024, 768, 256, batch_size);
+            if (w == nullptr)
+            {
+                state.SkipWithError("cannot open the file");
+                return;
+            }
+        }
+        timestamp += 40000;
+        if (!avi_add_frame(w, frame.data(), frame.size(), timestamp))
+        {
+            state.SkipWithError("write failed");
+            break;
+        }
+    }
+    if (w != nullptr)
+    {
+        avi_close(w);
+    }
+    unlink(path.c_str());
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * frame.size());
+}
+BENCHMARK(BM_AviWrite)->Arg(4)->Arg(32)->ArgName("batch_kb")->UseRealTime();
+
+// The text of the status page with every module's lines, as /status renders it
+static void BM_StatusPrintInfo(benchmark::State &state)
+{
+    for (auto _ : state)
+    {
+        page_len = 0;
+        status_print_info(page_printf);
+        benchmark::DoNotOptimize(page);
+    }
+    state.counters["bytes"] = page_len;
+}
+BENCHMARK(BM_StatusPrintInfo);
+
+// A whole /metrics response, written to a client
+static void BM_MetricsScrape(benchmark::State &state)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+    {
+        state.SkipWithError("socketpair failed");
+        return;
+    }
+    std::thread reader([fd = fds[1]]
+    {
+        char buf[16 * 1024];
+        while (read(fd, buf, sizeof(buf)) > 0)
+        {
+        }
+    });
+
+    for (auto _ : state)
+    {
+        host_httpd_request(server, fds[0], "/metrics");
+    }
+
+    close(fds[0]);
+    reader.join();
+    close(fds[1]);
+}
+BENCHMARK(BM_MetricsScrape);
+
+int main(int argc, char **argv)
+{
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    {
+        return 1;
+    }
+    if (!setup())
+    {
+        fprintf(stderr, "setup failed\n");
+        return 1;
+    }
+
+    const char *replay_path = getenv("CAMERA_REPLAY");
+    load_test_jpeg(replay_path);
+    if (replay_path != nullptr)
+    {
+        benchmark::RegisterBenchmark("BM_ReplayStream", BM_ReplayStream, replay_path)->Arg(1)->Arg(4)->ArgName("clients")->UseRealTime();
+        benchmark::AddCustomContext("replay", replay_path);
+    }
+
+    benchmark::AddCustomContext("firmware", CAMERA_VERSION);
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    fflush(nullptr);
+    // the tasks never return so there is no tidy way down
+    _exit(0);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "esp_err.h"
+#include "rom/gpio.h"
+
+#define SDMMC_HOST_SLOT_1 1
+#define SDMMC_FREQ_DEFAULT 20000
+#define SDMMC_FREQ_HIGHSPEED 40000
+
+typedef struct
+{
+    int slot;
+    int max_freq_khz;
+} sdmmc_host_t;
+
+typedef struct
+{
+    int clk;
+    int cmd;
+    int d0;
+    int d1;
+    int d2;
+    int d3;
+    uint8_t width;
+    uint32_t flags;
+} sdmmc_slot_config_t;
+
+typedef struct sdmmc_card_t sdmmc_card_t;
+
+#define SDMMC_HOST_DEFAULT() sdmmc_host_t{ SDMMC_HOST_SLOT_1, SDMMC_FREQ_DEFAULT }
+#define SDMMC_SLOT_CONFIG_DEFAULT() sdmmc_slot_config_t{ -1, -1, -1, -1, -1, -1, 4, 0 }
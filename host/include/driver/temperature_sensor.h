@@ -0,0 +1,16 @@
+#pragma once
+
+#include "esp_err.h"
+
+typedef struct temperature_sensor_obj_t *temperature_sensor_handle_t;
+
+typedef struct
+{
+    int range_min;
+    int range_max;
+} temperature_sensor_config_t;
+
+// Reads a steady 40C
+esp_err_t temperature_sensor_install(const temperature_sensor_config_t *config, temperature_sensor_handle_t *out_handle);
+esp_err_t temperature_sensor_enable(temperature_sensor_handle_t handle);
+esp_err_t temperature_sensor_get_celsius(temperature_sensor_handle_t handle, float *out_celsius);
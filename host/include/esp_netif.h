@@ -0,0 +1,6 @@
+#pragma once
+
+#include "esp_netif_types.h"
+
+esp_err_t esp_netif_init(void);
+esp_err_t esp_netif_get_hostname(esp_netif_t *esp_netif, const char **hostname);
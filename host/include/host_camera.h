@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Controls for the stand-in sensor. It hands out copies of the image it was last given, stamped
+// with the time they are taken, and keeps to the fb_count buffers of camera_config_t.
+void host_camera_set_image(const uint8_t *jpeg, size_t len);
+
+// An image shaped like a frame from the sensor: SOI, JFIF APP0, SOF0 and SOS headers then filler
+// for the entropy coded data and EOI. Nothing that sends frames decodes them.
+void host_camera_set_test_image(size_t len, int width, int height);
+
+// When triggered esp_camera_fb_get waits for a host_camera_trigger call for each frame, otherwise
+// frames come back as soon as a buffer is free
+void host_camera_set_triggered(bool triggered);
+void host_camera_trigger();
+
+// Untriggered frames come no faster than this, as from the sensor. 0, the default, for no limit.
+void host_camera_set_fps(int fps);
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "esp_http_server.h"
+
+// Runs the handler registered for the uri, which may carry a query string, as a GET arriving on
+// sockfd, and waits for it to return. The handler is called on the httpd task. Sockets handed back to httpd by the
+// handler are closed through the server's close_fn when httpd_sess_trigger_close is called for
+// them or when host_httpd_close is.
+esp_err_t host_httpd_request(httpd_handle_t handle, int sockfd, const char *uri);
+void host_httpd_close(httpd_handle_t handle, int sockfd);
+
+// Waits until every piece of work queued so far has run
+void host_httpd_wait_idle(httpd_handle_t handle);
@@ -0,0 +1,13 @@
+#pragma once
+
+// lwip's socket API follows POSIX so the host's own is used
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "sdkconfig.h"
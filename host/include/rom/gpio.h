@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef enum
+{
+    GPIO_NUM_4 = 4,
+    GPIO_NUM_21 = 21,
+    GPIO_NUM_38 = 38,
+    GPIO_NUM_39 = 39,
+    GPIO_NUM_40 = 40,
+} gpio_num_t;
+
+typedef enum
+{
+    GPIO_MODE_INPUT = 1,
+    GPIO_MODE_OUTPUT = 2,
+} gpio_mode_t;
+
+void gpio_pad_select_gpio(uint32_t gpio_num);
+int gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode);
+int gpio_set_level(gpio_num_t gpio_num, uint32_t level);
@@ -0,0 +1,9 @@
+#pragma once
+
+// The settings main depends on, as sdkconfig.esp32s3 has them
+#define CONFIG_IDF_TARGET "esp32s3"
+#define CONFIG_IDF_TARGET_ESP32S3 1
+#define CONFIG_LWIP_MAX_SOCKETS 16
+#define CONFIG_HTTPD_WS_SUPPORT 1
+#define CONFIG_SOC_TEMP_SENSOR_SUPPORTED 1
+#define CONFIG_FREERTOS_HZ 1000
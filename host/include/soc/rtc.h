@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef struct
+{
+    int source;
+    uint32_t source_freq_mhz;
+    uint32_t div;
+    uint32_t freq_mhz;
+} rtc_cpu_freq_config_t;
+
+void rtc_clk_cpu_freq_get_config(rtc_cpu_freq_config_t *out_config);
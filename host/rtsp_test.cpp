@@ -0,0 +1,540 @@
+// Plays RTSP clients against main/rtsp.cpp, one taking RTP over UDP and one interleaved on the
+// RTSP connection, while a /stream client takes the same frames. The camera replays an AVI of
+// frames made here, and every frame put back together from the RTP/JPEG packets is checked
+// against the frame it came from. Prints how long frames took from capture to arriving at each
+// client. Run by ctest, exits non-zero if any check fails.
+#include "avi.h"
+#include "camera.h"
+#include "capture.h"
+#include "esp_timer.h"
+#include "freertos/timers.h"
+#include "host_httpd.h"
+#include "lwip/sockets.h"
+#include "rate.h"
+#include "replay.h"
+#include "rtsp.h"
+#include "session.h"
+#include "stream.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define TEST_FRAMES 8
+#define TEST_SECONDS 3
+#define TEST_MIN_FRAMES 20         // of the 75 or so replayed in that time
+#define TEST_UDP_PACKET_MAX 1400   // RTP packet, as RTSP_UDP_PACKET
+
+static int n_failed;
+
+#define CHECK(cond) \
+    do { if (!(cond)) { fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); ++n_failed; return; } } while (0)
+
+// A frame as the sensor would give it: the two quantization tables, SOF0 for 640x480 4:2:0, the
+// scan header and scan data that starts with the frame's number and has no markers in it
+struct source_frame
+{
+    std::vector<uint8_t> jpeg;
+    std::vector<uint8_t> qtables;
+    std::vector<uint8_t> scan;
+};
+
+static std::vector<source_frame> sources;
+
+static source_frame make_frame(int i, size_t scan_len)
+{
+    source_frame f;
+    for (int j = 0; j < 128; ++j)
+    {
+        f.qtables.push_back(1 + (i * 3 + j) % 60);
+    }
+    f.scan.resize(scan_len);
+    for (size_t j = 0; j < scan_len; ++j)
+    {
+        f.scan[j] = (i * 131 + j * 29 + (j >> 7)) % 255;
+    }
+    f.scan[0] = i;
+
+    const uint8_t sof_sos[] =
+    {
+        0xff, 0xc0, 0x00, 0x11, 0x08, 480 >> 8, 480 & 0xff, 640 >> 8, 640 & 0xff,
+        0x03, 0x01, 0x21, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11, 0x01,
+        0xff, 0xda, 0x00, 0x0c, 0x03, 0x01, 0x00, 0x02, 0x11, 0x03, 0x11, 0x00, 0x3f, 0x00,
+    };
+    f.jpeg = { 0xff, 0xd8, 0xff, 0xdb, 0x00, 2 + 2 * 65, 0x00 };
+    f.jpeg.insert(f.jpeg.end(), f.qtables.begin(), f.qtables.begin() + 64);
+    f.jpeg.push_back(0x01);
+    f.jpeg.insert(f.jpeg.end(), f.qtables.begin() + 64, f.qtables.end());
+    f.jpeg.insert(f.jpeg.end(), sof_sos, sof_sos + sizeof(sof_sos));
+    f.jpeg.insert(f.jpeg.end(), f.scan.begin(), f.scan.end());
+    f.jpeg.push_back(0xff);
+    f.jpeg.push_back(0xd9);
+    return f;
+}
+
+static std::string temp_path(const char *name)
+{
+    const char *dir = getenv("TMPDIR");
+    return std::string(dir != nullptr ? dir : "/tmp") + "/" + name + "_" + std::to_string(getpid()) + ".avi";
+}
+
+// Sizes from one packet to several interleaved ones
+static bool write_recording(const std::string &path)
+{
+    avi_writer *w = avi_open(path.c_str(), 640, 480, TEST_FRAMES, 4096);
+    if (w == nullptr)
+    {
+        return false;
+    }
+    for (int i = 0; i < TEST_FRAMES; ++i)
+    {
+        sources.push_back(make_frame(i, 900 + i * 7919));
+        avi_add_frame(w, sources.back().jpeg.data(), sources.back().jpeg.size(), i * 40000);
+    }
+    return avi_close(w);
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+    return p[0] << 8 | p[1];
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static double median_ms(std::vector<int64_t> us)
+{
+    if (us.empty())
+    {
+        return 0;
+    }
+    std::sort(us.begin(), us.end());
+    return us[us.size() / 2] / 1000.0;
+}
+
+static void print_latency(const char *name, unsigned int frames, const std::vector<int64_t> &us)
+{
+    printf("%-6s %4u frames, capture to client median %.2f ms max %.2f ms\n", name, frames, median_ms(us),
+           us.empty() ? 0 : *std::max_element(us.begin(), us.end()) / 1000.0);
+}
+
+// Puts frames back together from RTP/JPEG packets (RFC 2435) and checks each against its source
+struct rtp_receiver
+{
+    const char *name;
+    unsigned int checked = 0;
+    unsigned int lost = 0;
+    unsigned int bad = 0;
+    size_t largest_packet = 0;
+    std::vector<int64_t> latency_us;
+
+    bool have_seq = false;
+    uint16_t last_seq = 0;
+    bool in_frame = false;
+    bool broken = false;
+    uint32_t timestamp = 0;
+    size_t received = 0;
+    std::vector<uint8_t> scan;
+    std::vector<uint8_t> qtables;
+
+    void packet(const uint8_t *p, size_t len);
+    void check_frame();
+};
+
+void rtp_receiver::packet(const uint8_t *p, size_t len)
+{
+    largest_packet = std::max(largest_packet, len);
+    if (len < 20 || p[0] != 0x80 || (p[1] & 0x7f) != 26)
+    {
+        fprintf(stderr, "%s: not an RTP/JPEG packet\n", name);
+        ++bad;
+        return;
+    }
+
+    uint16_t seq = get16(p + 2);
+    if (have_seq && seq != (uint16_t)(last_seq + 1))
+    {
+        broken = true;
+    }
+    have_seq = true;
+    last_seq = seq;
+
+    uint32_t ts = get32(p + 4);
+    size_t offset = p[13] << 16 | p[14] << 8 | p[15];
+    if (!in_frame || ts != timestamp)
+    {
+        if (in_frame)
+        {
+            ++lost;
+        }
+        // a gap before the first packet of a frame is the end of the one before
+        in_frame = true;
+        broken = offset != 0;
+        timestamp = ts;
+        received = 0;
+        scan.clear();
+        qtables.clear();
+    }
+
+    uint8_t type = p[16];
+    size_t n = 20;
+    if (type >= 64)
+    {
+        n += 4;
+    }
+    if (offset == 0 && p[17] >= 128)
+    {
+        size_t qtables_len = get16(p + n + 2);
+        qtables.assign(p + n + 4, p + n + 4 + qtables_len);
+        n += 4 + qtables_len;
+    }
+    if (n > len || (type & 63) != 0 || p[18] != 640 / 8 || p[19] != 480 / 8)
+    {
+        fprintf(stderr, "%s: bad JPEG header\n", name);
+        ++bad;
+        return;
+    }
+
+    scan.resize(std::max(scan.size(), offset + len - n));
+    memcpy(scan.data() + offset, p + n, len - n);
+    received += len - n;
+
+    if (p[1] & 0x80)
+    {
+        if (broken || received != scan.size())
+        {
+            ++lost;
+        }
+        else
+        {
+            check_frame();
+        }
+        in_frame = false;
+        broken = false;
+    }
+}
+
+void rtp_receiver::check_frame()
+{
+    uint32_t now = (uint32_t)(esp_timer_get_time() * 9 / 100);
+    latency_us.push_back((int64_t)(uint32_t)(now - timestamp) * 100 / 9);
+
+    if (scan.empty() || scan[0] >= sources.size() || scan != sources[scan[0]].scan || qtables != sources[scan[0]].qtables)
+    {
+        fprintf(stderr, "%s: frame does not match its source\n", name);
+        ++bad;
+        return;
+    }
+    ++checked;
+}
+
+// An RTSP connection, with what has been read past the last reply kept for the interleaved data
+struct rtsp_client
+{
+    int fd = -1;
+    int cseq = 0;
+    std::string input;
+    std::string session;
+
+    bool connect_server();
+    bool request(const char *method, const char *headers, std::string *reply);
+    bool read_more();
+};
+
+bool rtsp_client::connect_server()
+{
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(RTSP_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    struct timeval tv{ 1, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0;
+}
+
+bool rtsp_client::read_more()
+{
+    char buf[16 * 1024];
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n <= 0)
+    {
+        return false;
+    }
+    input.append(buf, n);
+    return true;
+}
+
+bool rtsp_client::request(const char *method, const char *headers, std::string *reply)
+{
+    char buf[512];
+    int len = snprintf(buf, sizeof(buf), "%s rtsp://127.0.0.1:%d/ RTSP/1.0\r\nCSeq: %d\r\n%s%s%s%s\r\n", method, RTSP_PORT, ++cseq,
+                       headers, session.empty() ? "" : "Session: ", session.c_str(), session.empty() ? "" : "\r\n");
+    if (write(fd, buf, len) != len)
+    {
+        return false;
+    }
+
+    size_t end;
+    while ((end = input.find("\r\n\r\n")) == std::string::npos)
+    {
+        if (!read_more())
+        {
+            return false;
+        }
+    }
+    *reply = input.substr(0, end + 4);
+    input.erase(0, end + 4);
+
+    size_t pos = reply->find("Session: ");
+    if (pos != std::string::npos)
+    {
+        session = reply->substr(pos + 9, reply->find_first_of(";\r", pos) - pos - 9);
+    }
+    return reply->compare(0, 15, "RTSP/1.0 200 OK") == 0;
+}
+
+static bool play(rtsp_client &c, const char *transport)
+{
+    std::string reply;
+    if (!c.connect_server() || !c.request("OPTIONS", "", &reply) || !c.request("DESCRIBE", "Accept: application/sdp\r\n", &reply))
+    {
+        return false;
+    }
+    // the SDP body
+    while (c.input.find("track0\r\n") == std::string::npos && c.read_more())
+    {
+    }
+    c.input.erase(0, c.input.find("track0\r\n") + 8);
+    return c.request("SETUP", transport, &reply) && c.request("PLAY", "Range: npt=0.000-\r\n", &reply);
+}
+
+static void teardown(rtsp_client &c)
+{
+    char buf[256];
+    int len = snprintf(buf, sizeof(buf), "TEARDOWN rtsp://127.0.0.1:%d/ RTSP/1.0\r\nCSeq: %d\r\nSession: %s\r\n\r\n", RTSP_PORT, ++c.cseq,
+                       c.session.c_str());
+    write(c.fd, buf, len);
+    close(c.fd);
+}
+
+static void run_udp(rtp_receiver *r, int64_t until)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+    int size = 4 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    struct timeval tv{ 0, 200000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+    getsockname(fd, reinterpret_cast<struct sockaddr *>(&addr), &addr_len);
+
+    rtsp_client c;
+    char transport[96];
+    int port = ntohs(addr.sin_port);
+    snprintf(transport, sizeof(transport), "Transport: RTP/AVP;unicast;client_port=%d-%d\r\n", port, port + 1);
+    if (!play(c, transport))
+    {
+        fprintf(stderr, "udp: RTSP setup failed\n");
+        ++r->bad;
+        close(fd);
+        return;
+    }
+
+    static uint8_t buf[64 * 1024];
+    while (esp_timer_get_time() < until)
+    {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n > 0)
+        {
+            r->packet(buf, n);
+        }
+    }
+    teardown(c);
+    close(fd);
+}
+
+static void run_tcp(rtp_receiver *r, int64_t until)
+{
+    rtsp_client c;
+    if (!play(c, "Transport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n"))
+    {
+        fprintf(stderr, "tcp: RTSP setup failed\n");
+        ++r->bad;
+        return;
+    }
+
+    while (esp_timer_get_time() < until)
+    {
+        if (c.input.size() >= 4 && c.input[0] == '$')
+        {
+            size_t len = get16(reinterpret_cast<const uint8_t *>(c.input.data()) + 2);
+            if (c.input.size() >= 4 + len)
+            {
+                if (c.input[1] == 0)
+                {
+                    r->packet(reinterpret_cast<const uint8_t *>(c.input.data()) + 4, len);
+                }
+                c.input.erase(0, 4 + len);
+                continue;
+            }
+        }
+        else if (!c.input.empty())
+        {
+            fprintf(stderr, "tcp: unexpected data on the connection\n");
+            ++r->bad;
+            break;
+        }
+        c.read_more();
+    }
+    teardown(c);
+}
+
+// Reads a /stream response, taking the capture time from each part's headers
+static void run_stream(httpd_handle_t server, unsigned int *frames, std::vector<int64_t> *latency_us, int64_t until)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0 || host_httpd_request(server, fds[0], "/stream") != ESP_OK)
+    {
+        fprintf(stderr, "stream request failed\n");
+        return;
+    }
+    struct timeval tv{ 0, 200000 };
+    setsockopt(fds[1], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    std::string input;
+    char buf[64 * 1024];
+    while (esp_timer_get_time() < until)
+    {
+        ssize_t n = read(fds[1], buf, sizeof(buf));
+        if (n <= 0)
+        {
+            continue;
+        }
+        input.append(buf, n);
+
+        // part headers in a chunk of their own then the image in the next
+        for (;;)
+        {
+            size_t pos = input.find("X-Capture-Time: ");
+            size_t end = pos == std::string::npos ? pos : input.find("\r\n\r\n\r\n", pos);
+            size_t body = end == std::string::npos ? end : input.find("\r\n", end + 6);
+            if (body == std::string::npos)
+            {
+                break;
+            }
+            size_t len = strtoul(input.c_str() + end + 6, nullptr, 16);
+            if (input.size() < body + 2 + len)
+            {
+                break;
+            }
+            int64_t capture_time = (int64_t)(strtod(input.c_str() + pos + 16, nullptr) * 1000000);
+            latency_us->push_back(capture_wall_time(esp_timer_get_time()) - capture_time);
+            ++*frames;
+            input.erase(0, body + 2 + len);
+        }
+    }
+    host_httpd_close(server, fds[0]);
+    close(fds[1]);
+}
+
+static void server_close_fn(httpd_handle_t, int sockfd)
+{
+    session_closed(sockfd);
+    stream_remove_sink(sockfd);
+    close(sockfd);
+}
+
+static void check_rtp(const rtp_receiver &r, bool udp)
+{
+    printf("%-6s %4u frames checked, %u lost, largest packet %zu bytes\n", r.name, r.checked, r.lost, r.largest_packet);
+    print_latency(r.name, r.checked, r.latency_us);
+    CHECK(r.bad == 0);
+    CHECK(r.checked >= TEST_MIN_FRAMES);
+    // nothing is lost over TCP, and UDP packets stay inside an ethernet frame
+    CHECK(udp || r.lost == 0);
+    CHECK(!udp || r.largest_packet <= TEST_UDP_PACKET_MAX);
+}
+
+int main()
+{
+    // the status and rate events have nobody to go to
+    host_timers_enable(false);
+
+    std::string path = temp_path("rtsp");
+    httpd_handle_t server = nullptr;
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 0;
+    config.max_open_sockets = SESSION_MAX_OPEN;
+    config.open_fn = session_open;
+    config.close_fn = server_close_fn;
+    if (!write_recording(path) || trace_init() != ESP_OK || camera_init() != ESP_OK || capture_init() != ESP_OK || stream_init() != ESP_OK || rate_init() != ESP_OK ||
+        replay_init() != ESP_OK || session_init() != ESP_OK || rtsp_init() != ESP_OK || httpd_start(&server, &config) != ESP_OK)
+    {
+        fprintf(stderr, "setup failed\n");
+        unlink(path.c_str());
+        return 1;
+    }
+
+    httpd_uri_t stream{};
+    stream.uri = "/stream";
+    stream.method = HTTP_GET;
+    stream.handler = stream_handler;
+    httpd_register_uri_handler(server, &stream);
+
+    replay_config replay{};
+    replay.path = path.c_str();
+    replay.fps = 25;
+    replay.loop = true;
+    if (replay_start(&replay) != ESP_OK)
+    {
+        fprintf(stderr, "replay failed\n");
+        unlink(path.c_str());
+        return 1;
+    }
+
+    rtp_receiver udp{ "udp" };
+    rtp_receiver tcp{ "tcp" };
+    unsigned int stream_frames = 0;
+    std::vector<int64_t> stream_latency_us;
+    int64_t until = esp_timer_get_time() + TEST_SECONDS * 1000000ll;
+    std::thread udp_thread(run_udp, &udp, until);
+    std::thread tcp_thread(run_tcp, &tcp, until);
+    std::thread stream_thread(run_stream, server, &stream_frames, &stream_latency_us, until);
+    udp_thread.join();
+    tcp_thread.join();
+    stream_thread.join();
+    replay_stop();
+    unlink(path.c_str());
+
+    check_rtp(udp, true);
+    check_rtp(tcp, false);
+    print_latency("stream", stream_frames, stream_latency_us);
+    if (stream_frames < TEST_MIN_FRAMES)
+    {
+        fprintf(stderr, "stream: only %u frames\n", stream_frames);
+        ++n_failed;
+    }
+
+    fflush(nullptr);
+    if (n_failed != 0)
+    {
+        fprintf(stderr, "%d checks failed\n", n_failed);
+        _exit(1);
+    }
+    printf("rtsp ok\n");
+    // the tasks never return so there is no tidy way down
+    _exit(0);
+}
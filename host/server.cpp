@@ -0,0 +1,28 @@
+// Runs the firmware's app_main on the host, with the server listening on CAMERA_HTTP_PORT (8080
+// if that is not set) so browsers and tools/loadgen.py can be pointed at it as at a board. The
+// stand-in sensor gives a test image of CAMERA_HOST_FRAME_KB (48) at CAMERA_HOST_FPS (25), use
+// /replay for real frames.
+#include "host_camera.h"
+
+#include <signal.h>
+#include <stdlib.h>
+
+extern "C" void app_main(void);
+
+static int env_int(const char *name, int value)
+{
+    const char *s = getenv(name);
+    return s != nullptr ? atoi(s) : value;
+}
+
+int main()
+{
+    setenv("CAMERA_HTTP_PORT", "8080", 0);
+    // lwip reports a send to a closed connection as an error, it does not kill the task
+    signal(SIGPIPE, SIG_IGN);
+    // the size camera_init starts the sensor at
+    host_camera_set_test_image(env_int("CAMERA_HOST_FRAME_KB", 48) * 1024, 1024, 768);
+    host_camera_set_fps(env_int("CAMERA_HOST_FPS", 25));
+    app_main();
+    return 0;
+}
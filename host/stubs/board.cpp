@@ -0,0 +1,48 @@
+#include "esp_netif.h"
+#include "esp_http_server.h"
+#include "ota.h"
+#include "wifi.h"
+
+#include <string.h>
+
+// wifi.cpp and ota.cpp drive the radio and the flash so the host has these in their place
+
+char wifi_ssid[33] = "host";
+
+void wifi_init_sta(const char *, bool)
+{
+}
+
+esp_netif_t *wifi_get_netif()
+{
+    return nullptr;
+}
+
+void wifi_reconnect()
+{
+}
+
+void ota_add_endpoints(httpd_handle_t)
+{
+}
+
+void ota_start(void)
+{
+}
+
+void ota_mark_valid()
+{
+}
+
+void ota_send_reboot_page(httpd_req_t *req, const char *msg)
+{
+    httpd_resp_send(req, msg, HTTPD_RESP_USE_STRLEN);
+}
+
+void ota_get_partition_hashes(char *boot_hash, char *current_partition_hash)
+{
+    memset(boot_hash, '0', 64);
+    boot_hash[64] = '\0';
+    memset(current_partition_hash, '0', 64);
+    current_partition_hash[64] = '\0';
+}
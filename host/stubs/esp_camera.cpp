@@ -0,0 +1,265 @@
+#include "esp_camera.h"
+#include "esp_timer.h"
+#include "host_camera.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+const resolution_info_t resolution[] =
+{
+    { 96, 96 },
+    { 160, 120 },
+    { 176, 144 },
+    { 240, 176 },
+    { 240, 240 },
+    { 320, 240 },
+    { 400, 296 },
+    { 480, 320 },
+    { 640, 480 },
+    { 800, 600 },
+    { 1024, 768 },
+    { 1280, 720 },
+    { 1280, 1024 },
+    { 1600, 1200 },
+};
+
+struct host_fb
+{
+    camera_fb_t fb;
+    std::vector<uint8_t> data;
+    unsigned int generation;    // of the image data holds
+    bool in_use;
+};
+
+static std::mutex mutex;
+static std::condition_variable cv;
+static std::vector<host_fb> fbs;
+static std::vector<uint8_t> image;
+static unsigned int generation;
+static bool triggered;
+static unsigned int triggers;
+static sensor_t sensor;
+static bool initialised;
+static std::atomic<int64_t> interval_us;
+static int64_t next_frame_us;   // only the capture task gets frames
+
+static int set_pixformat(sensor_t *s, pixformat_t pixformat)
+{
+    s->pixformat = pixformat;
+    return 0;
+}
+
+static int set_framesize(sensor_t *s, framesize_t framesize)
+{
+    s->status.framesize = framesize;
+    return 0;
+}
+
+static int set_contrast(sensor_t *s, int level)
+{
+    s->status.contrast = level;
+    return 0;
+}
+
+static int set_brightness(sensor_t *s, int level)
+{
+    s->status.brightness = level;
+    return 0;
+}
+
+static int set_saturation(sensor_t *s, int level)
+{
+    s->status.saturation = level;
+    return 0;
+}
+
+static int set_quality(sensor_t *s, int quality)
+{
+    s->status.quality = quality;
+    return 0;
+}
+
+static int set_special_effect(sensor_t *s, int effect)
+{
+    s->status.special_effect = effect;
+    return 0;
+}
+
+static int set_hmirror(sensor_t *s, int enable)
+{
+    s->status.hmirror = enable;
+    return 0;
+}
+
+static int set_vflip(sensor_t *s, int enable)
+{
+    s->status.vflip = enable;
+    return 0;
+}
+
+esp_err_t esp_camera_init(const camera_config_t *config)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    fbs = std::vector<host_fb>(config->fb_count);
+    sensor = sensor_t{};
+    sensor.id.PID = 0x26;   // OV2640
+    sensor.pixformat = config->pixel_format;
+    sensor.status.framesize = config->frame_size;
+    sensor.status.quality = config->jpeg_quality;
+    sensor.status.aec = 1;
+    sensor.status.agc = 1;
+    sensor.xclk_freq_hz = config->xclk_freq_hz;
+    sensor.set_pixformat = set_pixformat;
+    sensor.set_framesize = set_framesize;
+    sensor.set_contrast = set_contrast;
+    sensor.set_brightness = set_brightness;
+    sensor.set_saturation = set_saturation;
+    sensor.set_quality = set_quality;
+    sensor.set_special_effect = set_special_effect;
+    sensor.set_hmirror = set_hmirror;
+    sensor.set_vflip = set_vflip;
+    initialised = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_camera_deinit(void)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    fbs.clear();
+    initialised = false;
+    return ESP_OK;
+}
+
+sensor_t *esp_camera_sensor_get(void)
+{
+    return initialised ? &sensor : nullptr;
+}
+
+// The image is copied into a buffer only when it has changed since the buffer last held it, so
+// the cost of a frame is the driver's hand over and nothing like a copy the board does not make
+camera_fb_t *esp_camera_fb_get(void)
+{
+    int64_t interval = interval_us.load();
+    if (interval > 0 && !triggered)
+    {
+        int64_t now = esp_timer_get_time();
+        if (next_frame_us > now)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(next_frame_us - now));
+        }
+        next_frame_us = std::max(next_frame_us + interval, now);
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    host_fb *free_fb = nullptr;
+    cv.wait(lock, [&free_fb]
+    {
+        if (!initialised || image.empty() || (triggered && triggers == 0))
+        {
+            return false;
+        }
+        for (auto &f : fbs)
+        {
+            if (!f.in_use)
+            {
+                free_fb = &f;
+                return true;
+            }
+        }
+        return false;
+    });
+    if (triggered)
+    {
+        --triggers;
+    }
+
+    free_fb->in_use = true;
+    if (free_fb->generation != generation)
+    {
+        free_fb->data = image;
+        free_fb->generation = generation;
+    }
+
+    int64_t now = esp_timer_get_time();
+    camera_fb_t &fb = free_fb->fb;
+    fb.buf = free_fb->data.data();
+    fb.len = free_fb->data.size();
+    fb.width = resolution[sensor.status.framesize].width;
+    fb.height = resolution[sensor.status.framesize].height;
+    fb.format = sensor.pixformat;
+    fb.timestamp.tv_sec = now / 1000000;
+    fb.timestamp.tv_usec = now % 1000000;
+    return &fb;
+}
+
+void esp_camera_fb_return(camera_fb_t *fb)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto &f : fbs)
+        {
+            if (&f.fb == fb)
+            {
+                f.in_use = false;
+            }
+        }
+    }
+    cv.notify_all();
+}
+
+void host_camera_set_image(const uint8_t *jpeg, size_t len)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        image.assign(jpeg, jpeg + len);
+        ++generation;
+    }
+    cv.notify_all();
+}
+
+void host_camera_set_triggered(bool on)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        triggered = on;
+        triggers = 0;
+    }
+    cv.notify_all();
+}
+
+void host_camera_trigger()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++triggers;
+    }
+    cv.notify_all();
+}
+
+void host_camera_set_test_image(size_t len, int width, int height)
+{
+    const uint8_t head[] =
+    {
+        0xff, 0xd8,
+        0xff, 0xe0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00,
+        0xff, 0xc0, 0x00, 0x11, 0x08, uint8_t(height >> 8), uint8_t(height), uint8_t(width >> 8), uint8_t(width),
+        0x03, 0x01, 0x21, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11, 0x01,
+        0xff, 0xda, 0x00, 0x0c, 0x03, 0x01, 0x00, 0x02, 0x11, 0x03, 0x11, 0x00, 0x3f, 0x00,
+    };
+    std::vector<uint8_t> jpeg(head, head + sizeof(head));
+    jpeg.resize(std::max(len, sizeof(head) + 2) - 2, 0x55);
+    jpeg.push_back(0xff);
+    jpeg.push_back(0xd9);
+    host_camera_set_image(jpeg.data(), jpeg.size());
+}
+
+void host_camera_set_fps(int fps)
+{
+    interval_us = fps > 0 ? 1000000 / fps : 0;
+}
@@ -0,0 +1,384 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Nothing here is ever freed, as on the board tasks and their objects live for the whole run
+
+struct host_task
+{
+    std::string name;
+    UBaseType_t priority;
+    uint32_t stack_depth;
+    BaseType_t core_id;
+    std::mutex mutex;
+    std::condition_variable cv;
+    uint32_t notified;
+};
+
+struct host_semaphore
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    UBaseType_t count;
+    UBaseType_t max_count;
+};
+
+struct host_spinlock
+{
+    std::mutex mutex;
+};
+
+struct host_timer
+{
+    std::string name;
+    TickType_t period;
+    bool auto_reload;
+    void *id;
+    TimerCallbackFunction_t callback;
+    bool active;
+    std::chrono::steady_clock::time_point due;
+};
+
+struct host_event_group
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    EventBits_t bits;
+};
+
+static std::mutex tasks_mutex;
+static std::vector<host_task *> tasks;
+static thread_local host_task *current_task = nullptr;
+
+static const auto start_time = std::chrono::steady_clock::now();
+
+// Threads the program did not start through xTaskCreate, main included, get a task the first
+// time they need one
+static host_task *self()
+{
+    if (current_task == nullptr)
+    {
+        current_task = new host_task{ "host", 1, 0, 0, {}, {}, 0 };
+        std::lock_guard<std::mutex> lock(tasks_mutex);
+        tasks.push_back(current_task);
+    }
+    return current_task;
+}
+
+// Runs pred under lock until it is true or the ticks have gone, portMAX_DELAY waits for ever
+template <typename Pred>
+static bool wait_for(std::unique_lock<std::mutex> &lock, std::condition_variable &cv, TickType_t ticks, Pred pred)
+{
+    if (ticks == portMAX_DELAY)
+    {
+        cv.wait(lock, pred);
+        return true;
+    }
+    return cv.wait_for(lock, std::chrono::milliseconds(ticks * portTICK_PERIOD_MS), pred);
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t stack_depth, void *arg, UBaseType_t priority,
+                                   TaskHandle_t *created, BaseType_t core_id)
+{
+    auto *task = new host_task{ name, priority, stack_depth, core_id == tskNO_AFFINITY ? 0 : core_id, {}, {}, 0 };
+    {
+        std::lock_guard<std::mutex> lock(tasks_mutex);
+        tasks.push_back(task);
+    }
+    if (created != nullptr)
+    {
+        *created = task;
+    }
+    std::thread([task, code, arg]()
+    {
+        current_task = task;
+        code(arg);
+    }).detach();
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack_depth, void *arg, UBaseType_t priority, TaskHandle_t *created)
+{
+    return xTaskCreatePinnedToCore(code, name, stack_depth, arg, priority, created, tskNO_AFFINITY);
+}
+
+// Only a task deleting itself is supported, which is all main does
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task == nullptr || task == current_task)
+    {
+        for (;;)
+        {
+            std::this_thread::sleep_for(std::chrono::hours(1));
+        }
+    }
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks * portTICK_PERIOD_MS));
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    auto elapsed = std::chrono::steady_clock::now() - start_time;
+    return std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() / portTICK_PERIOD_MS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return self();
+}
+
+BaseType_t xPortGetCoreID(void)
+{
+    return self()->core_id;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+    host_task *task = self();
+    std::unique_lock<std::mutex> lock(task->mutex);
+    wait_for(lock, task->cv, ticks_to_wait, [task] { return task->notified != 0; });
+    uint32_t value = task->notified;
+    if (value != 0)
+    {
+        task->notified = clear_on_exit ? 0 : value - 1;
+    }
+    return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    {
+        std::lock_guard<std::mutex> lock(task->mutex);
+        ++task->notified;
+    }
+    task->cv.notify_one();
+    return pdPASS;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    return task != nullptr ? task->stack_depth : self()->stack_depth;
+}
+
+UBaseType_t uxTaskGetNumberOfTasks(void)
+{
+    std::lock_guard<std::mutex> lock(tasks_mutex);
+    return tasks.size();
+}
+
+// Same columns as FreeRTOS: name, state, priority, stack and number, under 50 bytes a line
+void vTaskList(char *buffer)
+{
+    std::lock_guard<std::mutex> lock(tasks_mutex);
+    char *p = buffer;
+    *p = '\0';
+    for (size_t i = 0; i < tasks.size(); ++i)
+    {
+        const host_task *task = tasks[i];
+        p += sprintf(p, "%-16.16s\tB\t%u\t%u\t%u\n", task->name.c_str(), task->priority, (unsigned)task->stack_depth, (unsigned)i + 1);
+    }
+}
+
+void portENTER_CRITICAL(portMUX_TYPE *mux)
+{
+    static std::mutex init_mutex;
+    {
+        std::lock_guard<std::mutex> lock(init_mutex);
+        if (mux->lock == nullptr)
+        {
+            mux->lock = new host_spinlock;
+        }
+    }
+    mux->lock->mutex.lock();
+}
+
+void portEXIT_CRITICAL(portMUX_TYPE *mux)
+{
+    mux->lock->mutex.unlock();
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count)
+{
+    return new host_semaphore{ {}, {}, initial_count, max_count };
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return xSemaphoreCreateCounting(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return xSemaphoreCreateCounting(1, 0);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait)
+{
+    std::unique_lock<std::mutex> lock(semaphore->mutex);
+    if (!wait_for(lock, semaphore->cv, ticks_to_wait, [semaphore] { return semaphore->count != 0; }))
+    {
+        return pdFALSE;
+    }
+    --semaphore->count;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    {
+        std::lock_guard<std::mutex> lock(semaphore->mutex);
+        if (semaphore->count == semaphore->max_count)
+        {
+            return pdFALSE;
+        }
+        ++semaphore->count;
+    }
+    semaphore->cv.notify_one();
+    return pdTRUE;
+}
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    return new host_event_group{ {}, {}, 0 };
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    EventBits_t value;
+    {
+        std::lock_guard<std::mutex> lock(group->mutex);
+        group->bits |= bits;
+        value = group->bits;
+    }
+    group->cv.notify_all();
+    return value;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    std::lock_guard<std::mutex> lock(group->mutex);
+    EventBits_t value = group->bits;
+    group->bits &= ~bits;
+    return value;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit, BaseType_t wait_for_all,
+                                TickType_t ticks_to_wait)
+{
+    std::unique_lock<std::mutex> lock(group->mutex);
+    auto done = [group, bits, wait_for_all]
+    {
+        return wait_for_all ? (group->bits & bits) == bits : (group->bits & bits) != 0;
+    };
+    bool met = wait_for(lock, group->cv, ticks_to_wait, done);
+    EventBits_t value = group->bits;
+    if (met && clear_on_exit)
+    {
+        group->bits &= ~bits;
+    }
+    return value;
+}
+
+// One service thread runs every callback, started with the first timer
+static std::mutex timers_mutex;
+static std::condition_variable timers_cv;
+static std::vector<host_timer *> timers;
+static bool timers_enabled = true;
+
+static void timer_service()
+{
+    std::unique_lock<std::mutex> lock(timers_mutex);
+    for (;;)
+    {
+        if (!timers_enabled)
+        {
+            timers_cv.wait(lock);
+            continue;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        auto next = now + std::chrono::hours(1);
+        host_timer *due = nullptr;
+        for (host_timer *timer : timers)
+        {
+            if (timer->active && timer->due <= now)
+            {
+                due = timer;
+                break;
+            }
+            if (timer->active)
+            {
+                next = std::min(next, timer->due);
+            }
+        }
+
+        if (due == nullptr)
+        {
+            timers_cv.wait_until(lock, next);
+            continue;
+        }
+
+        due->active = due->auto_reload;
+        due->due += std::chrono::milliseconds(due->period * portTICK_PERIOD_MS);
+        lock.unlock();
+        due->callback(due);
+        lock.lock();
+    }
+}
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t auto_reload, void *timer_id, TimerCallbackFunction_t callback)
+{
+    static std::once_flag started;
+    std::call_once(started, [] { xTaskCreate([](void *) { timer_service(); }, "Tmr Svc", 2048, nullptr, 1, nullptr); });
+
+    auto *timer = new host_timer{ name, period, auto_reload != pdFALSE, timer_id, callback, false, {} };
+    std::lock_guard<std::mutex> lock(timers_mutex);
+    timers.push_back(timer);
+    return timer;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t)
+{
+    {
+        std::lock_guard<std::mutex> lock(timers_mutex);
+        timer->active = true;
+        timer->due = std::chrono::steady_clock::now() + std::chrono::milliseconds(timer->period * portTICK_PERIOD_MS);
+    }
+    timers_cv.notify_all();
+    return pdPASS;
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t)
+{
+    std::lock_guard<std::mutex> lock(timers_mutex);
+    timer->active = false;
+    return pdPASS;
+}
+
+void *pvTimerGetTimerID(TimerHandle_t timer)
+{
+    return timer->id;
+}
+
+void host_timers_enable(bool enable)
+{
+    {
+        std::lock_guard<std::mutex> lock(timers_mutex);
+        timers_enabled = enable;
+    }
+    timers_cv.notify_all();
+}
@@ -0,0 +1,783 @@
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
+#include "host_httpd.h"
+#include "lwip/sockets.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string.h>
+#include <string>
+#include <strings.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#define TAG "httpd"
+
+#define HOST_MAX_REQ_LEN 8192
+
+// A connection taken by the listener. Its thread reads requests off it until the client goes or
+// the server closes the session.
+struct host_session
+{
+    int fd;
+    bool closed;
+    int64_t last_active;
+};
+
+struct host_server
+{
+    httpd_config_t config;
+    std::vector<std::pair<std::string, httpd_uri_t>> handlers;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::pair<httpd_work_fn_t, void *>> work;
+    bool busy;
+    int listen_fd;
+    std::map<int, std::shared_ptr<host_session>> sessions;
+    std::map<int, httpd_send_func_t> send_fns;
+};
+
+// A request as read off the socket, or made up by host_httpd_request
+struct host_request
+{
+    httpd_method_t method;
+    std::string uri;
+    std::vector<std::pair<std::string, std::string>> headers;
+};
+
+// What httpd keeps about a request while it is handled. The first member stands in for the
+// session pointer some handlers log.
+struct host_req_aux
+{
+    void *sd;
+    int fd;
+    std::string query;
+    std::vector<std::pair<std::string, std::string>> req_headers;
+    const char *status;
+    const char *content_type;
+    std::vector<std::pair<const char *, const char *>> headers;
+    bool chunked;
+};
+
+static host_server *server_of(httpd_handle_t handle)
+{
+    return static_cast<host_server *>(handle);
+}
+
+static host_req_aux *aux_of(httpd_req_t *r)
+{
+    return static_cast<host_req_aux *>(r->aux);
+}
+
+// Stands in for the httpd task, running queued work and requests one at a time
+static void httpd_task(void *arg)
+{
+    host_server *server = static_cast<host_server *>(arg);
+    std::unique_lock<std::mutex> lock(server->mutex);
+    for (;;)
+    {
+        server->cv.wait(lock, [server] { return !server->work.empty(); });
+        auto item = server->work.front();
+        server->work.pop_front();
+        server->busy = true;
+        lock.unlock();
+        item.first(item.second);
+        lock.lock();
+        server->busy = false;
+        server->cv.notify_all();
+    }
+}
+
+static void listen_task(host_server *server);
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config)
+{
+    auto *server = new host_server;
+    server->config = *config;
+    server->busy = false;
+    server->listen_fd = -1;
+
+    const char *port = getenv("CAMERA_HTTP_PORT");
+    if (port != nullptr && server->config.server_port != 0)
+    {
+        server->config.server_port = atoi(port);
+    }
+    if (server->config.server_port != 0)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        struct sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(server->config.server_port);
+        if (bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 || listen(fd, server->config.backlog_conn) != 0)
+        {
+            ESP_LOGE(TAG, "failed to listen on port %d", server->config.server_port);
+            close(fd);
+            delete server;
+            return ESP_ERR_HTTPD_TASK;
+        }
+        server->listen_fd = fd;
+    }
+
+    if (xTaskCreatePinnedToCore(httpd_task, "httpd", config->stack_size, server, config->task_priority, nullptr, config->core_id) != pdPASS)
+    {
+        delete server;
+        return ESP_ERR_HTTPD_TASK;
+    }
+    if (server->listen_fd >= 0)
+    {
+        ESP_LOGI(TAG, "listening on port %d", server->config.server_port);
+        std::thread(listen_task, server).detach();
+    }
+    *handle = server;
+    return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler)
+{
+    host_server *server = server_of(handle);
+    std::lock_guard<std::mutex> lock(server->mutex);
+    if (server->handlers.size() >= server->config.max_uri_handlers)
+    {
+        return ESP_ERR_HTTPD_HANDLERS_FULL;
+    }
+    for (const auto &h : server->handlers)
+    {
+        if (h.first == uri_handler->uri && h.second.method == uri_handler->method)
+        {
+            return ESP_ERR_HTTPD_HANDLER_EXISTS;
+        }
+    }
+    server->handlers.emplace_back(uri_handler->uri, *uri_handler);
+    return ESP_OK;
+}
+
+esp_err_t httpd_queue_work(httpd_handle_t handle, httpd_work_fn_t work, void *arg)
+{
+    host_server *server = server_of(handle);
+    {
+        std::lock_guard<std::mutex> lock(server->mutex);
+        server->work.emplace_back(work, arg);
+    }
+    server->cv.notify_all();
+    return ESP_OK;
+}
+
+void host_httpd_wait_idle(httpd_handle_t handle)
+{
+    host_server *server = server_of(handle);
+    std::unique_lock<std::mutex> lock(server->mutex);
+    server->cv.wait(lock, [server] { return server->work.empty() && !server->busy; });
+}
+
+struct host_close
+{
+    host_server *server;
+    int fd;
+};
+
+// As httpd does on its task. The session's reader is woken by the shutdown and sees it has gone.
+static void close_session(void *arg)
+{
+    auto *c = static_cast<host_close *>(arg);
+    {
+        std::lock_guard<std::mutex> lock(c->server->mutex);
+        auto it = c->server->sessions.find(c->fd);
+        if (it != c->server->sessions.end())
+        {
+            it->second->closed = true;
+            c->server->sessions.erase(it);
+            shutdown(c->fd, SHUT_RDWR);
+        }
+        c->server->send_fns.erase(c->fd);
+    }
+    if (c->server->config.close_fn != nullptr)
+    {
+        c->server->config.close_fn(c->server, c->fd);
+    }
+    else
+    {
+        close(c->fd);
+    }
+    delete c;
+}
+
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd)
+{
+    return httpd_queue_work(handle, close_session, new host_close{ server_of(handle), sockfd });
+}
+
+void host_httpd_close(httpd_handle_t handle, int sockfd)
+{
+    httpd_sess_trigger_close(handle, sockfd);
+    host_httpd_wait_idle(handle);
+}
+
+// Through the session's send override if it has one, as httpd does
+int httpd_socket_send(httpd_handle_t handle, int sockfd, const char *buf, size_t buf_len, int flags)
+{
+    httpd_send_func_t send_fn = nullptr;
+    if (handle != nullptr)
+    {
+        host_server *server = server_of(handle);
+        std::lock_guard<std::mutex> lock(server->mutex);
+        auto it = server->send_fns.find(sockfd);
+        if (it != server->send_fns.end())
+        {
+            send_fn = it->second;
+        }
+    }
+    if (send_fn != nullptr)
+    {
+        return send_fn(handle, sockfd, buf, buf_len, flags);
+    }
+    ssize_t len = send(sockfd, buf, buf_len, flags | MSG_NOSIGNAL);
+    return len < 0 ? HTTPD_SOCK_ERR_FAIL : static_cast<int>(len);
+}
+
+esp_err_t httpd_sess_set_send_override(httpd_handle_t handle, int sockfd, httpd_send_func_t send_func)
+{
+    host_server *server = server_of(handle);
+    std::lock_guard<std::mutex> lock(server->mutex);
+    server->send_fns[sockfd] = send_func;
+    return ESP_OK;
+}
+
+static httpd_req_t *new_req(httpd_handle_t handle, int method, const char *uri, int fd, const std::string &query)
+{
+    auto *req = static_cast<httpd_req_t *>(calloc(1, sizeof(httpd_req_t)));
+    req->handle = handle;
+    req->method = method;
+    strncpy(const_cast<char *>(req->uri), uri, HTTPD_MAX_URI_LEN);
+    auto *aux = new host_req_aux{};
+    aux->sd = aux;
+    aux->fd = fd;
+    aux->query = query;
+    aux->status = HTTPD_200;
+    aux->content_type = "text/html";
+    req->aux = aux;
+    return req;
+}
+
+static void free_req(httpd_req_t *req)
+{
+    delete aux_of(req);
+    free(req);
+}
+
+// Runs on the httpd task. A failed handler closes the session, as httpd does.
+static esp_err_t handle_request(host_server *server, int sockfd, const host_request &request)
+{
+    const char *uri = request.uri.c_str();
+    const char *q = strchr(uri, '?');
+    std::string path = q != nullptr ? std::string(uri, q) : std::string(uri);
+    std::string query = q != nullptr ? std::string(q + 1) : std::string();
+
+    httpd_uri_t handler{};
+    {
+        std::lock_guard<std::mutex> lock(server->mutex);
+        for (const auto &h : server->handlers)
+        {
+            if (h.first == path && h.second.method == request.method)
+            {
+                handler = h.second;
+            }
+        }
+    }
+
+    httpd_req_t *req = new_req(server, request.method, uri, sockfd, query);
+    aux_of(req)->req_headers = request.headers;
+    req->user_ctx = handler.user_ctx;
+    esp_err_t res;
+    if (handler.handler == nullptr)
+    {
+        ESP_LOGW(TAG, "no handler for %s", path.c_str());
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, nullptr);
+        res = ESP_ERR_NOT_FOUND;
+    }
+    else if (handler.is_websocket)
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "no WebSockets on the host");
+        res = ESP_FAIL;
+    }
+    else
+    {
+        res = handler.handler(req);
+    }
+    free_req(req);
+    if (res != ESP_OK)
+    {
+        httpd_sess_trigger_close(server, sockfd);
+    }
+    return res;
+}
+
+struct host_dispatch
+{
+    host_server *server;
+    int fd;
+    const host_request *request;
+    esp_err_t res;
+    bool done;
+};
+
+static void dispatch_work(void *arg)
+{
+    auto *d = static_cast<host_dispatch *>(arg);
+    esp_err_t res = handle_request(d->server, d->fd, *d->request);
+    std::lock_guard<std::mutex> lock(d->server->mutex);
+    d->res = res;
+    d->done = true;
+}
+
+// Hands a request to the httpd task and waits for its handler to return
+static esp_err_t dispatch(host_server *server, int sockfd, const host_request &request)
+{
+    host_dispatch d{ server, sockfd, &request, ESP_OK, false };
+    httpd_queue_work(server, dispatch_work, &d);
+    std::unique_lock<std::mutex> lock(server->mutex);
+    server->cv.wait(lock, [&d] { return d.done; });
+    return d.res;
+}
+
+esp_err_t host_httpd_request(httpd_handle_t handle, int sockfd, const char *uri)
+{
+    host_request request{ HTTP_GET, uri, {} };
+    return dispatch(server_of(handle), sockfd, request);
+}
+
+static bool parse_request(const std::string &head, host_request *request)
+{
+    size_t line_end = head.find("\r\n");
+    std::string line = head.substr(0, line_end);
+    size_t sp1 = line.find(' ');
+    size_t sp2 = sp1 != std::string::npos ? line.find(' ', sp1 + 1) : std::string::npos;
+    if (sp2 == std::string::npos)
+    {
+        return false;
+    }
+
+    static const std::pair<const char *, httpd_method_t> methods[] =
+    {
+        { "GET", HTTP_GET }, { "HEAD", HTTP_HEAD }, { "POST", HTTP_POST }, { "PUT", HTTP_PUT }, { "DELETE", HTTP_DELETE },
+    };
+    std::string method = line.substr(0, sp1);
+    bool known = false;
+    for (const auto &m : methods)
+    {
+        if (method == m.first)
+        {
+            request->method = m.second;
+            known = true;
+        }
+    }
+    request->uri = line.substr(sp1 + 1, sp2 - sp1 - 1);
+    if (!known || request->uri.size() > HTTPD_MAX_URI_LEN)
+    {
+        return false;
+    }
+
+    request->headers.clear();
+    size_t pos = line_end + 2;
+    while (pos < head.size())
+    {
+        size_t end = head.find("\r\n", pos);
+        if (end == std::string::npos || end == pos)
+        {
+            break;
+        }
+        size_t colon = head.find(':', pos);
+        if (colon != std::string::npos && colon < end)
+        {
+            size_t value = std::min(head.find_first_not_of(' ', colon + 1), end);
+            request->headers.emplace_back(head.substr(pos, colon - pos), head.substr(value, end - value));
+        }
+        pos = end + 2;
+    }
+    return true;
+}
+
+static size_t content_length(const host_request &request)
+{
+    for (const auto &h : request.headers)
+    {
+        if (strcasecmp(h.first.c_str(), "Content-Length") == 0)
+        {
+            return strtoul(h.second.c_str(), nullptr, 10);
+        }
+    }
+    return 0;
+}
+
+// Reads requests off one connection and hands each to the httpd task, as httpd does when the
+// socket is readable. Bodies are read and dropped, nothing in main wants them here.
+static void session_thread(host_server *server, std::shared_ptr<host_session> session)
+{
+    int fd = session->fd;
+    std::string buf;
+    char chunk[2048];
+    for (;;)
+    {
+        size_t head_end;
+        bool gone = false;
+        while (!gone && (head_end = buf.find("\r\n\r\n")) == std::string::npos)
+        {
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            gone = n <= 0 || buf.size() > HOST_MAX_REQ_LEN;
+            if (!gone)
+            {
+                buf.append(chunk, n);
+            }
+        }
+
+        host_request request;
+        bool ok = !gone && parse_request(buf.substr(0, head_end + 2), &request);
+        size_t body = 0;
+        if (ok)
+        {
+            buf.erase(0, head_end + 4);
+            body = content_length(request);
+        }
+        while (ok && body > 0)
+        {
+            if (buf.empty())
+            {
+                ssize_t n = recv(fd, chunk, std::min(sizeof(chunk), body), 0);
+                ok = n > 0;
+                if (ok)
+                {
+                    buf.append(chunk, n);
+                }
+                continue;
+            }
+            size_t take = std::min(body, buf.size());
+            buf.erase(0, take);
+            body -= take;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(server->mutex);
+            if (session->closed)
+            {
+                return;
+            }
+            if (!ok)
+            {
+                // the client went, or sent something that is not HTTP
+                server->work.emplace_back(close_session, new host_close{ server, fd });
+                server->cv.notify_all();
+                return;
+            }
+            session->last_active = esp_timer_get_time();
+        }
+        if (dispatch(server, fd, request) != ESP_OK)
+        {
+            return;
+        }
+    }
+}
+
+struct host_open
+{
+    host_server *server;
+    int fd;
+    bool ok;
+    bool done;
+};
+
+// On the httpd task: makes room if every session is in use, then lets open_fn have its say
+static void open_session(void *arg)
+{
+    auto *o = static_cast<host_open *>(arg);
+    host_server *server = o->server;
+    bool full;
+    int lru_fd = -1;
+    {
+        std::lock_guard<std::mutex> lock(server->mutex);
+        full = server->sessions.size() >= server->config.max_open_sockets;
+        int64_t oldest = INT64_MAX;
+        for (const auto &s : server->sessions)
+        {
+            if (s.second->last_active < oldest)
+            {
+                oldest = s.second->last_active;
+                lru_fd = s.first;
+            }
+        }
+    }
+
+    bool ok = true;
+    if (full && server->config.lru_purge_enable && lru_fd >= 0)
+    {
+        ESP_LOGI(TAG, "closing least recently used session %d for %d", lru_fd, o->fd);
+        close_session(new host_close{ server, lru_fd });
+    }
+    else if (full)
+    {
+        ESP_LOGW(TAG, "no free session for %d", o->fd);
+        close(o->fd);
+        ok = false;
+    }
+
+    if (ok)
+    {
+        std::lock_guard<std::mutex> lock(server->mutex);
+        server->sessions[o->fd] = std::make_shared<host_session>(host_session{ o->fd, false, esp_timer_get_time() });
+    }
+    if (ok && server->config.open_fn != nullptr && server->config.open_fn(server, o->fd) != ESP_OK)
+    {
+        close_session(new host_close{ server, o->fd });
+        ok = false;
+    }
+
+    std::lock_guard<std::mutex> lock(server->mutex);
+    o->ok = ok;
+    o->done = true;
+}
+
+static void listen_task(host_server *server)
+{
+    for (;;)
+    {
+        int fd = accept(server->listen_fd, nullptr, nullptr);
+        if (fd < 0)
+        {
+            continue;
+        }
+
+        host_open o{ server, fd, false, false };
+        httpd_queue_work(server, open_session, &o);
+        std::shared_ptr<host_session> session;
+        {
+            std::unique_lock<std::mutex> lock(server->mutex);
+            server->cv.wait(lock, [&o] { return o.done; });
+            auto it = server->sessions.find(fd);
+            if (o.ok && it != server->sessions.end())
+            {
+                session = it->second;
+            }
+        }
+        if (session != nullptr)
+        {
+            std::thread(session_thread, server, session).detach();
+        }
+    }
+}
+
+esp_err_t httpd_req_async_handler_begin(httpd_req_t *r, httpd_req_t **out)
+{
+    httpd_req_t *copy = new_req(r->handle, r->method, r->uri, aux_of(r)->fd, aux_of(r)->query);
+    aux_of(copy)->req_headers = aux_of(r)->req_headers;
+    copy->user_ctx = r->user_ctx;
+    *out = copy;
+    return ESP_OK;
+}
+
+esp_err_t httpd_req_async_handler_complete(httpd_req_t *r)
+{
+    free_req(r);
+    return ESP_OK;
+}
+
+int httpd_req_to_sockfd(httpd_req_t *r)
+{
+    return r != nullptr ? aux_of(r)->fd : -1;
+}
+
+size_t httpd_req_get_url_query_len(httpd_req_t *r)
+{
+    return aux_of(r)->query.size();
+}
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *r, char *buf, size_t buf_len)
+{
+    const std::string &query = aux_of(r)->query;
+    if (query.empty())
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (buf_len == 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    strncpy(buf, query.c_str(), buf_len - 1);
+    buf[buf_len - 1] = '\0';
+    return query.size() < buf_len ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+}
+
+esp_err_t httpd_query_key_value(const char *qry, const char *key, char *val, size_t val_size)
+{
+    size_t key_len = strlen(key);
+    const char *p = qry;
+    while (p != nullptr && *p != '\0')
+    {
+        const char *end = strchr(p, '&');
+        size_t len = end != nullptr ? end - p : strlen(p);
+        if (len > key_len && strncmp(p, key, key_len) == 0 && p[key_len] == '=')
+        {
+            size_t value_len = len - key_len - 1;
+            size_t n = value_len < val_size ? value_len : val_size - 1;
+            memcpy(val, p + key_len + 1, n);
+            val[n] = '\0';
+            return value_len < val_size ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+        }
+        p = end != nullptr ? end + 1 : nullptr;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+static const std::string *find_header(httpd_req_t *r, const char *field)
+{
+    for (const auto &h : aux_of(r)->req_headers)
+    {
+        if (strcasecmp(h.first.c_str(), field) == 0)
+        {
+            return &h.second;
+        }
+    }
+    return nullptr;
+}
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field)
+{
+    const std::string *value = find_header(r, field);
+    return value != nullptr ? value->size() : 0;
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *val, size_t val_size)
+{
+    const std::string *value = find_header(r, field);
+    if (value == nullptr)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (val_size == 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    strncpy(val, value->c_str(), val_size - 1);
+    val[val_size - 1] = '\0';
+    return value->size() < val_size ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+}
+
+esp_err_t httpd_ws_recv_frame(httpd_req_t *, httpd_ws_frame_t *, size_t)
+{
+    return ESP_FAIL;
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status)
+{
+    aux_of(r)->status = status;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type)
+{
+    aux_of(r)->content_type = type;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value)
+{
+    aux_of(r)->headers.emplace_back(field, value);
+    return ESP_OK;
+}
+
+static esp_err_t send_all(httpd_req_t *r, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        int n = httpd_socket_send(r->handle, aux_of(r)->fd, buf, len, 0);
+        if (n < 0)
+        {
+            return ESP_ERR_HTTPD_RESP_SEND;
+        }
+        buf += n;
+        len -= n;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t send_headers(httpd_req_t *r, const char *length_header)
+{
+    host_req_aux *aux = aux_of(r);
+    std::string head = std::string("HTTP/1.1 ") + aux->status + "\r\nContent-Type: " + aux->content_type + "\r\n" + length_header;
+    for (const auto &h : aux->headers)
+    {
+        head += std::string(h.first) + ": " + h.second + "\r\n";
+    }
+    head += "\r\n";
+    return send_all(r, head.data(), head.size());
+}
+
+// As in httpd a null buffer with a length sends only the headers, leaving the body to the caller
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+    if (buf_len == HTTPD_RESP_USE_STRLEN)
+    {
+        buf_len = buf != nullptr ? strlen(buf) : 0;
+    }
+    std::string length = "Content-Length: " + std::to_string(buf_len) + "\r\n";
+    esp_err_t res = send_headers(r, length.c_str());
+    if (res == ESP_OK && buf != nullptr && buf_len > 0)
+    {
+        res = send_all(r, buf, buf_len);
+    }
+    return res;
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+    host_req_aux *aux = aux_of(r);
+    if (buf_len == HTTPD_RESP_USE_STRLEN)
+    {
+        buf_len = buf != nullptr ? strlen(buf) : 0;
+    }
+    if (!aux->chunked)
+    {
+        aux->chunked = true;
+        esp_err_t res = send_headers(r, "Transfer-Encoding: chunked\r\n");
+        if (res != ESP_OK)
+        {
+            return res;
+        }
+    }
+
+    char size[16];
+    int size_len = snprintf(size, sizeof(size), "%x\r\n", static_cast<unsigned>(buf_len));
+    esp_err_t res = send_all(r, size, size_len);
+    if (res == ESP_OK && buf != nullptr && buf_len > 0)
+    {
+        res = send_all(r, buf, buf_len);
+    }
+    if (res == ESP_OK)
+    {
+        res = send_all(r, "\r\n", 2);
+    }
+    return res;
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t error, const char *msg)
+{
+    const char *status = HTTPD_500;
+    if (error == HTTPD_400_BAD_REQUEST)
+    {
+        status = HTTPD_400;
+    }
+    else if (error == HTTPD_404_NOT_FOUND)
+    {
+        status = HTTPD_404;
+    }
+    httpd_resp_set_status(req, status);
+    httpd_resp_set_type(req, "text/html");
+    return httpd_resp_send(req, msg != nullptr ? msg : status, HTTPD_RESP_USE_STRLEN);
+}
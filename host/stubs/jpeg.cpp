@@ -0,0 +1,169 @@
+#include "esp_jpg_decode.h"
+#include "img_converters.h"
+
+#ifdef HOST_HAVE_JPEG
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <jpeglib.h>
+
+#include <vector>
+
+// The decoder and encoder of esp32-camera, done with the host's libjpeg. It scales by 1/2, 1/4
+// and 1/8 in the DCT domain as tjpgd does, so the work done is of the same kind if not the same
+// amount.
+
+struct host_jpeg_error
+{
+    jpeg_error_mgr mgr;
+    jmp_buf jump;
+};
+
+// libjpeg's own handler exits the process
+static void error_exit(j_common_ptr cinfo)
+{
+    longjmp(reinterpret_cast<host_jpeg_error *>(cinfo->err)->jump, 1);
+}
+
+static void quiet(j_common_ptr, int)
+{
+}
+
+// The writer is told the output size first, then gets RGB888 a row at a time, then is called with
+// no data at the bottom right
+esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jpg_writer_cb writer, void *arg)
+{
+    std::vector<uint8_t> input(len);
+    if (reader(arg, 0, input.data(), len) != len)
+    {
+        return ESP_FAIL;
+    }
+
+    jpeg_decompress_struct cinfo;
+    host_jpeg_error err;
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = error_exit;
+    err.mgr.emit_message = quiet;
+    if (setjmp(err.jump) != 0)
+    {
+        jpeg_destroy_decompress(&cinfo);
+        return ESP_FAIL;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, input.data(), input.size());
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = 1 << scale;
+    cinfo.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&cinfo);
+
+    uint16_t w = cinfo.output_width;
+    uint16_t h = cinfo.output_height;
+    // from libjpeg's pool so it goes with the decoder however that ends
+    JSAMPARRAY row = (*cinfo.mem->alloc_sarray)(reinterpret_cast<j_common_ptr>(&cinfo), JPOOL_IMAGE, w * 3, 1);
+    bool ok = writer(arg, 0, 0, w, h, nullptr);
+    while (ok && cinfo.output_scanline < h)
+    {
+        uint16_t y = cinfo.output_scanline;
+        jpeg_read_scanlines(&cinfo, row, 1);
+        ok = writer(arg, 0, y, w, 1, row[0]);
+    }
+    if (ok)
+    {
+        jpeg_finish_decompress(&cinfo);
+        ok = writer(arg, w, h, w, h, nullptr);
+    }
+    jpeg_destroy_decompress(&cinfo);
+    return ok ? ESP_OK : ESP_FAIL;
+}
+
+// RGB888 comes in as the sensor lays it out, blue first. The whole image goes to the callback in
+// one piece.
+bool fmt2jpg_cb(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, jpg_out_cb cb, void *arg)
+{
+    int components = format == PIXFORMAT_RGB888 ? 3 : format == PIXFORMAT_GRAYSCALE ? 1 : 0;
+    if (components == 0 || src_len < static_cast<size_t>(width) * height * components)
+    {
+        return false;
+    }
+
+    jpeg_compress_struct cinfo;
+    host_jpeg_error err;
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = error_exit;
+    err.mgr.emit_message = quiet;
+    unsigned char *out = nullptr;
+    unsigned long out_len = 0;
+    std::vector<uint8_t> row(static_cast<size_t>(width) * components);
+    if (setjmp(err.jump) != 0)
+    {
+        jpeg_destroy_compress(&cinfo);
+        free(out);
+        return false;
+    }
+
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &out, &out_len);
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = components;
+    cinfo.in_color_space = components == 3 ? JCS_RGB : JCS_GRAYSCALE;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    while (cinfo.next_scanline < height)
+    {
+        const uint8_t *s = src + static_cast<size_t>(cinfo.next_scanline) * width * components;
+        if (components == 3)
+        {
+            for (size_t i = 0; i < row.size(); i += 3)
+            {
+                row[i] = s[i + 2];
+                row[i + 1] = s[i + 1];
+                row[i + 2] = s[i];
+            }
+        }
+        else
+        {
+            memcpy(row.data(), s, row.size());
+        }
+        JSAMPROW rows[1] = { row.data() };
+        jpeg_write_scanlines(&cinfo, rows, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    bool ok = cb(arg, 0, out, out_len) == out_len;
+    free(out);
+    return ok;
+}
+
+bool frame2jpg_cb(camera_fb_t *fb, uint8_t quality, jpg_out_cb cb, void *arg)
+{
+    return fmt2jpg_cb(fb->buf, fb->len, fb->width, fb->height, fb->format, quality, cb, arg);
+}
+
+#else
+
+// Without libjpeg there is no codec, these always fail
+
+esp_err_t esp_jpg_decode(size_t, jpg_scale_t, jpg_reader_cb, jpg_writer_cb, void *)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+bool fmt2jpg_cb(uint8_t *, size_t, uint16_t, uint16_t, pixformat_t, uint8_t, jpg_out_cb, void *)
+{
+    return false;
+}
+
+bool frame2jpg_cb(camera_fb_t *, uint8_t, jpg_out_cb, void *)
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,358 @@
+#include "driver/temperature_sensor.h"
+#include "esp_chip_info.h"
+#include "esp_event.h"
+#include "esp_flash.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_netif.h"
+#include "esp_ota_ops.h"
+#include "esp_random.h"
+#include "esp_sntp.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_vfs_fat.h"
+#include "nvs_flash.h"
+#include "rom/gpio.h"
+#include "soc/rtc.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <malloc.h>
+#include <random>
+#include <stdarg.h>
+#include <string.h>
+
+#define HOST_INTERNAL_FREE (4 * 1024 * 1024)
+#define HOST_PSRAM_FREE (8 * 1024 * 1024)
+
+static esp_log_level_t initial_log_level()
+{
+    const char *level = getenv("CAMERA_LOG_LEVEL");
+    return level != nullptr ? static_cast<esp_log_level_t>(atoi(level)) : ESP_LOG_WARN;
+}
+
+esp_log_level_t host_log_level = initial_log_level();
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    if (strcmp(tag, "*") == 0)
+    {
+        host_log_level = level;
+    }
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    static const char letters[] = "NEWIDV";
+    fprintf(stderr, "%c (%lld) %s: ", letters[level], esp_timer_get_time() / 1000, tag);
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code)
+    {
+    case ESP_OK:
+        return "ESP_OK";
+    case ESP_FAIL:
+        return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:
+        return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:
+        return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:
+        return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_NOT_FOUND:
+        return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_TIMEOUT:
+        return "ESP_ERR_TIMEOUT";
+    default:
+        return "UNKNOWN ERROR";
+    }
+}
+
+int64_t esp_timer_get_time()
+{
+    static const auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+uint32_t esp_random(void)
+{
+    static thread_local std::mt19937 generator{ std::random_device{}() };
+    return generator();
+}
+
+void *heap_caps_malloc(size_t size, uint32_t)
+{
+    return malloc(size);
+}
+
+void *heap_caps_calloc(size_t n, size_t size, uint32_t)
+{
+    return calloc(n, size);
+}
+
+void *heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t)
+{
+    return aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+void heap_caps_free(void *ptr)
+{
+    free(ptr);
+}
+
+// Free internal heap is what it was at start less what malloc has handed out since, so it goes
+// down and back up with what main allocates and a leak shows as it would on the board. PSRAM
+// stays the same.
+static size_t heap_in_use()
+{
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+static const size_t heap_at_start = heap_in_use();
+static std::atomic<size_t> heap_min_free{ HOST_INTERNAL_FREE };
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    if ((caps & MALLOC_CAP_SPIRAM) != 0)
+    {
+        return HOST_PSRAM_FREE;
+    }
+    size_t used = heap_in_use() - std::min(heap_in_use(), heap_at_start);
+    size_t free_bytes = used < HOST_INTERNAL_FREE ? HOST_INTERNAL_FREE - used : 0;
+    size_t min_free = heap_min_free.load();
+    while (free_bytes < min_free && !heap_min_free.compare_exchange_weak(min_free, free_bytes))
+    {
+    }
+    return free_bytes;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+    if ((caps & MALLOC_CAP_SPIRAM) != 0)
+    {
+        return HOST_PSRAM_FREE;
+    }
+    heap_caps_get_free_size(caps);
+    return heap_min_free.load();
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+    return heap_caps_get_free_size(caps);
+}
+
+void heap_caps_get_info(multi_heap_info_t *info, uint32_t caps)
+{
+    memset(info, 0, sizeof(*info));
+    info->total_free_bytes = heap_caps_get_free_size(caps);
+    info->largest_free_block = info->total_free_bytes;
+    info->minimum_free_bytes = info->total_free_bytes;
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+    return heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+    return heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+}
+
+void esp_restart(void)
+{
+    exit(0);
+}
+
+void esp_chip_info(esp_chip_info_t *out_info)
+{
+    out_info->model = CHIP_ESP32S3;
+    out_info->features = CHIP_FEATURE_WIFI_BGN | CHIP_FEATURE_BLE;
+    out_info->revision = 0;
+    out_info->cores = 2;
+}
+
+void rtc_clk_cpu_freq_get_config(rtc_cpu_freq_config_t *out_config)
+{
+    memset(out_config, 0, sizeof(*out_config));
+    out_config->source_freq_mhz = 480;
+    out_config->div = 2;
+    out_config->freq_mhz = 240;
+}
+
+esp_err_t esp_flash_get_size(esp_flash_t *, uint32_t *out_size)
+{
+    *out_size = 8 * 1024 * 1024;
+    return ESP_OK;
+}
+
+esp_err_t esp_efuse_mac_get_default(uint8_t *mac)
+{
+    static const uint8_t host_mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    memcpy(mac, host_mac, sizeof(host_mac));
+    return ESP_OK;
+}
+
+static const esp_partition_t partitions[] =
+{
+    { nullptr, ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_NVS, 0x9000, 0x4000, 0x1000, "nvs", false },
+    { nullptr, ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_OTA, 0xd000, 0x2000, 0x1000, "otadata", false },
+    { nullptr, ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_PHY, 0xf000, 0x1000, 0x1000, "phy_init", false },
+    { nullptr, ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, 0x10000, 0x180000, 0x1000, "ota_0", false },
+    { nullptr, ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_1, 0x190000, 0x180000, 0x1000, "ota_1", false },
+};
+
+#define N_PARTITIONS (sizeof(partitions) / sizeof(partitions[0]))
+
+// The iterator is one past the partition it points at so that null can end the list
+esp_partition_iterator_t esp_partition_find(esp_partition_type_t, esp_partition_subtype_t, const char *)
+{
+    return reinterpret_cast<esp_partition_iterator_t>(1);
+}
+
+esp_partition_iterator_t esp_partition_next(esp_partition_iterator_t iterator)
+{
+    uintptr_t next = reinterpret_cast<uintptr_t>(iterator) + 1;
+    return next <= N_PARTITIONS ? reinterpret_cast<esp_partition_iterator_t>(next) : nullptr;
+}
+
+const esp_partition_t *esp_partition_get(esp_partition_iterator_t iterator)
+{
+    return partitions + reinterpret_cast<uintptr_t>(iterator) - 1;
+}
+
+void esp_partition_iterator_release(esp_partition_iterator_t)
+{
+}
+
+const esp_partition_t *esp_ota_get_running_partition(void)
+{
+    return partitions + 3;
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *, nvs_open_mode_t, nvs_handle_t *out_handle)
+{
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t, const char *, uint32_t *)
+{
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t, const char *, uint32_t)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_str(nvs_handle_t, const char *, char *, size_t *)
+{
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_set_str(nvs_handle_t, const char *, const char *)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t)
+{
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t)
+{
+}
+
+esp_err_t esp_netif_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_get_hostname(esp_netif_t *, const char **hostname)
+{
+    *hostname = "camera-host";
+    return ESP_OK;
+}
+
+esp_err_t esp_event_loop_create_default(void)
+{
+    return ESP_OK;
+}
+
+void esp_sntp_setoperatingmode(int)
+{
+}
+
+void esp_sntp_setservername(uint8_t, const char *)
+{
+}
+
+void esp_sntp_init(void)
+{
+}
+
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t)
+{
+}
+
+void gpio_pad_select_gpio(uint32_t)
+{
+}
+
+int gpio_set_direction(gpio_num_t, gpio_mode_t)
+{
+    return ESP_OK;
+}
+
+int gpio_set_level(gpio_num_t, uint32_t)
+{
+    return ESP_OK;
+}
+
+esp_err_t temperature_sensor_install(const temperature_sensor_config_t *, temperature_sensor_handle_t *out_handle)
+{
+    *out_handle = reinterpret_cast<temperature_sensor_handle_t>(1);
+    return ESP_OK;
+}
+
+esp_err_t temperature_sensor_enable(temperature_sensor_handle_t)
+{
+    return ESP_OK;
+}
+
+esp_err_t temperature_sensor_get_celsius(temperature_sensor_handle_t, float *out_celsius)
+{
+    *out_celsius = 40.0f;
+    return ESP_OK;
+}
+
+esp_err_t esp_vfs_fat_sdmmc_mount(const char *, const sdmmc_host_t *, const void *, const esp_vfs_fat_sdmmc_mount_config_t *, sdmmc_card_t **)
+{
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t esp_vfs_fat_info(const char *, uint64_t *, uint64_t *)
+{
+    return ESP_ERR_INVALID_STATE;
+}
@@ -0,0 +1,286 @@
+#include "avi.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef ESP_PLATFORM
+#include "esp_heap_caps.h"
+// writes go straight from the batch buffer so it has to be somewhere the SD host can DMA from
+#define avi_alloc_batch(n) heap_caps_malloc(n, MALLOC_CAP_DMA)
+#define avi_alloc_index(n) heap_caps_malloc(n, MALLOC_CAP_SPIRAM)
+#else
+#define avi_alloc_batch(n) malloc(n)
+#define avi_alloc_index(n) malloc(n)
+#endif
+
+#define AVI_HEADER_LEN 224
+#define AVI_MOVI_OFFSET 220     // the 'movi' fourcc, idx1 offsets are relative to it
+#define AVI_MAX_LEN 0x7fff0000u // keeps every size field well inside 32 bits
+
+#define AVIF_HASINDEX 0x10
+#define AVIIF_KEYFRAME 0x10
+
+// 8 bytes a frame rather than the 16 of an idx1 entry, the rest is the same for every frame
+struct avi_index_entry
+{
+    uint32_t offset;    // of the chunk header from AVI_MOVI_OFFSET
+    uint32_t len;       // of the jpeg
+};
+
+struct avi_writer
+{
+    int fd;
+    int width;
+    int height;
+    uint8_t *batch;
+    size_t batch_size;
+    size_t batch_len;
+    uint32_t disk_len;  // bytes handed to the file so far, the batch follows on from here
+    avi_index_entry *index;
+    size_t max_frames;
+    size_t n_frames;
+    size_t max_len;
+    int64_t first_timestamp;
+    int64_t last_timestamp;
+};
+
+static void set16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void set32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static void set_chunk(uint8_t *p, const char *fourcc, uint32_t size)
+{
+    memcpy(p, fourcc, 4);
+    set32(p + 4, size);
+}
+
+static uint32_t chunk_end(const avi_index_entry &entry)
+{
+    return AVI_MOVI_OFFSET + entry.offset + 8 + ((entry.len + 1) & ~1u);
+}
+
+// Describes the first n_frames frames, which end at movi_end
+static void format_header(const avi_writer *w, uint8_t *h, size_t n_frames, uint32_t movi_end, bool has_index)
+{
+    uint32_t us_per_frame = 100000;
+    if (w->n_frames > 1)
+    {
+        us_per_frame = (uint32_t)((w->last_timestamp - w->first_timestamp) / (int64_t)(w->n_frames - 1));
+    }
+    uint32_t file_end = movi_end + (has_index ? 8 + 16 * n_frames : 0);
+
+    memset(h, 0, AVI_HEADER_LEN);
+    set_chunk(h, "RIFF", file_end - 8);
+    memcpy(h + 8, "AVI ", 4);
+    set_chunk(h + 12, "LIST", 192);
+    memcpy(h + 20, "hdrl", 4);
+
+    set_chunk(h + 24, "avih", 56);
+    uint8_t *avih = h + 32;
+    set32(avih, us_per_frame);
+    set32(avih + 4, us_per_frame > 0 ? (uint32_t)((uint64_t)w->max_len * 1000000 / us_per_frame) : 0);
+    set32(avih + 12, has_index ? AVIF_HASINDEX : 0);
+    set32(avih + 16, n_frames);
+    set32(avih + 24, 1);
+    set32(avih + 28, w->max_len);
+    set32(avih + 32, w->width);
+    set32(avih + 36, w->height);
+
+    set_chunk(h + 88, "LIST", 116);
+    memcpy(h + 96, "strl", 4);
+    set_chunk(h + 100, "strh", 56);
+    uint8_t *strh = h + 108;
+    memcpy(strh, "vids", 4);
+    memcpy(strh + 4, "MJPG", 4);
+    set32(strh + 20, us_per_frame);
+    set32(strh + 24, 1000000);
+    set32(strh + 32, n_frames);
+    set32(strh + 36, w->max_len);
+    set32(strh + 40, 0xffffffff);
+    set16(strh + 52, w->width);
+    set16(strh + 54, w->height);
+
+    set_chunk(h + 164, "strf", 40);
+    uint8_t *strf = h + 172;
+    set32(strf, 40);
+    set32(strf + 4, w->width);
+    set32(strf + 8, w->height);
+    set16(strf + 12, 1);
+    set16(strf + 14, 24);
+    memcpy(strf + 16, "MJPG", 4);
+    set32(strf + 20, w->width * w->height * 3);
+
+    set_chunk(h + 212, "LIST", movi_end - AVI_MOVI_OFFSET);
+    memcpy(h + AVI_MOVI_OFFSET, "movi", 4);
+}
+
+static bool flush(avi_writer *w)
+{
+    if (w->batch_len == 0)
+    {
+        return true;
+    }
+
+    ssize_t n = write(w->fd, w->batch, w->batch_len);
+    if (n != (ssize_t)w->batch_len)
+    {
+        return false;
+    }
+    w->disk_len += w->batch_len;
+    w->batch_len = 0;
+    return true;
+}
+
+// Everything goes through the batch so the file only ever sees whole batch sized writes at batch
+// aligned offsets, apart from the last one on close
+static bool put(avi_writer *w, const void *data, size_t len)
+{
+    auto *p = static_cast<const uint8_t *>(data);
+    while (len > 0)
+    {
+        size_t n = std::min(len, w->batch_size - w->batch_len);
+        memcpy(w->batch + w->batch_len, p, n);
+        w->batch_len += n;
+        p += n;
+        len -= n;
+        if (w->batch_len == w->batch_size && !flush(w))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool write_header(avi_writer *w, size_t n_frames, uint32_t movi_end, bool has_index)
+{
+    uint8_t header[AVI_HEADER_LEN];
+    format_header(w, header, n_frames, movi_end, has_index);
+    return pwrite(w->fd, header, sizeof(header), 0) == sizeof(header);
+}
+
+static void free_writer(avi_writer *w)
+{
+    free(w->batch);
+    free(w->index);
+    free(w);
+}
+
+avi_writer *avi_open(const char *path, int width, int height, size_t max_frames, size_t batch_size)
+{
+    auto *w = static_cast<avi_writer *>(calloc(1, sizeof(avi_writer)));
+    if (w == nullptr)
+    {
+        return nullptr;
+    }
+    w->width = width;
+    w->height = height;
+    w->batch_size = batch_size;
+    w->max_frames = max_frames;
+    w->batch = static_cast<uint8_t *>(avi_alloc_batch(batch_size));
+    w->index = static_cast<avi_index_entry *>(avi_alloc_index(max_frames * sizeof(avi_index_entry)));
+    if (w->batch == nullptr || w->index == nullptr || batch_size < AVI_HEADER_LEN)
+    {
+        free_writer(w);
+        return nullptr;
+    }
+
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w->fd < 0)
+    {
+        free_writer(w);
+        return nullptr;
+    }
+
+    // a header for an empty file goes first, it is filled in by avi_sync and avi_close
+    format_header(w, w->batch, 0, AVI_MOVI_OFFSET + 4, false);
+    w->batch_len = AVI_HEADER_LEN;
+    return w;
+}
+
+bool avi_add_frame(avi_writer *w, const uint8_t *jpg, size_t len, int64_t timestamp)
+{
+    uint32_t offset = w->disk_len + w->batch_len;
+    if (avi_full(w) || offset + 8 + len + 1 > AVI_MAX_LEN)
+    {
+        return false;
+    }
+
+    uint8_t chunk[8];
+    set_chunk(chunk, "00dc", len);
+    if (!put(w, chunk, sizeof(chunk)) || !put(w, jpg, len) || ((len & 1) != 0 && !put(w, "", 1)))
+    {
+        return false;
+    }
+
+    w->index[w->n_frames].offset = offset - AVI_MOVI_OFFSET;
+    w->index[w->n_frames].len = len;
+    ++w->n_frames;
+    w->max_len = std::max(w->max_len, len);
+    if (w->n_frames == 1)
+    {
+        w->first_timestamp = timestamp;
+    }
+    w->last_timestamp = timestamp;
+    return true;
+}
+
+// Makes what is on the disk so far a playable file without an index. Only frames that have been
+// written out in full are counted, the rest are still in the batch.
+bool avi_sync(avi_writer *w)
+{
+    size_t n = w->n_frames;
+    while (n > 0 && chunk_end(w->index[n - 1]) > w->disk_len)
+    {
+        --n;
+    }
+    uint32_t movi_end = n > 0 ? chunk_end(w->index[n - 1]) : AVI_MOVI_OFFSET + 4;
+    if (w->disk_len < AVI_HEADER_LEN)
+    {
+        return true;
+    }
+    return write_header(w, n, movi_end, false) && fsync(w->fd) == 0;
+}
+
+bool avi_close(avi_writer *w)
+{
+    uint32_t movi_end = w->disk_len + w->batch_len;
+    uint8_t chunk[8];
+    set_chunk(chunk, "idx1", 16 * w->n_frames);
+    bool ok = put(w, chunk, sizeof(chunk));
+    for (size_t i = 0; ok && i < w->n_frames; ++i)
+    {
+        uint8_t entry[16];
+        memcpy(entry, "00dc", 4);
+        set32(entry + 4, AVIIF_KEYFRAME);
+        set32(entry + 8, w->index[i].offset);
+        set32(entry + 12, w->index[i].len);
+        ok = put(w, entry, sizeof(entry));
+    }
+    ok = ok && flush(w) && write_header(w, w->n_frames, movi_end, true);
+    ok = close(w->fd) == 0 && ok;
+    free_writer(w);
+    return ok;
+}
+
+size_t avi_frame_count(const avi_writer *w)
+{
+    return w->n_frames;
+}
+
+bool avi_full(const avi_writer *w)
+{
+    return w->n_frames >= w->max_frames;
+}
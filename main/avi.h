@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Writes MJPEG AVI files a frame at a time. The idx1 index is kept in memory as it goes and
+// written on close, the header is rewritten by avi_sync so a file cut off by a power loss
+// still plays up to the last sync. Only uses POSIX file calls so it runs against an ordinary
+// file on a host as well.
+struct avi_writer;
+
+// batch_size is the size of every write to the file, make it a multiple of the medium's sector size
+extern avi_writer *avi_open(const char *path, int width, int height, size_t max_frames, size_t batch_size);
+extern bool avi_add_frame(avi_writer *w, const uint8_t *jpg, size_t len, int64_t timestamp);
+extern bool avi_sync(avi_writer *w);
+extern bool avi_close(avi_writer *w);
+
+extern size_t avi_frame_count(const avi_writer *w);
+extern bool avi_full(const avi_writer *w);
@@ -0,0 +1,116 @@
+#include <esp_log.h>
+#include "bufpool.h"
+#include "img_converters.h"
+
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+
+#define TAG "bufpool"
+
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static bufpool_buf bufs[BUFPOOL_COUNT];
+static bool in_use[BUFPOOL_COUNT];
+
+static unsigned int n_allocs;
+static unsigned int n_gets;
+static unsigned int n_empty;
+static unsigned int n_overflows;
+static unsigned int n_used;
+static unsigned int max_used;
+
+bufpool_buf *bufpool_get()
+{
+    int slot = -1;
+
+    portENTER_CRITICAL(&lock);
+    ++n_gets;
+    for (int i = 0; i < BUFPOOL_COUNT; ++i)
+    {
+        if (!in_use[i])
+        {
+            in_use[i] = true;
+            slot = i;
+            if (++n_used > max_used)
+            {
+                max_used = n_used;
+            }
+            break;
+        }
+    }
+    if (slot < 0)
+    {
+        ++n_empty;
+    }
+    portEXIT_CRITICAL(&lock);
+
+    if (slot < 0)
+    {
+        return nullptr;
+    }
+
+    bufpool_buf *buf = bufs + slot;
+    if (buf->data == nullptr)
+    {
+        buf->data = static_cast<uint8_t *>(heap_caps_aligned_alloc(BUFPOOL_ALIGN, BUFPOOL_SIZE, MALLOC_CAP_SPIRAM));
+        if (buf->data == nullptr)
+        {
+            ESP_LOGE(TAG, "failed to allocate pool buffer %d", slot);
+            bufpool_put(buf);
+            return nullptr;
+        }
+        ++n_allocs;
+    }
+    buf->len = 0;
+    return buf;
+}
+
+void bufpool_put(bufpool_buf *buf)
+{
+    portENTER_CRITICAL(&lock);
+    in_use[buf - bufs] = false;
+    --n_used;
+    portEXIT_CRITICAL(&lock);
+}
+
+size_t bufpool_append(void *arg, size_t index, const void *data, size_t len)
+{
+    bufpool_buf *buf = static_cast<bufpool_buf *>(arg);
+    if (index != buf->len || buf->len + len > BUFPOOL_SIZE)
+    {
+        return 0;
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    return len;
+}
+
+bufpool_buf *bufpool_encode(camera_fb_t *fb, uint8_t quality)
+{
+    bufpool_buf *buf = bufpool_get();
+    if (buf == nullptr)
+    {
+        return nullptr;
+    }
+
+    if (!frame2jpg_cb(fb, quality, bufpool_append, buf))
+    {
+        ESP_LOGE(TAG, "JPEG compression failed, %u bytes so far", buf->len);
+        portENTER_CRITICAL(&lock);
+        ++n_overflows;
+        portEXIT_CRITICAL(&lock);
+        bufpool_put(buf);
+        return nullptr;
+    }
+
+    return buf;
+}
+
+void bufpool_print_info(int (*printfn)(const char *format, ...))
+{
+    if (n_gets == 0)
+    {
+        return;
+    }
+    printfn("Encode buffers: %u allocated, %u in use, max %u, %u requests, %u empty, %u failed\n",
+            n_allocs, n_used, max_used, n_gets, n_empty, n_overflows);
+}
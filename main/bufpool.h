@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_camera.h"
+
+// Fixed set of PSRAM buffers for jpeg encoding of non-jpeg frames. Buffers are allocated the
+// first time they are needed and then reused so steady state encoding does not touch the heap.
+#define BUFPOOL_COUNT 8
+#define BUFPOOL_SIZE (128 * 1024)
+#define BUFPOOL_ALIGN 64
+
+struct bufpool_buf
+{
+    uint8_t *data;
+    size_t len;
+};
+
+extern bufpool_buf *bufpool_get();
+extern void bufpool_put(bufpool_buf *buf);
+
+// Output callback for the jpeg encoders, arg is the bufpool_buf being filled
+extern size_t bufpool_append(void *arg, size_t index, const void *data, size_t len);
+
+// Encodes fb as jpeg into a pool buffer, nullptr if the pool is empty or the image did not fit
+extern bufpool_buf *bufpool_encode(camera_fb_t *fb, uint8_t quality);
+
+extern void bufpool_print_info(int (*printfn)(const char *format, ...));
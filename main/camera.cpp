@@ -1,5 +1,6 @@
 #include "esp_camera.h"
 #include "esp_log.h"
+#include "replay.h"
 
 #ifdef CONFIG_IDF_TARGET_ESP32
 #define AITHINKER 1
@@ -91,8 +92,9 @@
 
 #define TAG "camera"
 
+static camera_config_t camera_config;
+
 esp_err_t camera_init(){
-    static camera_config_t camera_config;
     camera_config.pin_pwdn  = CAM_PIN_PWDN;
     camera_config.pin_reset = CAM_PIN_RESET;
     camera_config.pin_xclk = CAM_PIN_XCLK;
@@ -125,7 +127,7 @@ esp_err_t camera_init(){
     camera_config.frame_size = FRAMESIZE_XGA;//QQVGA-QXGA Do not use sizes above QVGA when not JPEG
 
     camera_config.jpeg_quality = 12; //0-63 lower number means higher quality
-    camera_config.fb_count = 2; //if more than one, i2s runs in continuous mode. Use only with JPEG
+    camera_config.fb_count = 3; //if more than one, i2s runs in continuous mode. Use only with JPEG. Keep above CAPTURE_MAX_FRAMES
     camera_config.grab_mode = CAMERA_GRAB_LATEST; // Sets when buffers should be filled
 
 #if 0
@@ -146,3 +148,60 @@ esp_err_t camera_init(){
 
     return ESP_OK;
 }
+
+// The driver sizes its frame buffers for the frame size it was started with
+bool camera_fits(framesize_t size)
+{
+    const resolution_info_t &allocated = resolution[camera_config.frame_size];
+    return resolution[size].width * resolution[size].height <= allocated.width * allocated.height;
+}
+
+// Starts the driver again with buffers for a bigger frame size, keeping the settings that can be
+// changed from the UI. No frame may be held by anyone.
+esp_err_t camera_restart(framesize_t size)
+{
+    sensor_t *s = esp_camera_sensor_get();
+    camera_status_t saved = s->status;
+
+    esp_camera_deinit();
+    camera_config.frame_size = size;
+    camera_config.jpeg_quality = saved.quality;
+    esp_err_t err = esp_camera_init(&camera_config);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Camera restart at %dx%d failed", resolution[size].width, resolution[size].height);
+        return err;
+    }
+
+    s = esp_camera_sensor_get();
+    s->set_vflip(s, saved.vflip);
+    s->set_hmirror(s, saved.hmirror);
+    s->set_brightness(s, saved.brightness);
+    s->set_contrast(s, saved.contrast);
+    s->set_special_effect(s, saved.special_effect);
+    ESP_LOGI(TAG, "Camera restarted at %dx%d", resolution[size].width, resolution[size].height);
+    return ESP_OK;
+}
+
+camera_fb_t *camera_fb_get()
+{
+    if (replay_active())
+    {
+        camera_fb_t *fb = replay_fb_get();
+        // straight on to the sensor if the replay came to its end or was stopped
+        if (fb != nullptr || replay_active())
+        {
+            return fb;
+        }
+    }
+    return esp_camera_fb_get();
+}
+
+// A frame goes back to whichever gave it out, replay may have started or stopped in between
+void camera_fb_return(camera_fb_t *fb)
+{
+    if (!replay_fb_return(fb))
+    {
+        esp_camera_fb_return(fb);
+    }
+}
@@ -1,8 +1,14 @@
 #pragma once
 
+#include "esp_camera.h"
 #include "esp_err.h"
 
 esp_err_t camera_init();
-unsigned int camera_get_frame_count(bool reset);
+bool camera_fits(framesize_t size);
+esp_err_t camera_restart(framesize_t size);
+
+// Frames from the sensor, or from a recording while one is being replayed
+camera_fb_t *camera_fb_get();
+void camera_fb_return(camera_fb_t *fb);
 
 extern char camera_name[32];
@@ -20,17 +20,29 @@
 #include "esp_log.h"
 #include "nvs_flash.h"
 
+#include "bufpool.h"
 #include "camera.h"
-#include "favicon.h"
+#include "capture.h"
+#include "clip.h"
 #include "httpd_util.h"
-#include "index.h"
 #include "rom/gpio.h"
 #include "lwip/sockets.h"
 #include "ota.h"
+#include "metrics.h"
+#include "motion.h"
+#include "rate.h"
+#include "recorder.h"
+#include "replay.h"
+#include "rtsp.h"
+#include "session.h"
 #include "sse.h"
 #include "status.h"
+#include "still.h"
+#include "stream.h"
 #include "temp.h"
+#include "trace.h"
 #include "wifi.h"
+#include "www.h"
 
 #include <esp_http_server.h>
 
@@ -38,15 +50,6 @@ const gpio_num_t LED_PIN = GPIO_NUM_21; //GPIO_NUM_4;
 static bool led_state = false;
 
 #define TAG "camera"
-#define PART_BOUNDARY "123456789000000000000987654321"
-
-#define _STREAM_CONTENT_TYPE "multipart/x-mixed-replace;boundary=" PART_BOUNDARY
-
-static const char* _STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
-static const char* _STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n";
-
-static esp_err_t stream_handler(httpd_req_t *req);
-static esp_err_t still_handler(httpd_req_t *req);
 
 static uint32_t persistent_flags;
 char camera_name[32];
@@ -64,6 +67,20 @@ void status_extra_info_function(int (*printfn)(const char *format, ...))
         printfn("Camera: name %s\n", camera_name);
     }
 
+    stream_print_info(printfn);
+    rate_print_info(printfn);
+    capture_print_info(printfn);
+    clip_print_info(printfn);
+    recorder_print_info(printfn);
+    replay_print_info(printfn);
+    motion_print_info(printfn);
+    rtsp_print_info(printfn);
+    bufpool_print_info(printfn);
+    still_print_info(printfn);
+    session_print_info(printfn);
+    www_print_info(printfn);
+    trace_print_info(printfn);
+
     float temp = temp_read();
     if (temp > 0)
     {
@@ -175,11 +192,7 @@ static esp_err_t name_handler(httpd_req_t *req)
 
 static esp_err_t config_handler(httpd_req_t *req)
 {
-    auto res = httpd_resp_set_hdr(req, "Connection", "close");
-    if (res != ESP_OK)
-    {
-        return res;
-    }
+    const char *busy = nullptr;
 
     size_t buf_len = httpd_req_get_url_query_len(req) + 1;
     if (buf_len > 1) 
@@ -194,21 +207,44 @@ static esp_err_t config_handler(httpd_req_t *req)
             if (httpd_query_key_value(buf, "resolution", param, sizeof(param)) == ESP_OK) 
             {
                 ESP_LOGI(TAG, "Found URL query parameter => resolution=%s", param);
+                int framesize = -1;
                 if (strcmp(param, "svga") == 0)
                 {
-                    s->set_framesize(s, FRAMESIZE_SVGA);
+                    framesize = FRAMESIZE_SVGA;
                 }
                 else if (strcmp(param, "vga") == 0)
                 {
-                    s->set_framesize(s, FRAMESIZE_VGA);
+                    framesize = FRAMESIZE_VGA;
                 }
                 else if (strcmp(param, "xga") == 0)
                 {
-                    s->set_framesize(s, FRAMESIZE_XGA);
+                    framesize = FRAMESIZE_XGA;
                 }
                 else if (strcmp(param, "cif") == 0)
                 {
-                    s->set_framesize(s, FRAMESIZE_CIF);
+                    framesize = FRAMESIZE_CIF;
+                }
+                else if (strcmp(param, "hd") == 0)
+                {
+                    framesize = FRAMESIZE_HD;
+                }
+                else if (strcmp(param, "sxga") == 0)
+                {
+                    framesize = FRAMESIZE_SXGA;
+                }
+                else if (strcmp(param, "uxga") == 0)
+                {
+                    framesize = FRAMESIZE_UXGA;
+                }
+
+                if (framesize >= 0)
+                {
+                    // the switch is made between frames, which can take seconds when the driver
+                    // restarts, so the reply does not wait for it. The time it took comes as an event.
+                    if (capture_set_framesize(framesize) != ESP_OK)
+                    {
+                        busy = "frame size change under way";
+                    }
                 }
             }
             else if (httpd_query_key_value(buf, "vflip", param, sizeof(param)) == ESP_OK) 
@@ -268,38 +304,47 @@ static esp_err_t config_handler(httpd_req_t *req)
                 int effect = atoi(param);
                 s->set_special_effect(s, effect);
             }
+            else if (httpd_query_key_value(buf, "quality", param, sizeof(param)) == ESP_OK) 
+            {
+                ESP_LOGI(TAG, "Found URL query parameter => quality=%s", param);
+                rate_set_quality(atoi(param));
+            }
+            else if (httpd_query_key_value(buf, "target_fps", param, sizeof(param)) == ESP_OK) 
+            {
+                ESP_LOGI(TAG, "Found URL query parameter => target_fps=%s", param);
+                rate_set_target(atoi(param), 0);
+            }
+            else if (httpd_query_key_value(buf, "target_kbps", param, sizeof(param)) == ESP_OK) 
+            {
+                ESP_LOGI(TAG, "Found URL query parameter => target_kbps=%s", param);
+                rate_set_target(0, atoi(param));
+            }
+            else if (httpd_query_key_value(buf, "quality_range", param, sizeof(param)) == ESP_OK) 
+            {
+                ESP_LOGI(TAG, "Found URL query parameter => quality_range=%s", param);
+                int q_best, q_worst;
+                if (sscanf(param, "%d-%d", &q_best, &q_worst) == 2)
+                {
+                    rate_set_bounds(q_best, q_worst);
+                }
+            }
         }
         free(buf);
     }    
-    return httpd_resp_send(req, "OK", HTTPD_RESP_USE_STRLEN);
-}
-
-static esp_err_t index_handler(httpd_req_t *req)
-{
-    esp_err_t res = httpd_resp_set_type(req, "text/html");
-    if(res != ESP_OK){
-        return res;
-    }
-    res = httpd_resp_set_hdr(req, "Connection", "close");
-    const char *head = get_index_page_head();
-    res = httpd_resp_send_chunk(req, head, HTTPD_RESP_USE_STRLEN);
-    if (res != ESP_OK)
-    {
-        return res;
-    }
-    const char *body = index_page_body;
-	res = httpd_resp_send_chunk(req, body, HTTPD_RESP_USE_STRLEN);
-    if (res != ESP_OK)
+    if (busy != nullptr)
     {
-        return res;
+        return resp_send_busy(req, busy);
     }
-    return httpd_resp_send_chunk(req, nullptr, 0);
+    return httpd_resp_send(req, "OK", HTTPD_RESP_USE_STRLEN);
 }
 
 static void server_close_fn(httpd_handle_t hd, int sockfd)
 {
     ESP_LOGI(TAG, "client closed %d", sockfd);
+    session_closed(sockfd);
     sse_remove_sink(sockfd);
+    stream_remove_sink(sockfd);
+    clip_remove_reader(sockfd);
     ESP_LOGI(TAG, "sink removed %d", sockfd);
     int err = close(sockfd);
     ESP_LOGI(TAG, "close stat %d", err);
@@ -311,51 +356,90 @@ static httpd_handle_t start_webserver(void)
     esp_log_level_set("httpd", ESP_LOG_DEBUG);  
     //esp_log_level_set("httpd_parse", ESP_LOG_DEBUG);  
     sse_init();
+    stream_init();
+    rate_init();
+    clip_init();
+    still_init();
+    session_init();
     
     httpd_handle_t server = NULL;
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.lru_purge_enable = true;
     config.max_uri_handlers = 32;
+    config.max_open_sockets = SESSION_MAX_OPEN;
     config.core_id = 0;
+    config.open_fn = session_open;
     config.close_fn = server_close_fn;
+    // connections are kept between requests, so find out about clients which have gone away
+    config.keep_alive_enable = true;
+    config.keep_alive_idle = 5;
+    config.keep_alive_interval = 5;
+    config.keep_alive_count = 3;
 
     // Start the httpd server
     ESP_LOGI(TAG, "Starting server on port: '%d'", config.server_port);
     if (httpd_start(&server, &config) == ESP_OK) {
         // Set URI handlers
         ESP_LOGI(TAG, "Registering URI handlers");
-        httpd_uri_t index{};
-        index.uri       = "/";
-        index.method    = HTTP_GET;
-        index.handler   = index_handler;
-        httpd_register_uri_handler(server, &index);
-
+        www_add_endpoints(server);
         status_add_endpoints(server);
-        favicon_add_endpoint(server);
 
         httpd_uri_t stream{};
         stream.uri       = "/stream";
         stream.method    = HTTP_GET;
         stream.handler   = stream_handler;
-        httpd_register_uri_handler(server, &stream);
+        session_register_uri_handler(server, &stream);
+
+        httpd_uri_t ws_stream{};
+        ws_stream.uri          = "/ws/stream";
+        ws_stream.method       = HTTP_GET;
+        ws_stream.handler      = stream_ws_handler;
+        ws_stream.is_websocket = true;
+        // the stream task owns the socket, httpd answering a ping itself would write into the middle of a frame
+        ws_stream.handle_ws_control_frames = true;
+        session_register_uri_handler(server, &ws_stream);
+
+        httpd_uri_t clip{};
+        clip.uri       = "/clip";
+        clip.method    = HTTP_GET;
+        clip.handler   = clip_handler;
+        session_register_uri_handler(server, &clip);
+
+        httpd_uri_t replay{};
+        replay.uri       = "/replay";
+        replay.method    = HTTP_GET;
+        replay.handler   = replay_handler;
+        session_register_uri_handler(server, &replay);
 
         httpd_uri_t events{};
         events.uri       = "/events";
         events.method    = HTTP_GET;
         events.handler   = sse_handler;
-        httpd_register_uri_handler(server, &events);
+        session_register_uri_handler(server, &events);
 
         httpd_uri_t still{};
         still.uri       = "/still";
         still.method    = HTTP_GET,
         still.handler   = still_handler,
-        httpd_register_uri_handler(server, &still);
+        session_register_uri_handler(server, &still);
+
+        httpd_uri_t metrics{};
+        metrics.uri       = "/metrics";
+        metrics.method    = HTTP_GET;
+        metrics.handler   = metrics_handler;
+        session_register_uri_handler(server, &metrics);
+
+        httpd_uri_t trace{};
+        trace.uri       = "/trace";
+        trace.method    = HTTP_GET;
+        trace.handler   = trace_handler;
+        session_register_uri_handler(server, &trace);
 
         httpd_uri_t name{};
         name.uri       = "/name";
         name.method    = HTTP_GET,
         name.handler   = name_handler,
-        httpd_register_uri_handler(server, &name);
+        session_register_uri_handler(server, &name);
 
         ota_add_endpoints(server);
 
@@ -363,19 +447,19 @@ static httpd_handle_t start_webserver(void)
         update_config.uri	  = "/config";
         update_config.method   = HTTP_GET;
         update_config.handler  = config_handler;
-        httpd_register_uri_handler(server, &update_config);
+        session_register_uri_handler(server, &update_config);
 
         httpd_uri_t led_config{};
         led_config.uri	  = "/led";
         led_config.method   = HTTP_GET;
         led_config.handler  = led_handler;
-        httpd_register_uri_handler(server, &led_config);
+        session_register_uri_handler(server, &led_config);
 
         httpd_uri_t log_config{};
         log_config.uri	  = "/log";
         log_config.method   = HTTP_GET;
         log_config.handler  = log_handler;
-        httpd_register_uri_handler(server, &log_config);
+        session_register_uri_handler(server, &log_config);
 
         #if CONFIG_EXAMPLE_BASIC_AUTH
         httpd_register_basic_auth(server);
@@ -416,7 +500,12 @@ extern "C" void app_main(void)
     wifi_init_sta("esp_camera", false);
 
     ESP_LOGI(TAG, "start up camera");
+    trace_init();
     camera_init();
+    capture_init();
+    recorder_init();
+    replay_init();
+    motion_init();
 
     if (get_saved_prefs() == ESP_OK)
     {
@@ -460,298 +549,10 @@ extern "C" void app_main(void)
     temp_init();
     httpd_handle_t handle = start_webserver();
     ESP_LOGI(TAG, "started webserver %p", handle);
+    rtsp_init();
     for (;;)
     {
         wifi_reconnect();
         vTaskDelay(pdMS_TO_TICKS(500));
     }
 }
-
-typedef struct
-{
-    httpd_req_t *req;
-    size_t len;
-} jpg_chunking_t;
-
-static size_t jpg_encode_stream(void * arg, size_t index, const void* data, size_t len)
-{
-    jpg_chunking_t *j = (jpg_chunking_t *)arg;
-    if(!index){
-        j->len = 0;
-    }
-    if(httpd_resp_send_chunk(j->req, (const char *)data, len) != ESP_OK){
-        return 0;
-    }
-    j->len += len;
-    return len;
-}
-
-static const uint8_t jfif_header[] = 
-{
-    0xff, 0xd8, 0xff, 0xe0, 0x00, 0x10, 0x4a, 0x46, 0x49, 0x46, 0x00, 0x01, 0x01, 0x01, 0x00, 0x00,  //      0: ......JFIF......
-    0x00, 0x00, 0x00, 0x00                                                                           //     10: ....
-};
-
-static const uint8_t exif_header[] =
-{
-    0xff, 0xd8, 0xff, 0xe1, 0x00, 0x86, 0x45, 0x78, 0x69, 0x66, 0x00, 0x00, 0x49, 0x49, 0x2a, 0x00,  //      0: ......Exif..II*.
-    0x08, 0x00, 0x00, 0x00, 0x02, 0x00, 0x32, 0x01, 0x02, 0x00, 0x14, 0x00, 0x00, 0x00, 0x26, 0x00,  //     10: ......2.......&.
-    0x00, 0x00, 0x69, 0x87, 0x04, 0x00, 0x01, 0x00, 0x00, 0x00, 0x3a, 0x00, 0x00, 0x00, 0x60, 0x00,  //     20: ..i.......:...`.
-    0x00, 0x00, 0x32, 0x30, 0x32, 0x32, 0x3a, 0x30, 0x36, 0x3a, 0x31, 0x30, 0x20, 0x32, 0x31, 0x3a,  //     30: ..2022:06:10 21:
-    0x32, 0x34, 0x3a, 0x35, 0x31, 0x00, 0x01, 0x00, 0x03, 0x90, 0x02, 0x00, 0x14, 0x00, 0x00, 0x00,  //     40: 24:51...........
-    0x4c, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x32, 0x30, 0x32, 0x32, 0x3a, 0x30, 0x36, 0x3a,  //     50: L.......2022:06:
-    0x31, 0x30, 0x20, 0x32, 0x31, 0x3a, 0x32, 0x34, 0x3a, 0x35, 0x31, 0x00, 0x02, 0x00, 0x01, 0x02,  //     60: 10 21:24:51.....
-    0x04, 0x00, 0x01, 0x00, 0x00, 0x00, 0x7e, 0x00, 0x00, 0x00, 0x02, 0x02, 0x04, 0x00, 0x01, 0x00,  //     70: ......~.........
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00                                       //     80: ..........
-};
-
-static esp_err_t send_jpeg_as_exif(httpd_handle_t hd, int fd, const char *buf, ssize_t buf_len)
-{
-    char tmp_header[sizeof(exif_header)];
-    memcpy(tmp_header, exif_header, sizeof(exif_header));
-    time_t now;
-    time(&now);
-    struct tm t;
-    localtime_r(&now, &t);
-    if (snprintf(tmp_header + 50, 20, "%4d:%02d:%02d %02d:%02d:%02d", 1900 + t.tm_year, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec) > 0)
-    {
-        ESP_LOGI(TAG, "image timestamp %s", tmp_header + 50);
-    }
-    memcpy(tmp_header + 88, tmp_header + 50, 20);
-    esp_err_t res = socket_send_all(hd, fd, tmp_header, sizeof(exif_header));
-    if (res == ESP_OK)
-    {
-        res = socket_send_all(hd, fd, buf + sizeof(jfif_header), buf_len - sizeof(jfif_header));
-    }
-    return res;
-}
-
-static esp_err_t still_handler(httpd_req_t *req)
-{
-    ESP_LOGI(TAG, "still_httpd req: %d", httpd_req_to_sockfd(req));
-    int64_t fr_start = esp_timer_get_time();
-
-    camera_fb_t * fb = esp_camera_fb_get();
-    if (fb == nullptr) 
-    {
-        ESP_LOGE(TAG, "Camera capture failed");
-        httpd_resp_send_500(req);
-        return ESP_FAIL;
-    }
-
-    auto res = httpd_resp_set_type(req, "image/jpeg");
-    if(res == ESP_OK)
-    {
-        res = httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
-    }
-    if(res == ESP_OK)
-    {
-        res = httpd_resp_set_hdr(req, "Cache-control", "no-cache");
-    }
-    if (res == ESP_OK)
-    {
-        res = httpd_resp_set_hdr(req, "Connection", "close");
-    }
-
-    unsigned int fb_len = 0;
-    if(res == ESP_OK)
-    {
-        if(fb->format == PIXFORMAT_JPEG)
-        {
-            fb_len = fb->len;
-            // A bit of a hack having seen the source of http_resp_send. If you pass in a non-zero length but a null buffer
-            // all the headers are sent for you including Content-length but none of the body allowing sending of the body here without
-            // copying everything out of the fb buffer as we only need to change the header from jfif to exif
-            if (fb->len > sizeof(jfif_header) && memcmp(fb->buf, jfif_header, sizeof(jfif_header)) == 0)
-            {
-                int new_len = fb->len + sizeof(exif_header) - sizeof(jfif_header);
-                res = httpd_resp_send(req, nullptr, new_len);
-                if (res == ESP_OK)
-                {
-                    res = send_jpeg_as_exif(req->handle, httpd_req_to_sockfd(req), (const char *)fb->buf, fb->len);
-                }
-                else
-                {
-                    ESP_LOGI(TAG, "jpeg header send status %d", res);
-                }
-            }
-            else
-            {
-                res = httpd_resp_send(req, (const char *)fb->buf, fb->len);
-            }
-        }
-        else
-        {
-            jpg_chunking_t jchunk = {req, 0};
-            res = frame2jpg_cb(fb, 80, jpg_encode_stream, &jchunk)?ESP_OK:ESP_FAIL;
-            httpd_resp_send_chunk(req, NULL, 0);
-            fb_len = jchunk.len;
-        }
-    }
-
-    esp_camera_fb_return(fb);
-    int64_t fr_end = esp_timer_get_time();
-    ESP_LOGI(TAG, "JPG: %ub %lums - res %d", fb_len, (uint32_t)((fr_end - fr_start)/1000), res);
-    return res;
-}
-
-struct async_frame_resp
-{
-    httpd_handle_t hd;
-    int fd;
-    int64_t last_frame_time;
-};
-
-static esp_err_t send_all(async_frame_resp *afr, const char *buf, ssize_t buf_len)
-{
-    return socket_send_all(afr->hd, afr->fd, buf, buf_len);
-}
-
-static unsigned int n_frames;
-
-unsigned int camera_get_frame_count(bool reset)
-{
-    unsigned int res = n_frames;
-
-    if (reset)
-    {
-        n_frames = 0;
-    }
-
-    return res;
-}
-
-static void send_next_frame(void *data)
-{
-    async_frame_resp *afr = static_cast<async_frame_resp *>(data);
-    int64_t grab_start = esp_timer_get_time();
-    ESP_LOGI(TAG, "@%lld: stream next frame: %d on %d", grab_start / 1000, afr->fd, xPortGetCoreID());
-
-    camera_fb_t * fb = esp_camera_fb_get();
-    if (fb == nullptr)
-    {
-        ESP_LOGE(TAG, "Camera capture failed");
-        free(afr);
-        return;
-    }
-
-    ++n_frames;
-
-    size_t jpg_buf_len;
-    uint8_t * jpg_buf;
-
-    if (fb->format != PIXFORMAT_JPEG)
-    {
-        bool jpeg_converted = frame2jpg(fb, 80, &jpg_buf, &jpg_buf_len);
-        if(!jpeg_converted)
-        {
-            ESP_LOGE(TAG, "JPEG compression failed");
-            esp_camera_fb_return(fb);
-            free(afr);
-            return;
-        }
-    }
-    else 
-    {
-        jpg_buf_len = fb->len;
-        jpg_buf = fb->buf;
-    }
-
-    ESP_LOGI(TAG, "frame length: %zd", jpg_buf_len);
-
-    int64_t send_start = esp_timer_get_time();
-
-    char part_buf[128];
-    auto res = socket_send_chunk(afr->hd, afr->fd, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
-
-    if (res == ESP_OK)
-    {
-        size_t hlen = snprintf(part_buf, 64, _STREAM_PART, jpg_buf_len);
-
-        res = socket_send_chunk(afr->hd, afr->fd, part_buf, hlen);
-    }
-
-    if (res == ESP_OK)
-    {
-        if (jpg_buf_len > sizeof(jfif_header) && memcmp(jpg_buf, jfif_header, sizeof(jfif_header)) == 0)
-        {
-            int new_len = jpg_buf_len + sizeof(exif_header) - sizeof(jfif_header);
-            char len_str[10];
-            snprintf(len_str, sizeof(len_str), "%x\r\n", new_len);
-            res = send_all(afr, len_str, strlen(len_str));
-            if (res == ESP_OK)
-            {
-                res = send_jpeg_as_exif(afr->hd, afr->fd, (const char *)jpg_buf, jpg_buf_len);
-            }
-            if (res == ESP_OK)
-            {
-                res = send_all(afr, "\r\n", 2); // end of chunk
-            }
-        }
-        else
-        {
-            res = socket_send_chunk(afr->hd, afr->fd, (const char *)jpg_buf, jpg_buf_len);
-        }
-    }
-
-    int64_t send_end = esp_timer_get_time();
-    int64_t send_time = send_end - send_start;
-    int64_t rate = (jpg_buf_len * 1000000ll) / send_time;
-    ESP_LOGI(TAG, "@%lld: Send rate %ld bps %d in %ld.%03ld ms", send_end / 1000, (int32_t)rate, jpg_buf_len, (int32_t)(send_time / 1000), (int32_t)(send_time % 1000));
-    if (fb->format != PIXFORMAT_JPEG)
-    {
-        free(jpg_buf);
-    }
-
-    esp_camera_fb_return(fb);
-
-    if (res != ESP_OK)
-    {
-        ESP_LOGI(TAG, "Send err %d", (int)res);
-        free(afr);
-        return;
-    }
-
-    int64_t fr_end = esp_timer_get_time();
-    int64_t frame_time = fr_end - afr->last_frame_time;
-    afr->last_frame_time = fr_end;
-    frame_time /= 1000;
-    ESP_LOGI(TAG, "MJPG: fd %d: %luKB %lums (%.1ffps)", afr->fd, (uint32_t)(jpg_buf_len/1024), (uint32_t)frame_time, 1000.0 / (uint32_t)frame_time);
-    res = httpd_queue_work(afr->hd, send_next_frame, afr);
-    ESP_LOGI(TAG, "Queue work err %d", (int)res);
-}
-
-static esp_err_t stream_handler(httpd_req_t *req)
-{
-    ESP_LOGI(TAG, "stream2 req: %d", httpd_req_to_sockfd(req));
-    auto *afr = static_cast<async_frame_resp*>(malloc(sizeof(struct async_frame_resp)));
-    afr->hd = req->handle;
-    afr->fd = httpd_req_to_sockfd(req);
-    afr->last_frame_time = esp_timer_get_time();
-    if (afr->fd < 0) 
-    {
-        free(afr);
-        return ESP_FAIL;
-    }
-
-    int one = 1;
-    setsockopt(afr->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
-
-    const char *httpd_hdr_str = "HTTP/1.1 200 ok\r\nContent-Type: " _STREAM_CONTENT_TYPE "\r\nTransfer-Encoding: chunked\r\nConnection: close\r\nAccess-Control-Allow-Origin: *\r\n\r\n";
-    auto res = send_all(afr, httpd_hdr_str, strlen(httpd_hdr_str));
-    if (res != ESP_OK)
-    {
-        ESP_LOGI(TAG, "send header failed : %d", res);
-        free(afr);
-        return res;
-    }
-
-    ESP_LOGI(TAG, "Queuing work fd : %d", afr->fd);
-    res = httpd_queue_work(req->handle, send_next_frame, afr);
-    if (res != ESP_OK)
-    {
-        free(afr);
-        ESP_LOGI(TAG, "Queuing work failed : %d", res);
-    }
-    return res;
-}
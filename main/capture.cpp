@@ -0,0 +1,533 @@
+#include <esp_log.h>
+#include <sys/time.h>
+#include "camera.h"
+#include "capture.h"
+#include "metrics.h"
+#include "replay.h"
+#include "sse.h"
+#include "trace.h"
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#define TAG "capture"
+
+// After a change frames are thrown away until one is whole and the new size, giving up after this many
+#define CAPTURE_SETTLE_FRAMES 6
+// How long a change waits for every frame to come back before restarting the driver
+#define CAPTURE_DRAIN_MS 3000
+#define CAPTURE_CHANGE_TIMEOUT_MS 10000
+
+struct capture_consumer
+{
+    capture_consumer_fn fn;
+    void *arg;
+};
+
+static SemaphoreHandle_t mutex = nullptr;
+static SemaphoreHandle_t free_frames = nullptr;
+static TaskHandle_t task = nullptr;
+
+static capture_frame frames[CAPTURE_MAX_FRAMES];
+static capture_consumer consumers[CAPTURE_MAX_CONSUMERS];
+static int n_consumers;
+static std::atomic<int> demand;
+static uint32_t last_seq;
+static std::atomic<unsigned int> n_frames;
+static int64_t last_timestamp;
+
+// A settings change waiting for the capture task, one at a time
+struct capture_change
+{
+    uint32_t seq;
+    int framesize;
+    int quality;
+    esp_err_t result;
+    int64_t switch_us;
+};
+
+static SemaphoreHandle_t change_lock = nullptr;
+static SemaphoreHandle_t change_done = nullptr;
+static capture_change change;
+static std::atomic<bool> change_pending;
+static uint32_t last_change_seq;    // under change_lock
+static std::atomic<uint32_t> done_seq;      // of the last change the capture task finished
+static camera_fb_t *settled_fb;     // first good frame after a change, used next
+static std::atomic<int> next_quality{-1};   // from capture_set_quality, -1 for none
+
+static unsigned int n_changes;
+static unsigned int n_restarts;
+static unsigned int n_settle_dropped;
+static int64_t last_switch_us;
+
+bool capture_add_consumer(capture_consumer_fn fn, void *arg)
+{
+    bool added = false;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    if (n_consumers < CAPTURE_MAX_CONSUMERS)
+    {
+        consumers[n_consumers].fn = fn;
+        consumers[n_consumers].arg = arg;
+        ++n_consumers;
+        added = true;
+    }
+    xSemaphoreGive(mutex);
+
+    return added;
+}
+
+void capture_acquire()
+{
+    if (demand.fetch_add(1) == 0)
+    {
+        xTaskNotifyGive(task);
+    }
+}
+
+void capture_release()
+{
+    demand.fetch_sub(1);
+}
+
+unsigned int capture_get_frame_count(bool reset)
+{
+    return reset ? n_frames.exchange(0) : n_frames.load();
+}
+
+int64_t capture_wall_time(int64_t timestamp)
+{
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    return now.tv_sec * 1000000ll + now.tv_usec - (esp_timer_get_time() - timestamp);
+}
+
+// The sensor counts exposure in lines, near enough 50us each for the OV2640 at our clock, and gain
+// in steps up from 1x. It only reports what it was set to so the settings chosen in automatic mode
+// are left as unknown.
+#define CAPTURE_LINE_US 50
+
+void capture_exif_fields(const capture_frame *frame, exif_fields *fields)
+{
+    int64_t wall_time = capture_wall_time(frame->timestamp);
+    fields->when.tv_sec = wall_time / 1000000;
+    fields->when.tv_usec = wall_time % 1000000;
+    fields->seq = frame->seq;
+    fields->exposure_us = 0;
+    fields->iso = 0;
+    fields->name = camera_name;
+
+    sensor_t *s = esp_camera_sensor_get();
+    if (s != nullptr)
+    {
+        if (!s->status.aec)
+        {
+            fields->exposure_us = s->status.aec_value * CAPTURE_LINE_US;
+        }
+        if (!s->status.agc)
+        {
+            fields->iso = 100 * (s->status.agc_gain + 1);
+        }
+    }
+}
+
+void capture_frame_ref(capture_frame *frame)
+{
+    frame->refs.fetch_add(1);
+}
+
+void capture_frame_unref(capture_frame *frame)
+{
+    if (frame->refs.fetch_sub(1) != 1)
+    {
+        return;
+    }
+
+    if (frame->encoded != nullptr)
+    {
+        bufpool_put(frame->encoded);
+        frame->encoded = nullptr;
+    }
+    for (int i = 0; i <= SCALE_MAX; ++i)
+    {
+        if (frame->scaled[i] != nullptr)
+        {
+            bufpool_put(frame->scaled[i]);
+            frame->scaled[i] = nullptr;
+        }
+    }
+    camera_fb_return(frame->fb);
+    frame->fb = nullptr;
+    frame->buf = nullptr;
+    xSemaphoreGive(free_frames);
+}
+
+static capture_frame *get_free_frame()
+{
+    xSemaphoreTake(free_frames, portMAX_DELAY);
+    for (int i = 0; i < CAPTURE_MAX_FRAMES; ++i)
+    {
+        if (frames[i].fb == nullptr)
+        {
+            return frames + i;
+        }
+    }
+    // can't happen, the semaphore counts the free slots
+    ESP_LOGE(TAG, "no free frame slot");
+    xSemaphoreGive(free_frames);
+    return nullptr;
+}
+
+static bool fill_frame(capture_frame *frame, camera_fb_t *fb)
+{
+    frame->fb = fb;
+    frame->encoded = nullptr;
+    frame->timestamp = fb->timestamp.tv_sec * 1000000ll + fb->timestamp.tv_usec;
+
+    if (fb->format == PIXFORMAT_JPEG)
+    {
+        frame->buf = fb->buf;
+        frame->len = fb->len;
+        return true;
+    }
+
+    frame->encoded = bufpool_encode(fb, 80);
+    if (frame->encoded == nullptr)
+    {
+        frame->fb = nullptr;
+        return false;
+    }
+    frame->buf = frame->encoded->data;
+    frame->len = frame->encoded->len;
+    return true;
+}
+
+static bool jpeg_dimensions(const uint8_t *buf, size_t len, int *width, int *height)
+{
+    const uint8_t *end = buf + len;
+    const uint8_t *p = buf + 2;
+    while (p + 9 <= end && p[0] == 0xff)
+    {
+        if (p[1] >= 0xc0 && p[1] <= 0xc2)
+        {
+            *height = (p[5] << 8) | p[6];
+            *width = (p[7] << 8) | p[8];
+            return true;
+        }
+        p += 2 + ((p[2] << 8) | p[3]);
+    }
+    return false;
+}
+
+// Whole and at the size asked for, rather than cut short or started before the change
+static bool frame_settled(const camera_fb_t *fb, framesize_t size)
+{
+    if (fb->format != PIXFORMAT_JPEG)
+    {
+        return fb->width == resolution[size].width && fb->height == resolution[size].height;
+    }
+
+    int width, height;
+    return fb->len > 4 && fb->buf[fb->len - 2] == 0xff && fb->buf[fb->len - 1] == 0xd9 &&
+           jpeg_dimensions(fb->buf, fb->len, &width, &height) && width == resolution[size].width && height == resolution[size].height;
+}
+
+// Waits for every frame to be handed back, so the driver can be restarted. Stream clients too slow
+// to finish theirs copy what is left of it so this does not wait on the network.
+static bool drain_frames()
+{
+    int taken = 0;
+    TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(CAPTURE_DRAIN_MS);
+    while (taken < CAPTURE_MAX_FRAMES)
+    {
+        TickType_t now = xTaskGetTickCount();
+        if (now >= deadline || xSemaphoreTake(free_frames, deadline - now) != pdTRUE)
+        {
+            break;
+        }
+        ++taken;
+    }
+
+    if (taken < CAPTURE_MAX_FRAMES)
+    {
+        for (int i = 0; i < taken; ++i)
+        {
+            xSemaphoreGive(free_frames);
+        }
+        return false;
+    }
+    return true;
+}
+
+// Runs on the capture task, between frames
+static void apply_change()
+{
+    int64_t start = esp_timer_get_time();
+    sensor_t *s = esp_camera_sensor_get();
+    framesize_t size = change.framesize >= 0 ? static_cast<framesize_t>(change.framesize) : s->status.framesize;
+    change.result = ESP_OK;
+
+    if (replay_active())
+    {
+        // a recording comes at the size it was made
+        change.result = ESP_ERR_NOT_SUPPORTED;
+        return;
+    }
+
+    if (settled_fb != nullptr)
+    {
+        camera_fb_return(settled_fb);
+        settled_fb = nullptr;
+    }
+
+    if (!camera_fits(size))
+    {
+        if (!drain_frames())
+        {
+            ESP_LOGE(TAG, "frames still in use, not restarting the camera");
+            change.result = ESP_ERR_TIMEOUT;
+            return;
+        }
+        change.result = camera_restart(size);
+        for (int i = 0; i < CAPTURE_MAX_FRAMES; ++i)
+        {
+            xSemaphoreGive(free_frames);
+        }
+        if (change.result != ESP_OK)
+        {
+            return;
+        }
+        ++n_restarts;
+        s = esp_camera_sensor_get();
+        if (change.quality >= 0)
+        {
+            s->set_quality(s, change.quality);
+        }
+    }
+    else
+    {
+        if (change.framesize >= 0)
+        {
+            s->set_framesize(s, size);
+        }
+        if (change.quality >= 0)
+        {
+            s->set_quality(s, change.quality);
+        }
+    }
+
+    // The first frame may have been under way during the change, and the driver may still have
+    // some at the old size queued. A change of quality alone leaves every frame usable.
+    for (int i = 0; change.framesize >= 0 && i < CAPTURE_SETTLE_FRAMES; ++i)
+    {
+        camera_fb_t *fb = camera_fb_get();
+        if (fb == nullptr)
+        {
+            continue;
+        }
+        if (i > 0 && frame_settled(fb, size))
+        {
+            settled_fb = fb;
+            break;
+        }
+        camera_fb_return(fb);
+        ++n_settle_dropped;
+    }
+
+    change.switch_us = esp_timer_get_time() - start;
+    last_switch_us = change.switch_us;
+    ++n_changes;
+    ESP_LOGI(TAG, "switched to %dx%d quality %d in %lld ms", resolution[size].width, resolution[size].height, s->status.quality, change.switch_us / 1000);
+}
+
+// Nobody waits on a change posted by capture_set_framesize, so how it went goes out as an event
+static void report_change()
+{
+    sensor_t *s = esp_camera_sensor_get();
+    framesize_t size = s->status.framesize;
+    char buf[160];
+    int len = snprintf(buf, sizeof(buf), "{ \"seq\": %lu, \"width\": %d, \"height\": %d, \"quality\": %d, \"switch_ms\": %lld.%03lld, \"result\": \"%s\" }",
+                       static_cast<unsigned long>(change.seq), resolution[size].width, resolution[size].height, s->status.quality,
+                       change.switch_us / 1000, change.switch_us % 1000, esp_err_to_name(change.result));
+    sse_broadcast("capture", buf, len);
+}
+
+// Called with change_lock held. change_done may have been given for an earlier change, so it is
+// done_seq that says when this one is finished.
+static bool wait_change(uint32_t seq)
+{
+    int64_t until = esp_timer_get_time() + CAPTURE_CHANGE_TIMEOUT_MS * 1000ll;
+    while (done_seq.load() != seq)
+    {
+        int64_t left_ms = (until - esp_timer_get_time()) / 1000;
+        if (left_ms <= 0 || xSemaphoreTake(change_done, pdMS_TO_TICKS(left_ms)) != pdTRUE)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Called with change_lock held and no change pending
+static void post_change(int framesize, int quality)
+{
+    // so a give left over from a change that timed out does not end a wait early
+    xSemaphoreTake(change_done, 0);
+    change.seq = ++last_change_seq;
+    change.framesize = framesize;
+    change.quality = quality;
+    change.result = ESP_ERR_TIMEOUT;
+    change.switch_us = 0;
+    change_pending.store(true);
+    xTaskNotifyGive(task);
+}
+
+esp_err_t capture_reconfigure(int framesize, int quality, int64_t *switch_us)
+{
+    xSemaphoreTake(change_lock, portMAX_DELAY);
+    // a change that timed out may still be under way, it is left to finish rather than overwritten
+    if (change_pending.load() && !wait_change(change.seq))
+    {
+        xSemaphoreGive(change_lock);
+        return ESP_ERR_TIMEOUT;
+    }
+
+    post_change(framesize, quality);
+    esp_err_t res = ESP_ERR_TIMEOUT;
+    if (wait_change(change.seq))
+    {
+        res = change.result;
+        if (switch_us != nullptr)
+        {
+            *switch_us = change.switch_us;
+        }
+    }
+    xSemaphoreGive(change_lock);
+    return res;
+}
+
+esp_err_t capture_set_framesize(int framesize)
+{
+    // somebody in capture_reconfigure holds the lock for as long as their change takes
+    if (xSemaphoreTake(change_lock, 0) != pdTRUE)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t res = ESP_ERR_INVALID_STATE;
+    if (!change_pending.load())
+    {
+        post_change(framesize, -1);
+        res = ESP_OK;
+    }
+    xSemaphoreGive(change_lock);
+    return res;
+}
+
+void capture_set_quality(int quality)
+{
+    next_quality.store(quality);
+    xTaskNotifyGive(task);
+}
+
+void capture_print_info(int (*printfn)(const char *format, ...))
+{
+    printfn("Capture: %u changes %u restarts %u frames dropped settling, last switch %lld ms%s\n", n_changes, n_restarts, n_settle_dropped,
+            last_switch_us / 1000, change_pending.load() ? ", switching" : "");
+}
+
+static void capture_task(void *)
+{
+    for (;;)
+    {
+        if (change_pending.load())
+        {
+            apply_change();
+            report_change();
+            done_seq.store(change.seq);
+            change_pending.store(false);
+            xSemaphoreGive(change_done);
+            continue;
+        }
+
+        int quality = next_quality.exchange(-1);
+        if (quality >= 0 && !replay_active())
+        {
+            sensor_t *s = esp_camera_sensor_get();
+            s->set_quality(s, quality);
+        }
+
+        if (demand.load() == 0)
+        {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        capture_frame *frame = get_free_frame();
+        if (frame == nullptr)
+        {
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+
+        trace(TRACE_CAPTURE_START);
+        camera_fb_t *fb = settled_fb != nullptr ? settled_fb : camera_fb_get();
+        settled_fb = nullptr;
+        if (fb == nullptr)
+        {
+            ESP_LOGE(TAG, "Camera capture failed");
+            xSemaphoreGive(free_frames);
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+
+        if (!fill_frame(frame, fb))
+        {
+            camera_fb_return(fb);
+            xSemaphoreGive(free_frames);
+            continue;
+        }
+
+        frame->seq = ++last_seq;
+        trace(TRACE_CAPTURE_END, -1, frame->seq);
+        ++n_frames;
+        metrics_frames_captured.fetch_add(1, std::memory_order_relaxed);
+        if (last_timestamp != 0)
+        {
+            metrics_observe(&metrics_capture_interval, frame->timestamp - last_timestamp);
+        }
+        last_timestamp = frame->timestamp;
+        // the capture task holds one reference while the consumers are told about the frame
+        frame->refs.store(1);
+
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        for (int i = 0; i < n_consumers; ++i)
+        {
+            consumers[i].fn(frame, consumers[i].arg);
+        }
+        xSemaphoreGive(mutex);
+
+        capture_frame_unref(frame);
+    }
+}
+
+esp_err_t capture_init()
+{
+    mutex = xSemaphoreCreateMutex();
+    free_frames = xSemaphoreCreateCounting(CAPTURE_MAX_FRAMES, CAPTURE_MAX_FRAMES);
+    change_lock = xSemaphoreCreateMutex();
+    change_done = xSemaphoreCreateBinary();
+    for (int i = 0; i < CAPTURE_MAX_FRAMES; ++i)
+    {
+        frames[i].index = i;
+    }
+
+    if (xTaskCreate(capture_task, "capture", 4096, nullptr, 5, &task) != pdPASS)
+    {
+        ESP_LOGE(TAG, "failed to create capture task");
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+
+#include "bufpool.h"
+#include "esp_camera.h"
+#include "esp_err.h"
+#include "exif.h"
+#include "scale.h"
+
+// Frames in flight at once. The driver needs a free buffer of its own to keep capturing
+// so this has to stay below the fb_count given to the camera in camera_init. Two lets
+// fast clients carry on with a new frame while a slow one is still on the previous.
+#define CAPTURE_MAX_FRAMES 2
+#define CAPTURE_MAX_CONSUMERS 8
+
+// A frame grabbed once by the capture task and shared by every consumer. The camera
+// buffer goes back to the driver when the last reference is dropped.
+struct capture_frame
+{
+    camera_fb_t *fb;
+    const uint8_t *buf; // always jpeg, either the sensor buffer or a converted copy
+    size_t len;
+    bufpool_buf *encoded; // holds the converted copy for non-jpeg sensor formats
+    bufpool_buf *scaled[SCALE_MAX + 1]; // downscaled copies made on demand, indexed by scale
+    uint32_t seq;
+    int64_t timestamp;  // from fb->timestamp, microseconds since boot
+    int index;          // slot number, 0 .. CAPTURE_MAX_FRAMES - 1
+    std::atomic<int> refs;
+};
+
+// Called on the capture task for every new frame, take a reference to keep it beyond the call
+typedef void (*capture_consumer_fn)(capture_frame *frame, void *arg);
+
+extern esp_err_t capture_init();
+extern bool capture_add_consumer(capture_consumer_fn fn, void *arg);
+
+// Frames are only captured while somebody wants them
+extern void capture_acquire();
+extern void capture_release();
+
+// Frames captured since the last reset, however many clients each one went to
+extern unsigned int capture_get_frame_count(bool reset);
+
+// Converts a capture timestamp to microseconds since the epoch using the current offset between
+// the boot and wall clocks, so it follows SNTP corrections
+extern int64_t capture_wall_time(int64_t timestamp);
+
+// Changes the frame size and quality (-1 leaves either as it is) between frames. Frames made
+// during the change are thrown away. If the driver has to be restarted for bigger buffers every
+// frame is waited for first. switch_us is how long it took to the first good frame after.
+extern esp_err_t capture_reconfigure(int framesize, int quality, int64_t *switch_us);
+
+// Asks for a new frame size without waiting, for the httpd task. The switch is made as by
+// capture_reconfigure and how long it took goes out as a "capture" event and in the status.
+// ESP_ERR_INVALID_STATE while another change is under way.
+extern esp_err_t capture_set_framesize(int framesize);
+
+// Asks for a new quality without waiting for it, the capture task sets it before its next frame.
+// The size stays the same so no frames are thrown away. Safe from a timer callback.
+extern void capture_set_quality(int quality);
+extern void capture_print_info(int (*printfn)(const char *format, ...));
+
+// Fills in what the exif header says about the frame
+extern void capture_exif_fields(const capture_frame *frame, exif_fields *fields);
+
+extern void capture_frame_ref(capture_frame *frame);
+extern void capture_frame_unref(capture_frame *frame);
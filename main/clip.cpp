@@ -0,0 +1,516 @@
+#include <esp_log.h>
+#include "capture.h"
+#include "clip.h"
+#include "httpd_util.h"
+#include "metrics.h"
+#include "lwip/sockets.h"
+#include "session.h"
+
+#include "esp_heap_caps.h"
+#include "freertos/semphr.h"
+#include "freertos/timers.h"
+
+#include <algorithm>
+
+#define TAG "clip"
+#define PART_BOUNDARY "123456789000000000000987654321"
+
+// The last few seconds of frames are kept so a clip can start before whatever prompted it.
+// Frames are copied once into a PSRAM ring when they are captured, the live streams keep
+// sending straight from the camera buffer. The ring takes a share of the PSRAM free at start up
+// between CLIP_BUDGET_MIN and CLIP_BUDGET_MAX. When the frame rate and size would fill it in less
+// than CLIP_SECONDS, frames are kept further apart so the clip still covers the whole time at a
+// lower rate.
+#ifndef CLIP_SECONDS
+#define CLIP_SECONDS 10
+#endif
+#ifndef CLIP_BUDGET_MAX
+#define CLIP_BUDGET_MAX (3 * 1024 * 1024)
+#endif
+#ifndef CLIP_BUDGET_MIN
+#define CLIP_BUDGET_MIN (512 * 1024)
+#endif
+#define CLIP_BUDGET_SHARE 3            // of the free PSRAM
+#define CLIP_MAX_ENTRIES 256
+#define CLIP_MAX_READERS 2
+#define CLIP_RETRY_MS 20               // before trying a reader whose socket was full again
+
+struct clip_entry
+{
+    size_t offset;      // into the arena
+    size_t len;
+    int64_t timestamp;
+    uint32_t seq;
+};
+
+// A clip download in progress. Entries from next_seq on are pinned until it has sent them.
+struct clip_reader
+{
+    httpd_handle_t hd;
+    int fd;
+    uint32_t id;
+    uint32_t next_seq;
+    uint32_t end_seq;
+
+    // the part being sent, or the closing chunk once there are no more
+    char part[160];
+    struct iovec iov[3];
+    struct iovec *next;     // what is left of it
+    int iovcnt;
+    uint32_t sending_seq;
+    bool finishing;
+    bool blocked;           // waiting on the retry timer
+};
+
+static SemaphoreHandle_t mutex = nullptr;
+static uint8_t *arena;
+static size_t arena_size;
+static clip_entry entries[CLIP_MAX_ENTRIES];   // oldest first starting at first
+static int first;
+static int count;
+static size_t head;                            // arena offset just past the newest frame
+static clip_reader *readers[CLIP_MAX_READERS];
+static uint32_t last_reader_id;
+static TimerHandle_t retry_timer;
+
+// the capture task's alone
+static size_t avg_len;
+static int64_t last_kept;
+
+static unsigned int n_stored;
+static unsigned int n_evicted;
+static unsigned int n_skipped;
+static unsigned int n_decimated;
+
+// The least time between kept frames for CLIP_SECONDS of frames of the average size to fit in
+// three quarters of the arena, the rest being slack for frames bigger than average and the end
+// given up when the ring wraps.
+static int64_t spacing_us()
+{
+    return CLIP_SECONDS * 1000000ll * avg_len / (arena_size * 3 / 4);
+}
+
+static bool pinned(uint32_t seq)
+{
+    for (int i = 0; i < CLIP_MAX_READERS; ++i)
+    {
+        if (readers[i] != nullptr && readers[i]->next_seq <= seq)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool evict_oldest()
+{
+    if (count == 0 || pinned(entries[first].seq))
+    {
+        return false;
+    }
+    first = (first + 1) % CLIP_MAX_ENTRIES;
+    --count;
+    ++n_evicted;
+    return true;
+}
+
+// Finds room for len bytes, evicting the oldest frames as needed. Frames never wrap round the end
+// of the arena so every entry is one contiguous block. Called with the mutex held.
+static bool reserve(size_t len, size_t *offset)
+{
+    size_t pos = head + len > arena_size ? 0 : head;
+
+    if (count == CLIP_MAX_ENTRIES && !evict_oldest())
+    {
+        return false;
+    }
+
+    while (count > 0)
+    {
+        const clip_entry &oldest = entries[first];
+        bool overlaps = oldest.offset < pos + len && pos < oldest.offset + oldest.len;
+        // wrapping to the start gives up the space at the end of the arena along with what is in it
+        bool passed_over = pos == 0 && head != 0 && oldest.offset >= head;
+        if (!overlaps && !passed_over)
+        {
+            break;
+        }
+        if (!evict_oldest())
+        {
+            return false;
+        }
+    }
+
+    *offset = pos;
+    return true;
+}
+
+// Runs on the capture task
+static void on_frame(capture_frame *frame, void *)
+{
+    if (frame->len > arena_size / 4)
+    {
+        ++n_skipped;
+        return;
+    }
+
+    avg_len = avg_len == 0 ? frame->len : (avg_len * 7 + frame->len) / 8;
+    if (last_kept != 0 && frame->timestamp - last_kept < spacing_us())
+    {
+        ++n_decimated;
+        return;
+    }
+
+    size_t offset;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    // anything older than the retention time goes first so it is not kept just because there is room
+    while (count > 0 && frame->timestamp - entries[first].timestamp > CLIP_SECONDS * 1000000ll && evict_oldest())
+    {
+    }
+    bool reserved = reserve(frame->len, &offset);
+    xSemaphoreGive(mutex);
+
+    if (!reserved)
+    {
+        // a slow clip download is holding on to the frames that would have made room
+        ++n_skipped;
+        return;
+    }
+
+    // the reserved space is not part of any entry so nobody else is looking at it
+    memcpy(arena + offset, frame->buf, frame->len);
+    last_kept = frame->timestamp;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    clip_entry &entry = entries[(first + count) % CLIP_MAX_ENTRIES];
+    entry.offset = offset;
+    entry.len = frame->len;
+    entry.timestamp = frame->timestamp;
+    entry.seq = frame->seq;
+    ++count;
+    head = offset + frame->len;
+    ++n_stored;
+    xSemaphoreGive(mutex);
+}
+
+static void free_reader(clip_reader *reader)
+{
+    for (int i = 0; i < CLIP_MAX_READERS; ++i)
+    {
+        if (readers[i] == reader)
+        {
+            readers[i] = nullptr;
+        }
+    }
+    free(reader);
+}
+
+static clip_reader *find_reader(uint32_t id)
+{
+    for (int i = 0; i < CLIP_MAX_READERS; ++i)
+    {
+        if (readers[i] != nullptr && readers[i]->id == id)
+        {
+            return readers[i];
+        }
+    }
+    return nullptr;
+}
+
+// Called with the mutex held. Sets the reader up to send its next frame, or the end of the
+// response when it has sent them all.
+static void start_part(clip_reader *reader)
+{
+    const clip_entry *entry = nullptr;
+    for (int i = 0; i < count; ++i)
+    {
+        const clip_entry &e = entries[(first + i) % CLIP_MAX_ENTRIES];
+        if (e.seq >= reader->next_seq && e.seq <= reader->end_seq)
+        {
+            entry = &e;
+            break;
+        }
+    }
+
+    reader->next = reader->iov;
+    if (entry == nullptr)
+    {
+        const char *end = "\r\n--" PART_BOUNDARY "--\r\n";
+        reader->iov[0].iov_base = reader->part;
+        reader->iov[0].iov_len = snprintf(reader->part, sizeof(reader->part), "%x\r\n%s\r\n0\r\n\r\n", strlen(end), end);
+        reader->iovcnt = 1;
+        reader->finishing = true;
+        return;
+    }
+
+    char part_header[128];
+    int part_header_len = snprintf(part_header, sizeof(part_header),
+        "\r\n--" PART_BOUNDARY "\r\nContent-Type: image/jpeg\r\nContent-Length: %u\r\nX-Timestamp: %lld.%06lld\r\n\r\n",
+        entry->len, entry->timestamp / 1000000, entry->timestamp % 1000000);
+
+    reader->iov[0].iov_base = reader->part;
+    reader->iov[0].iov_len = snprintf(reader->part, sizeof(reader->part), "%x\r\n%s", part_header_len + entry->len, part_header);
+    reader->iov[1].iov_base = arena + entry->offset;
+    reader->iov[1].iov_len = entry->len;
+    reader->iov[2].iov_base = const_cast<char *>("\r\n");
+    reader->iov[2].iov_len = 2;
+    reader->iovcnt = 3;
+    reader->sending_seq = entry->seq;
+}
+
+// Sends what the socket will take of a clip without blocking then queues itself again, so other
+// requests get the httpd task in between. When the socket is full the retry timer queues it
+// instead, rather than it going round and round on the httpd task. Runs on the httpd task, as
+// does the close function which can remove the reader, so it is looked up by id each time rather
+// than trusting a pointer.
+static void send_next(void *arg)
+{
+    uint32_t id = (uint32_t)(uintptr_t)arg;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    clip_reader *reader = find_reader(id);
+    if (reader == nullptr)
+    {
+        xSemaphoreGive(mutex);
+        return;
+    }
+    if (reader->iovcnt == 0)
+    {
+        start_part(reader);
+    }
+    httpd_handle_t hd = reader->hd;
+    int fd = reader->fd;
+    xSemaphoreGive(mutex);
+
+    // the entry is pinned by the reader so can be sent from the arena without the lock
+    int len = socket_sendv_some(fd, &reader->next, &reader->iovcnt);
+    if (len < 0)
+    {
+        ESP_LOGI(TAG, "Send err %d, closing %d", errno, fd);
+        session_release(fd);
+        httpd_sess_trigger_close(hd, fd);
+        return;
+    }
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    if (reader->iovcnt == 0 && reader->finishing)
+    {
+        free_reader(reader);
+        xSemaphoreGive(mutex);
+        // the connection can go back to serving requests, and be closed when idle
+        session_release(fd);
+        ESP_LOGI(TAG, "clip done on %d", fd);
+        return;
+    }
+    if (reader->iovcnt == 0)
+    {
+        reader->next_seq = reader->sending_seq + 1;
+    }
+    else if (len == 0)
+    {
+        reader->blocked = true;
+        xSemaphoreGive(mutex);
+        xTimerStart(retry_timer, 0);
+        return;
+    }
+    xSemaphoreGive(mutex);
+
+    if (httpd_queue_work(hd, send_next, arg) != ESP_OK)
+    {
+        metrics_httpd_queue_failures.fetch_add(1, std::memory_order_relaxed);
+        session_release(fd);
+        httpd_sess_trigger_close(hd, fd);
+    }
+}
+
+// Runs on the timer task
+static void retry_blocked(TimerHandle_t)
+{
+    bool again = false;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (int i = 0; i < CLIP_MAX_READERS; ++i)
+    {
+        clip_reader *reader = readers[i];
+        if (reader == nullptr || !reader->blocked)
+        {
+            continue;
+        }
+        if (httpd_queue_work(reader->hd, send_next, (void *)(uintptr_t)reader->id) == ESP_OK)
+        {
+            reader->blocked = false;
+        }
+        else
+        {
+            metrics_httpd_queue_failures.fetch_add(1, std::memory_order_relaxed);
+            again = true;
+        }
+    }
+    xSemaphoreGive(mutex);
+
+    if (again)
+    {
+        xTimerStart(retry_timer, 0);
+    }
+}
+
+void clip_print_info(int (*printfn)(const char *format, ...))
+{
+    if (mutex == nullptr)
+    {
+        return;
+    }
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    int64_t span = count > 0 ? entries[(first + count - 1) % CLIP_MAX_ENTRIES].timestamp - entries[first].timestamp : 0;
+    printfn("Clip: %d frames %lld ms in %u KB stored %u evicted %u skipped %u decimated %u (one per %lld ms)\n",
+        count, span / 1000, arena_size / 1024, n_stored, n_evicted, n_skipped, n_decimated, spacing_us() / 1000);
+    xSemaphoreGive(mutex);
+}
+
+esp_err_t clip_handler(httpd_req_t *req)
+{
+    int fd = httpd_req_to_sockfd(req);
+    if (fd < 0)
+    {
+        return ESP_FAIL;
+    }
+
+    int seconds = CLIP_SECONDS;
+    size_t buf_len = httpd_req_get_url_query_len(req) + 1;
+    if (buf_len > 1)
+    {
+        char *buf = (char *)malloc(buf_len);
+        if (httpd_req_get_url_query_str(req, buf, buf_len) == ESP_OK)
+        {
+            char param[8];
+            if (httpd_query_key_value(buf, "seconds", param, sizeof(param)) == ESP_OK)
+            {
+                seconds = atoi(param);
+            }
+        }
+        free(buf);
+    }
+    if (seconds <= 0 || seconds > CLIP_SECONDS)
+    {
+        seconds = CLIP_SECONDS;
+    }
+
+    auto *reader = static_cast<clip_reader*>(calloc(1, sizeof(struct clip_reader)));
+    if (reader == nullptr)
+    {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "out of memory");
+    }
+    reader->hd = req->handle;
+    reader->fd = fd;
+
+    const char *error = nullptr;
+    bool busy = false;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    if (count == 0)
+    {
+        error = "no frames retained";
+    }
+    else
+    {
+        const clip_entry &newest = entries[(first + count - 1) % CLIP_MAX_ENTRIES];
+        reader->end_seq = newest.seq;
+        reader->next_seq = newest.seq;
+        for (int i = 0; i < count; ++i)
+        {
+            const clip_entry &e = entries[(first + i) % CLIP_MAX_ENTRIES];
+            if (newest.timestamp - e.timestamp <= seconds * 1000000ll)
+            {
+                reader->next_seq = e.seq;
+                break;
+            }
+        }
+
+        error = "too many clip downloads";
+        busy = true;
+        for (int i = 0; i < CLIP_MAX_READERS; ++i)
+        {
+            if (readers[i] == nullptr)
+            {
+                reader->id = ++last_reader_id;
+                readers[i] = reader;
+                error = nullptr;
+                busy = false;
+                break;
+            }
+        }
+    }
+    xSemaphoreGive(mutex);
+
+    if (error != nullptr)
+    {
+        free(reader);
+        return busy ? resp_send_busy(req, error) : httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, error);
+    }
+
+    ESP_LOGI(TAG, "clip req: %d seconds %d frames %lu..%lu", fd, seconds, reader->next_seq, reader->end_seq);
+
+    const char *httpd_hdr_str = "HTTP/1.1 200 ok\r\nContent-Type: multipart/x-mixed-replace;boundary=" PART_BOUNDARY "\r\nTransfer-Encoding: chunked\r\nAccess-Control-Allow-Origin: *\r\n\r\n";
+    auto res = socket_send_all(req->handle, fd, httpd_hdr_str, strlen(httpd_hdr_str));
+    if (res != ESP_OK)
+    {
+        clip_remove_reader(fd);
+        return res;
+    }
+
+    session_hold(fd);
+    res = httpd_queue_work(req->handle, send_next, (void *)(uintptr_t)reader->id);
+    if (res != ESP_OK)
+    {
+        metrics_httpd_queue_failures.fetch_add(1, std::memory_order_relaxed);
+        clip_remove_reader(fd);
+        session_release(fd);
+    }
+    return res;
+}
+
+bool clip_remove_reader(int fd)
+{
+    bool removed = false;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (int i = 0; i < CLIP_MAX_READERS; ++i)
+    {
+        if (readers[i] != nullptr && readers[i]->fd == fd)
+        {
+            free_reader(readers[i]);
+            removed = true;
+        }
+    }
+    xSemaphoreGive(mutex);
+
+    return removed;
+}
+
+esp_err_t clip_init()
+{
+    mutex = xSemaphoreCreateMutex();
+    retry_timer = xTimerCreate("clip timer", pdMS_TO_TICKS(CLIP_RETRY_MS), pdFALSE, nullptr, retry_blocked);
+    if (retry_timer == nullptr)
+    {
+        ESP_LOGE(TAG, "failed to create clip timer");
+        return ESP_FAIL;
+    }
+    arena_size = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM) / CLIP_BUDGET_SHARE;
+    arena_size = std::max<size_t>(CLIP_BUDGET_MIN, std::min<size_t>(CLIP_BUDGET_MAX, arena_size));
+    arena = static_cast<uint8_t *>(heap_caps_malloc(arena_size, MALLOC_CAP_SPIRAM));
+    if (arena == nullptr)
+    {
+        ESP_LOGE(TAG, "failed to allocate %u bytes for clip buffer", arena_size);
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "clip buffer %u KB", arena_size / 1024);
+    if (!capture_add_consumer(on_frame, nullptr))
+    {
+        ESP_LOGE(TAG, "failed to add capture consumer");
+        return ESP_FAIL;
+    }
+
+    // the ring is only useful if it is always being filled
+    capture_acquire();
+    return ESP_OK;
+}
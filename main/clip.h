@@ -0,0 +1,8 @@
+#pragma once
+
+#include "esp_http_server.h"
+
+esp_err_t clip_init();
+esp_err_t clip_handler(httpd_req_t *req);
+bool clip_remove_reader(int fd);
+void clip_print_info(int (*printfn)(const char *format, ...));
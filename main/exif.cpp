@@ -0,0 +1,153 @@
+#include "exif.h"
+
+#include <array>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// Layout of the header, offsets in the TIFF structure are from the start of its byte order mark
+// which follows the SOI, the APP1 marker and length, and "Exif\0\0"
+static constexpr size_t TIFF = 12;
+static constexpr size_t IFD_ENTRY_LEN = 12;
+static constexpr size_t DATE_TIME_LEN = 20;
+
+static constexpr size_t IFD0 = 8;
+static constexpr size_t IFD0_ENTRIES = 3;
+static constexpr size_t NAME = IFD0 + 2 + IFD0_ENTRIES * IFD_ENTRY_LEN + 4;
+static constexpr size_t DATE_TIME = NAME + EXIF_NAME_LEN;
+
+static constexpr size_t EXIF_IFD = DATE_TIME + DATE_TIME_LEN;
+static constexpr size_t EXIF_IFD_ENTRIES = 5;
+static constexpr size_t EXPOSURE = EXIF_IFD + 2 + EXIF_IFD_ENTRIES * IFD_ENTRY_LEN + 4;
+static constexpr size_t DATE_TIME_ORIGINAL = EXPOSURE + 8;
+static constexpr size_t TIFF_LEN = DATE_TIME_ORIGINAL + DATE_TIME_LEN;
+
+// values of four bytes or less are kept in the entry itself
+static constexpr size_t entry_value(size_t ifd, size_t entry)
+{
+    return ifd + 2 + entry * IFD_ENTRY_LEN + 8;
+}
+
+static constexpr size_t ISO = entry_value(EXIF_IFD, 1);
+static constexpr size_t IMAGE_NUMBER = entry_value(EXIF_IFD, 3);
+static constexpr size_t SUB_SEC_TIME = entry_value(EXIF_IFD, 4);
+
+static_assert(TIFF + TIFF_LEN == EXIF_HEADER_LEN, "EXIF_HEADER_LEN does not match the layout");
+
+enum : uint16_t { TYPE_ASCII = 2, TYPE_SHORT = 3, TYPE_LONG = 4, TYPE_RATIONAL = 5 };
+
+using header_bytes = std::array<uint8_t, EXIF_HEADER_LEN>;
+
+static constexpr void put16(header_bytes &h, size_t at, uint16_t v)
+{
+    h[at] = v;
+    h[at + 1] = v >> 8;
+}
+
+static constexpr void put32(header_bytes &h, size_t at, uint32_t v)
+{
+    put16(h, at, v);
+    put16(h, at + 2, v >> 16);
+}
+
+static constexpr void put_entry(header_bytes &h, size_t ifd, size_t entry, uint16_t tag, uint16_t type, uint32_t count, uint32_t value)
+{
+    size_t at = TIFF + ifd + 2 + entry * IFD_ENTRY_LEN;
+    put16(h, at, tag);
+    put16(h, at + 2, type);
+    put32(h, at + 4, count);
+    put32(h, at + 8, value);
+}
+
+static constexpr header_bytes make_template()
+{
+    header_bytes h{};
+    h[0] = 0xff;
+    h[1] = 0xd8;
+    h[2] = 0xff;
+    h[3] = 0xe1;
+    h[4] = (EXIF_HEADER_LEN - 4) >> 8;
+    h[5] = (EXIF_HEADER_LEN - 4) & 0xff;
+    const char exif[] = "Exif\0";
+    for (size_t i = 0; i < 6; ++i)
+    {
+        h[6 + i] = exif[i];
+    }
+    h[TIFF] = 'I';
+    h[TIFF + 1] = 'I';
+    put16(h, TIFF + 2, 42);
+    put32(h, TIFF + 4, IFD0);
+
+    // entries are in tag order
+    put16(h, TIFF + IFD0, IFD0_ENTRIES);
+    put_entry(h, IFD0, 0, 0x010e, TYPE_ASCII, EXIF_NAME_LEN, NAME);               // ImageDescription
+    put_entry(h, IFD0, 1, 0x0132, TYPE_ASCII, DATE_TIME_LEN, DATE_TIME);          // DateTime
+    put_entry(h, IFD0, 2, 0x8769, TYPE_LONG, 1, EXIF_IFD);                        // ExifIFD
+
+    put16(h, TIFF + EXIF_IFD, EXIF_IFD_ENTRIES);
+    put_entry(h, EXIF_IFD, 0, 0x829a, TYPE_RATIONAL, 1, EXPOSURE);                // ExposureTime
+    put_entry(h, EXIF_IFD, 1, 0x8827, TYPE_SHORT, 1, 0);                          // ISOSpeedRatings
+    put_entry(h, EXIF_IFD, 2, 0x9003, TYPE_ASCII, DATE_TIME_LEN, DATE_TIME_ORIGINAL); // DateTimeOriginal
+    put_entry(h, EXIF_IFD, 3, 0x9211, TYPE_LONG, 1, 0);                           // ImageNumber
+    put_entry(h, EXIF_IFD, 4, 0x9291, TYPE_ASCII, 4, 0);                          // SubSecTimeOriginal
+    put32(h, TIFF + EXPOSURE + 4, 1000000);
+    return h;
+}
+
+static constexpr header_bytes exif_template = make_template();
+
+static const uint8_t jfif_id[] = { 'J', 'F', 'I', 'F', 0 };
+
+size_t exif_jfif_len(const uint8_t *buf, size_t len)
+{
+    if (len < 6 + sizeof(jfif_id) || buf[0] != 0xff || buf[1] != 0xd8 || buf[2] != 0xff || buf[3] != 0xe0 ||
+        memcmp(buf + 6, jfif_id, sizeof(jfif_id)) != 0)
+    {
+        return 0;
+    }
+
+    // the segment length counts itself but not the marker
+    size_t end = 4 + ((buf[4] << 8) | buf[5]);
+    return end < len ? end : 0;
+}
+
+void exif_init(exif_header *header)
+{
+    memcpy(header->data, exif_template.data(), EXIF_HEADER_LEN);
+    header->second = -1;
+}
+
+static void set16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void set32(uint8_t *p, uint32_t v)
+{
+    set16(p, v);
+    set16(p + 2, v >> 16);
+}
+
+void exif_update(exif_header *header, const exif_fields *fields)
+{
+    uint8_t *tiff = header->data + TIFF;
+    if (fields->when.tv_sec != header->second)
+    {
+        header->second = fields->when.tv_sec;
+        struct tm t;
+        localtime_r(&fields->when.tv_sec, &t);
+        char *date_time = reinterpret_cast<char *>(tiff + DATE_TIME);
+        snprintf(date_time, DATE_TIME_LEN, "%4d:%02d:%02d %02d:%02d:%02d", 1900 + t.tm_year, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec);
+        memcpy(tiff + DATE_TIME_ORIGINAL, date_time, DATE_TIME_LEN);
+        strncpy(reinterpret_cast<char *>(tiff + NAME), fields->name != nullptr ? fields->name : "", EXIF_NAME_LEN - 1);
+    }
+
+    unsigned int ms = fields->when.tv_usec / 1000;
+    tiff[SUB_SEC_TIME] = '0' + ms / 100;
+    tiff[SUB_SEC_TIME + 1] = '0' + ms / 10 % 10;
+    tiff[SUB_SEC_TIME + 2] = '0' + ms % 10;
+    set32(tiff + EXPOSURE, fields->exposure_us);
+    set16(tiff + ISO, fields->iso);
+    set32(tiff + IMAGE_NUMBER, fields->seq);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+// The sensor produces a plain JFIF header, we swap it for an EXIF one carrying the capture time,
+// frame number and camera settings. This is the SOI marker and the whole APP1 segment.
+#define EXIF_HEADER_LEN 208
+#define EXIF_NAME_LEN 32
+
+// What goes into the header for one frame
+struct exif_fields
+{
+    struct timeval when;    // capture time on the wall clock
+    uint32_t seq;
+    uint32_t exposure_us;   // 0 if not known
+    uint16_t iso;           // 0 if not known
+    const char *name;
+};
+
+// A ready to send header. It starts as a copy of a template built at compile time and after that
+// only the fields are patched in place, the date strings and name just once a second.
+struct exif_header
+{
+    uint8_t data[EXIF_HEADER_LEN];
+    time_t second;
+};
+
+// Length of the SOI and JFIF APP0 segment to be replaced, 0 if the image does not start with them
+extern size_t exif_jfif_len(const uint8_t *buf, size_t len);
+extern void exif_init(exif_header *header);
+extern void exif_update(exif_header *header, const exif_fields *fields);
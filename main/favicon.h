@@ -1,5 +0,0 @@
-#pragma once
-
-#include "esp_http_server.h"
-
-extern void favicon_add_endpoint(httpd_handle_t server);
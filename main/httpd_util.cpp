@@ -42,5 +42,118 @@ esp_err_t socket_send_chunk(httpd_handle_t hd, int fd, const char *buf, ssize_t
     return ESP_OK;
 }
 
+// skip what was sent, a partial write can stop in the middle of a buffer
+static void advance_iov(struct iovec **iov, int *iovcnt, size_t len)
+{
+    while (*iovcnt > 0 && len >= (*iov)->iov_len)
+    {
+        len -= (*iov)->iov_len;
+        ++*iov;
+        --*iovcnt;
+    }
+    if (*iovcnt > 0)
+    {
+        (*iov)->iov_base = static_cast<char *>((*iov)->iov_base) + len;
+        (*iov)->iov_len -= len;
+    }
+}
+
+// Sends a list of buffers with as few lwip calls as possible, usually one. lwip has no TCP_CORK but
+// handing it everything in a single sendmsg lets tcp_write pack consecutive buffers into full MSS
+// segments before anything is output, which is what corking would buy.
+// Note this bypasses any send override installed on the httpd session.
+esp_err_t socket_sendv_all(int fd, struct iovec *iov, int iovcnt)
+{
+    while (iovcnt > 0)
+    {
+        struct msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        int len = sendmsg(fd, &msg, 0);
+
+        if (len < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return ESP_ERR_HTTPD_RESP_SEND;
+        }
+
+        advance_iov(&iov, &iovcnt, len);
+    }
+
+    return ESP_OK;
+}
+
+// Non-blocking version, sends whatever the socket will take now and moves iov/iovcnt past it.
+// Returns the number of bytes sent, 0 if the socket is full or -1 on error.
+int socket_sendv_some(int fd, struct iovec **iov, int *iovcnt)
+{
+    struct msghdr msg{};
+    msg.msg_iov = *iov;
+    msg.msg_iovlen = *iovcnt;
+    int len = sendmsg(fd, &msg, MSG_DONTWAIT);
+
+    if (len < 0)
+    {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    }
+
+    advance_iov(iov, iovcnt, len);
+    return len;
+}
+
+static int send_flags(int fd, const char *buf, size_t buf_len, int flags)
+{
+    int len = send(fd, buf, buf_len, flags);
+    if (len < 0)
+    {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? HTTPD_SOCK_ERR_TIMEOUT : HTTPD_SOCK_ERR_FAIL;
+    }
+    return len;
+}
 
+// As httpd's own send function
+static int send_plain(httpd_handle_t, int fd, const char *buf, size_t buf_len, int flags)
+{
+    return buf == nullptr ? HTTPD_SOCK_ERR_INVALID : send_flags(fd, buf, buf_len, flags);
+}
 
+static int send_more(httpd_handle_t, int fd, const char *buf, size_t buf_len, int flags)
+{
+    return buf == nullptr ? HTTPD_SOCK_ERR_INVALID : send_flags(fd, buf, buf_len, flags | MSG_MORE);
+}
+
+// httpd writes the headers with a send of their own, so for the length of the call the session's
+// send goes with MSG_MORE. lwip then leaves PSH off the segment and a stack that can cork holds it
+// for the body, rather than the headers going out as a small packet of their own.
+esp_err_t resp_send_headers(httpd_req_t *req, size_t content_len)
+{
+    int fd = httpd_req_to_sockfd(req);
+    httpd_sess_set_send_override(req->handle, fd, send_more);
+    // A bit of a hack having seen the source of http_resp_send. With a non-zero length but a null
+    // buffer all the headers are sent including Content-Length but none of the body.
+    esp_err_t res = httpd_resp_send(req, nullptr, content_len);
+    httpd_sess_set_send_override(req->handle, fd, send_plain);
+    return res;
+}
+
+esp_err_t resp_send_busy(httpd_req_t *req, const char *message)
+{
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_type(req, "text/plain");
+    httpd_resp_set_hdr(req, "Retry-After", "5");
+    return httpd_resp_send(req, message, HTTPD_RESP_USE_STRLEN);
+}
+
+esp_err_t resp_send_not_modified(httpd_req_t *req, const char *etag, const char *headers)
+{
+    char buf[256];
+    int len = snprintf(buf, sizeof(buf), "HTTP/1.1 304 Not Modified\r\nETag: %s\r\n%s\r\n", etag, headers);
+    if (len >= (int)sizeof(buf))
+    {
+        return ESP_ERR_HTTPD_RESP_HDR;
+    }
+    return socket_send_all(req->handle, httpd_req_to_sockfd(req), buf, len);
+}
@@ -1,7 +1,20 @@
 #pragma once
 
 #include "esp_http_server.h"
+#include "lwip/sockets.h"
 
 esp_err_t socket_send_all(httpd_handle_t hd, int fd, const char *buf, ssize_t buf_len);
 esp_err_t socket_send_chunk(httpd_handle_t hd, int fd, const char *buf, ssize_t buf_len);
+esp_err_t socket_sendv_all(int fd, struct iovec *iov, int iovcnt);
+int socket_sendv_some(int fd, struct iovec **iov, int *iovcnt);
+
+// httpd_resp_send of just the headers, for a body of content_len the caller sends itself straight after
+esp_err_t resp_send_headers(httpd_req_t *req, size_t content_len);
+
+// A 304 with the etag and any other headers given (each ending in \r\n). Sent by hand as
+// httpd_resp_send always adds a Content-Type, which a 304 should not have.
+esp_err_t resp_send_not_modified(httpd_req_t *req, const char *etag, const char *headers);
+
+// A 503 with Retry-After, for a request turned away because too many of its kind are running
+esp_err_t resp_send_busy(httpd_req_t *req, const char *message);
 
@@ -1,3 +0,0 @@
-#pragma once
-extern const char *index_page_body;
-extern const char *get_index_page_head();
\ No newline at end of file
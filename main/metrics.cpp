@@ -0,0 +1,181 @@
+#include <esp_log.h>
+#include <stdarg.h>
+#include "metrics.h"
+#include "stream.h"
+
+#include "esp_heap_caps.h"
+
+#define TAG "metrics"
+
+static const uint32_t interval_bounds[] = { 20000, 40000, 60000, 80000, 100000, 150000, 200000, 300000, 500000, 1000000 };
+static std::atomic<uint32_t> interval_counts[sizeof(interval_bounds) / sizeof(interval_bounds[0]) + 1];
+
+static const uint32_t latency_bounds[] = { 1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000, 2000000 };
+static std::atomic<uint32_t> latency_counts[sizeof(latency_bounds) / sizeof(latency_bounds[0]) + 1];
+
+std::atomic<uint32_t> metrics_frames_captured;
+metrics_histogram metrics_capture_interval{ interval_bounds, sizeof(interval_bounds) / sizeof(interval_bounds[0]), interval_counts, {} };
+std::atomic<uint32_t> metrics_frames_sent;
+std::atomic<uint32_t> metrics_frames_dropped;
+metrics_total metrics_bytes_sent;
+metrics_histogram metrics_send_latency{ latency_bounds, sizeof(latency_bounds) / sizeof(latency_bounds[0]), latency_counts, {} };
+std::atomic<uint32_t> metrics_sse_queue_failures;
+std::atomic<uint32_t> metrics_httpd_queue_failures;
+
+// The count is odd while the writer is part way through
+void metrics_add(metrics_total *total, uint32_t value)
+{
+    total->seq.fetch_add(1);
+    uint32_t lo = total->lo.load(std::memory_order_relaxed);
+    if (lo + value < lo)
+    {
+        total->hi.fetch_add(1, std::memory_order_relaxed);
+    }
+    total->lo.store(lo + value, std::memory_order_relaxed);
+    total->seq.fetch_add(1);
+}
+
+static uint64_t read_total(const metrics_total *total)
+{
+    for (;;)
+    {
+        uint32_t seq = total->seq.load();
+        uint64_t value = (uint64_t)total->hi.load() << 32 | total->lo.load();
+        if ((seq & 1) == 0 && total->seq.load() == seq)
+        {
+            return value;
+        }
+    }
+}
+
+void metrics_observe(metrics_histogram *histogram, uint32_t us)
+{
+    size_t i = 0;
+    while (i < histogram->n_bounds && us > histogram->bounds[i])
+    {
+        ++i;
+    }
+    histogram->counts[i].fetch_add(1, std::memory_order_relaxed);
+    metrics_add(&histogram->sum, us);
+}
+
+// Text is built up a chunk at a time so a scrape needs no big buffer
+struct metrics_writer
+{
+    httpd_req_t *req;
+    esp_err_t res;
+    size_t len;
+    char buf[1024];
+};
+
+static void flush(metrics_writer *w)
+{
+    if (w->res == ESP_OK && w->len > 0)
+    {
+        w->res = httpd_resp_send_chunk(w->req, w->buf, w->len);
+    }
+    w->len = 0;
+}
+
+static void out(metrics_writer *w, const char *format, ...)
+{
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(w->buf + w->len, sizeof(w->buf) - w->len, format, args);
+        va_end(args);
+        if (n >= 0 && w->len + n < sizeof(w->buf))
+        {
+            w->len += n;
+            return;
+        }
+        flush(w);
+    }
+}
+
+static void out_counter(metrics_writer *w, const char *name, const char *help, uint64_t value)
+{
+    out(w, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name, value);
+}
+
+static void out_gauge(metrics_writer *w, const char *name, const char *help, uint64_t value)
+{
+    out(w, "# HELP %s %s\n# TYPE %s gauge\n%s %llu\n", name, help, name, name, value);
+}
+
+static void out_histogram(metrics_writer *w, const char *name, const char *help, const metrics_histogram *h)
+{
+    out(w, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < h->n_bounds; ++i)
+    {
+        cumulative += h->counts[i].load(std::memory_order_relaxed);
+        out(w, "%s_bucket{le=\"%lu.%06lu\"} %llu\n", name, h->bounds[i] / 1000000, h->bounds[i] % 1000000, cumulative);
+    }
+    cumulative += h->counts[h->n_bounds].load(std::memory_order_relaxed);
+    uint64_t sum = read_total(&h->sum);
+    out(w, "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %llu.%06llu\n%s_count %llu\n", name, cumulative, name, sum / 1000000, sum % 1000000, name, cumulative);
+}
+
+static void out_clients(metrics_writer *w)
+{
+    stream_client_stats clients[CONFIG_LWIP_MAX_SOCKETS];
+    int n = stream_get_client_stats(clients, CONFIG_LWIP_MAX_SOCKETS);
+
+    static const char *const names[][2] =
+    {
+        { "camera_client_frames_delivered_total", "Frames sent in full to each stream client" },
+        { "camera_client_frames_dropped_total", "Frames each stream client missed because it was still busy with an earlier one" },
+        { "camera_client_frames_paced_total", "Frames passed over to keep each stream client to its rate or credit" },
+        { "camera_client_bytes_sent_total", "Bytes sent to each stream client" },
+    };
+    for (int m = 0; m < 4; ++m)
+    {
+        out(w, "# HELP %s %s\n# TYPE %s counter\n", names[m][0], names[m][1], names[m][0]);
+        for (int i = 0; i < n; ++i)
+        {
+            const stream_client_stats &c = clients[i];
+            uint64_t value = m == 0 ? c.sent : m == 1 ? c.dropped : m == 2 ? c.paced : c.bytes;
+            out(w, "%s{fd=\"%d\",scale=\"%d\",transport=\"%s\"} %llu\n", names[m][0], c.fd, 1 << c.scale, c.ws ? "ws" : "http", value);
+        }
+    }
+}
+
+// Everything is read without stopping anything, apart from a copy of the per client numbers
+// made under the stream lock
+esp_err_t metrics_handler(httpd_req_t *req)
+{
+    auto *w = static_cast<metrics_writer *>(malloc(sizeof(metrics_writer)));
+    if (w == nullptr)
+    {
+        return httpd_resp_send_500(req);
+    }
+    w->req = req;
+    w->res = httpd_resp_set_type(req, "text/plain; version=0.0.4");
+    w->len = 0;
+
+    out_counter(w, "camera_frames_captured_total", "Frames taken from the sensor", metrics_frames_captured.load());
+    out_histogram(w, "camera_capture_interval_seconds", "Time between sensor frames by their timestamps", &metrics_capture_interval);
+    out_counter(w, "camera_stream_frames_sent_total", "Frames sent in full to stream clients", metrics_frames_sent.load());
+    out_counter(w, "camera_stream_frames_dropped_total", "Frames stream clients missed because they were still busy", metrics_frames_dropped.load());
+    out_counter(w, "camera_stream_bytes_sent_total", "Bytes sent to stream clients", read_total(&metrics_bytes_sent));
+    out_histogram(w, "camera_stream_send_seconds", "Time from starting to send a frame to a client to the last byte going", &metrics_send_latency);
+    out_clients(w);
+    out_counter(w, "camera_sse_queue_failures_total", "Server sent events that could not be queued", metrics_sse_queue_failures.load());
+    out_counter(w, "camera_httpd_queue_failures_total", "Work that could not be queued on the http server", metrics_httpd_queue_failures.load());
+
+    out_gauge(w, "camera_heap_free_bytes", "Free internal heap", heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+    out_gauge(w, "camera_heap_min_free_bytes", "Lowest free internal heap since boot", heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL));
+    out_gauge(w, "camera_psram_free_bytes", "Free PSRAM", heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+    out_gauge(w, "camera_psram_min_free_bytes", "Lowest free PSRAM since boot", heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM));
+
+    flush(w);
+    esp_err_t res = w->res == ESP_OK ? httpd_resp_send_chunk(req, nullptr, 0) : w->res;
+    free(w);
+    if (res != ESP_OK)
+    {
+        ESP_LOGI(TAG, "metrics send failed %d", res);
+    }
+    return res;
+}
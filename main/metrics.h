@@ -0,0 +1,39 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_http_server.h"
+
+// Counters and histograms updated on the hot paths without taking a lock. Plain counters are 32 bit
+// atomics, which are lock free on both chips. Totals that need 64 bits have a single writer and
+// are read consistently through a sequence count.
+struct metrics_total
+{
+    std::atomic<uint32_t> seq;
+    std::atomic<uint32_t> lo;
+    std::atomic<uint32_t> hi;
+};
+
+// Each histogram is observed from one task only
+struct metrics_histogram
+{
+    const uint32_t *bounds;         // upper bounds in microseconds, ascending
+    size_t n_bounds;
+    std::atomic<uint32_t> *counts;  // n_bounds + 1, the last for anything bigger
+    metrics_total sum;
+};
+
+extern std::atomic<uint32_t> metrics_frames_captured;
+extern metrics_histogram metrics_capture_interval;
+extern std::atomic<uint32_t> metrics_frames_sent;
+extern std::atomic<uint32_t> metrics_frames_dropped;
+extern metrics_total metrics_bytes_sent;
+extern metrics_histogram metrics_send_latency;
+extern std::atomic<uint32_t> metrics_sse_queue_failures;
+extern std::atomic<uint32_t> metrics_httpd_queue_failures;
+
+extern void metrics_add(metrics_total *total, uint32_t value);
+extern void metrics_observe(metrics_histogram *histogram, uint32_t us);
+
+extern esp_err_t metrics_handler(httpd_req_t *req);
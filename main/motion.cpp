@@ -0,0 +1,729 @@
+#include <algorithm>
+#include <esp_log.h>
+#include <string.h>
+#include "capture.h"
+#include "motion.h"
+#include "sse.h"
+
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#define TAG "motion"
+
+// Motion is found from the DC coefficient of each 8x8 luma block, which is the block's average
+// brightness and can be had from the entropy coded data alone: the AC terms are skipped over
+// without being dequantized and there is no IDCT or colour conversion. That gives a 1/8 scale
+// luma map which is compared against a slowly moving background.
+#define MOTION_INTERVAL_MS 200      // look at no more than five frames a second
+#define MOTION_THRESHOLD 24         // luma difference for a block to count as changed
+#define MOTION_BACKGROUND_SHIFT 4   // the background moves 1/16 of the way to each new frame
+#define MOTION_WARMUP_FRAMES 8
+#define MOTION_MIN_BLOCKS 6         // smaller changed regions are noise
+#define MOTION_GLOBAL_PERCENT 40    // more than this changed at once is exposure or lighting
+#define MOTION_MAX_BOXES 4
+#define MOTION_REPEAT_MS 1000       // how often to repeat the event while there is motion
+#define MOTION_HOLD_MS 2000         // and how long it has to be still before reporting the end
+
+struct huffman_table
+{
+    uint8_t fast_len[256]; // codes of up to 8 bits are looked up directly, 0 for longer ones
+    uint8_t fast_val[256];
+    int32_t maxcode[17];
+    int32_t valptr[17];
+    int32_t mincode[17];
+    uint8_t vals[256];
+};
+
+struct jpeg_component
+{
+    int id;
+    int h;
+    int v;
+    int quant;
+    int dc;
+    int ac;
+};
+
+struct jpeg_info
+{
+    int width;
+    int height;
+    int ncomp;
+    jpeg_component comp[3];
+    int hmax;
+    int vmax;
+    int dc_quant; // luma DC quantizer
+    int restart_interval;
+    const uint8_t *scan; // start of the entropy coded data
+};
+
+// Bits are kept at the top of acc. Stuffed zero bytes are dropped and a marker is never read
+// past, zeros are fed in instead until restart() moves over it.
+struct bit_reader
+{
+    const uint8_t *p;
+    const uint8_t *end;
+    uint32_t acc;
+    int bits;
+};
+
+struct motion_box
+{
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+    int blocks;
+};
+
+// baseline only has tables 0 and 1 of each class, indexed [class][id]
+static huffman_table tables[2][2];
+
+static SemaphoreHandle_t mutex = nullptr;
+static TaskHandle_t task = nullptr;
+static capture_frame *pending;
+static int64_t last_look;
+
+static uint8_t *copy;
+static size_t copy_size;
+
+static int map_w, map_h;
+static uint8_t *luma;
+static uint16_t *background; // 8.8 fixed point
+static uint8_t *changed;
+static uint32_t *stack;
+static unsigned int warmup;
+
+static bool active;
+static int64_t last_event;
+static int64_t last_motion;
+
+static unsigned int n_frames;
+static unsigned int n_skipped;
+static unsigned int n_errors;
+static unsigned int n_events;
+static unsigned int last_width, last_height;
+static int64_t total_copy_us, total_decode_us, total_analyse_us;
+static unsigned int max_us;
+
+static bool build_table(huffman_table *t, const uint8_t *counts, const uint8_t *vals)
+{
+    memset(t->fast_len, 0, sizeof(t->fast_len));
+    int code = 0, k = 0;
+    for (int l = 1; l <= 16; ++l)
+    {
+        t->valptr[l] = k;
+        t->mincode[l] = code;
+        for (int i = 0; i < counts[l - 1]; ++i, ++k, ++code)
+        {
+            if (code >= (1 << l))
+            {
+                return false;
+            }
+            t->vals[k] = vals[k];
+            if (l <= 8)
+            {
+                int shift = 8 - l;
+                for (int j = 0; j < (1 << shift); ++j)
+                {
+                    t->fast_len[(code << shift) | j] = l;
+                    t->fast_val[(code << shift) | j] = vals[k];
+                }
+            }
+        }
+        t->maxcode[l] = counts[l - 1] != 0 ? code - 1 : -1;
+        code <<= 1;
+    }
+    return true;
+}
+
+static bool parse_headers(const uint8_t *buf, size_t len, jpeg_info *info)
+{
+    if (len < 4 || buf[0] != 0xff || buf[1] != 0xd8)
+    {
+        return false;
+    }
+
+    int quant[4] = {};
+    const uint8_t *end = buf + len;
+    const uint8_t *p = buf + 2;
+    while (p + 4 <= end)
+    {
+        if (p[0] != 0xff)
+        {
+            return false;
+        }
+        if (p[1] == 0xff)
+        {
+            ++p; // fill byte
+            continue;
+        }
+
+        uint8_t marker = p[1];
+        const uint8_t *seg = p + 4;
+        const uint8_t *next = p + 2 + ((p[2] << 8) | p[3]);
+        if (next > end)
+        {
+            return false;
+        }
+
+        switch (marker)
+        {
+        case 0xdb: // DQT
+            for (const uint8_t *q = seg; q + 2 < next; )
+            {
+                bool wide = (q[0] >> 4) != 0;
+                quant[q[0] & 3] = wide ? (q[1] << 8) | q[2] : q[1];
+                q += wide ? 129 : 65;
+            }
+            break;
+        case 0xc0: // SOF0 and SOF1, sequential huffman. Anything else leaves ncomp at 0 and fails at SOS.
+        case 0xc1:
+            info->height = (seg[1] << 8) | seg[2];
+            info->width = (seg[3] << 8) | seg[4];
+            info->ncomp = seg[5];
+            if (info->ncomp != 1 && info->ncomp != 3)
+            {
+                return false;
+            }
+            for (int i = 0; i < info->ncomp; ++i)
+            {
+                const uint8_t *c = seg + 6 + i * 3;
+                info->comp[i].id = c[0];
+                info->comp[i].h = c[1] >> 4;
+                info->comp[i].v = c[1] & 15;
+                info->comp[i].quant = c[2] & 3;
+            }
+            break;
+        case 0xc4: // DHT
+            for (const uint8_t *q = seg; q + 17 <= next; )
+            {
+                int cls = q[0] >> 4, id = q[0] & 15;
+                int count = 0;
+                for (int i = 1; i <= 16; ++i)
+                {
+                    count += q[i];
+                }
+                if (cls > 1 || id > 1 || count > 256 || q + 17 + count > next || !build_table(&tables[cls][id], q + 1, q + 17))
+                {
+                    return false;
+                }
+                q += 17 + count;
+            }
+            break;
+        case 0xdd: // DRI
+            info->restart_interval = (seg[0] << 8) | seg[1];
+            break;
+        case 0xda: // SOS
+        {
+            if (info->ncomp == 0 || seg[0] != info->ncomp)
+            {
+                return false;
+            }
+            for (int i = 0; i < info->ncomp; ++i)
+            {
+                int id = seg[1 + i * 2], dc = seg[2 + i * 2] >> 4, ac = seg[2 + i * 2] & 15;
+                auto *c = std::find_if(info->comp, info->comp + info->ncomp, [id](const jpeg_component &c) { return c.id == id; });
+                if (c == info->comp + info->ncomp || dc > 1 || ac > 1)
+                {
+                    return false;
+                }
+                c->dc = dc;
+                c->ac = ac;
+            }
+
+            if (info->ncomp == 1)
+            {
+                // a single component scan is not interleaved, every block is an MCU
+                info->comp[0].h = info->comp[0].v = 1;
+            }
+            else if (info->comp[1].h != 1 || info->comp[1].v != 1 || info->comp[2].h != 1 || info->comp[2].v != 1)
+            {
+                return false;
+            }
+            info->hmax = info->comp[0].h;
+            info->vmax = info->comp[0].v;
+            if (info->hmax < 1 || info->hmax > 2 || info->vmax < 1 || info->vmax > 2)
+            {
+                return false;
+            }
+            info->dc_quant = quant[info->comp[0].quant];
+            info->scan = next;
+            return info->dc_quant != 0;
+        }
+        default:
+            break;
+        }
+        p = next;
+    }
+    return false;
+}
+
+static inline void fill(bit_reader *br)
+{
+    while (br->bits <= 24)
+    {
+        uint32_t byte = 0;
+        const uint8_t *p = br->p;
+        if (p < br->end && (p[0] != 0xff || (p + 1 < br->end && p[1] == 0)))
+        {
+            byte = p[0];
+            br->p += byte == 0xff ? 2 : 1;
+        }
+        br->acc |= byte << (24 - br->bits);
+        br->bits += 8;
+    }
+}
+
+static inline void skip_bits(bit_reader *br, int n)
+{
+    br->acc <<= n;
+    br->bits -= n;
+}
+
+static inline int get_bits(bit_reader *br, int n)
+{
+    fill(br);
+    int v = br->acc >> (32 - n);
+    skip_bits(br, n);
+    return v;
+}
+
+static inline int decode(bit_reader *br, const huffman_table *t)
+{
+    fill(br);
+    unsigned int look = br->acc >> 24;
+    int len = t->fast_len[look];
+    if (len != 0)
+    {
+        skip_bits(br, len);
+        return t->fast_val[look];
+    }
+
+    for (int l = 9; l <= 16; ++l)
+    {
+        int code = br->acc >> (32 - l);
+        if (code <= t->maxcode[l])
+        {
+            skip_bits(br, l);
+            return t->vals[t->valptr[l] + code - t->mincode[l]];
+        }
+    }
+    return -1;
+}
+
+static void restart(bit_reader *br)
+{
+    // whatever is left in the accumulator is padding, the RSTn marker comes next
+    br->acc = 0;
+    br->bits = 0;
+    while (br->p + 1 < br->end && !(br->p[0] == 0xff && br->p[1] >= 0xd0 && br->p[1] <= 0xd7))
+    {
+        ++br->p;
+    }
+    br->p = std::min(br->p + 2, br->end);
+}
+
+// Walks one block, keeping the DC prediction up to date. AC values are skipped, only their
+// huffman codes have to be decoded to know how many bits to step over.
+static bool decode_block(bit_reader *br, const huffman_table *dc, const huffman_table *ac, int *pred)
+{
+    int s = decode(br, dc);
+    if (s < 0 || s > 11)
+    {
+        return false;
+    }
+    if (s != 0)
+    {
+        int v = get_bits(br, s);
+        *pred += v < (1 << (s - 1)) ? v - (1 << s) + 1 : v;
+    }
+
+    for (int k = 1; k < 64; )
+    {
+        int rs = decode(br, ac);
+        if (rs < 0)
+        {
+            return false;
+        }
+        int run = rs >> 4, size = rs & 15;
+        if (size == 0)
+        {
+            if (run != 15)
+            {
+                break; // end of block
+            }
+            k += 16;
+        }
+        else
+        {
+            fill(br);
+            skip_bits(br, size);
+            k += run + 1;
+        }
+    }
+    return true;
+}
+
+static bool ensure_map(int w, int h)
+{
+    if (w == map_w && h == map_h)
+    {
+        return true;
+    }
+
+    heap_caps_free(luma);
+    heap_caps_free(background);
+    heap_caps_free(changed);
+    heap_caps_free(stack);
+    size_t n = w * h;
+    luma = static_cast<uint8_t *>(heap_caps_malloc(n, MALLOC_CAP_SPIRAM));
+    background = static_cast<uint16_t *>(heap_caps_malloc(n * sizeof(uint16_t), MALLOC_CAP_SPIRAM));
+    changed = static_cast<uint8_t *>(heap_caps_malloc(n, MALLOC_CAP_SPIRAM));
+    stack = static_cast<uint32_t *>(heap_caps_malloc(n * sizeof(uint32_t), MALLOC_CAP_SPIRAM));
+    if (luma == nullptr || background == nullptr || changed == nullptr || stack == nullptr)
+    {
+        ESP_LOGE(TAG, "no memory for %dx%d map", w, h);
+        map_w = map_h = 0;
+        return false;
+    }
+
+    map_w = w;
+    map_h = h;
+    warmup = 0;
+    return true;
+}
+
+// Fills in the luma map, one byte per 8x8 block
+static bool decode_luma(const uint8_t *buf, size_t len, jpeg_info *info)
+{
+    if (!parse_headers(buf, len, info))
+    {
+        return false;
+    }
+
+    int mcus_x = (info->width + info->hmax * 8 - 1) / (info->hmax * 8);
+    int mcus_y = (info->height + info->vmax * 8 - 1) / (info->vmax * 8);
+    if (!ensure_map(mcus_x * info->hmax, mcus_y * info->vmax))
+    {
+        return false;
+    }
+
+    bit_reader br{ info->scan, buf + len, 0, 0 };
+    int pred[3] = {};
+    int mcu = 0;
+    for (int my = 0; my < mcus_y; ++my)
+    {
+        for (int mx = 0; mx < mcus_x; ++mx, ++mcu)
+        {
+            if (info->restart_interval != 0 && mcu != 0 && mcu % info->restart_interval == 0)
+            {
+                restart(&br);
+                pred[0] = pred[1] = pred[2] = 0;
+            }
+
+            for (int c = 0; c < info->ncomp; ++c)
+            {
+                const jpeg_component &comp = info->comp[c];
+                for (int by = 0; by < comp.v; ++by)
+                {
+                    for (int bx = 0; bx < comp.h; ++bx)
+                    {
+                        if (!decode_block(&br, &tables[0][comp.dc], &tables[1][comp.ac], &pred[c]))
+                        {
+                            return false;
+                        }
+                        if (c == 0)
+                        {
+                            // DC is eight times the mean of the level shifted samples
+                            int y = 128 + pred[0] * info->dc_quant / 8;
+                            luma[(my * comp.v + by) * map_w + mx * comp.h + bx] = std::clamp(y, 0, 255);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Grows an 8 connected region of changed blocks from start, clearing them as it goes
+static motion_box flood(int start)
+{
+    motion_box box{ map_w, map_h, -1, -1, 0 };
+    int top = 0;
+    stack[top++] = start;
+    changed[start] = 0;
+    while (top > 0)
+    {
+        int i = stack[--top];
+        int x = i % map_w, y = i / map_w;
+        box.x0 = std::min(box.x0, x);
+        box.y0 = std::min(box.y0, y);
+        box.x1 = std::max(box.x1, x);
+        box.y1 = std::max(box.y1, y);
+        ++box.blocks;
+        for (int ny = std::max(y - 1, 0); ny <= std::min(y + 1, map_h - 1); ++ny)
+        {
+            for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, map_w - 1); ++nx)
+            {
+                int n = ny * map_w + nx;
+                if (changed[n])
+                {
+                    changed[n] = 0;
+                    stack[top++] = n;
+                }
+            }
+        }
+    }
+    return box;
+}
+
+// Compares the map with the background and returns the biggest changed regions
+static int analyse(motion_box *boxes)
+{
+    int total = map_w * map_h;
+    if (warmup < MOTION_WARMUP_FRAMES)
+    {
+        for (int i = 0; i < total; ++i)
+        {
+            background[i] = warmup == 0 ? luma[i] << 8 : background[i] + (((luma[i] << 8) - background[i]) >> 1);
+        }
+        ++warmup;
+        return 0;
+    }
+
+    int count = 0;
+    for (int i = 0; i < total; ++i)
+    {
+        int bg = background[i];
+        int y = luma[i] << 8;
+        changed[i] = std::abs(y - bg) > (MOTION_THRESHOLD << 8);
+        count += changed[i];
+        background[i] = bg + ((y - bg) >> MOTION_BACKGROUND_SHIFT);
+    }
+
+    if (count * 100 > total * MOTION_GLOBAL_PERCENT)
+    {
+        ESP_LOGD(TAG, "%d of %d blocks changed, taking as new background", count, total);
+        for (int i = 0; i < total; ++i)
+        {
+            background[i] = luma[i] << 8;
+        }
+        return 0;
+    }
+
+    int n_boxes = 0;
+    for (int i = 0; i < total && count > 0; ++i)
+    {
+        if (!changed[i])
+        {
+            continue;
+        }
+        motion_box box = flood(i);
+        count -= box.blocks;
+        if (box.blocks < MOTION_MIN_BLOCKS)
+        {
+            continue;
+        }
+
+        // keep the largest few, in order
+        int pos = n_boxes;
+        while (pos > 0 && boxes[pos - 1].blocks < box.blocks)
+        {
+            if (pos < MOTION_MAX_BOXES)
+            {
+                boxes[pos] = boxes[pos - 1];
+            }
+            --pos;
+        }
+        if (pos < MOTION_MAX_BOXES)
+        {
+            boxes[pos] = box;
+            n_boxes = std::min(n_boxes + 1, MOTION_MAX_BOXES);
+        }
+    }
+    return n_boxes;
+}
+
+static void report(uint32_t seq, const jpeg_info *info, const motion_box *boxes, int n_boxes, unsigned int us)
+{
+    char buf[128 + MOTION_MAX_BOXES * 64];
+    int len = snprintf(buf, sizeof(buf), "{ \"seq\": %lu, \"active\": %s, \"width\": %d, \"height\": %d, \"us\": %u, \"boxes\": [",
+                       static_cast<unsigned long>(seq), n_boxes > 0 ? "true" : "false", info->width, info->height, us);
+    for (int i = 0; i < n_boxes; ++i)
+    {
+        const motion_box &b = boxes[i];
+        int x = b.x0 * 8, y = b.y0 * 8;
+        int w = std::min((b.x1 + 1) * 8, info->width) - x;
+        int h = std::min((b.y1 + 1) * 8, info->height) - y;
+        len += snprintf(buf + len, sizeof(buf) - len, "%s{ \"x\": %d, \"y\": %d, \"w\": %d, \"h\": %d, \"blocks\": %d }",
+                        i == 0 ? "" : ", ", x, y, w, h, b.blocks);
+    }
+    len += snprintf(buf + len, sizeof(buf) - len, "] }");
+    sse_broadcast("motion", buf, len);
+    ++n_events;
+}
+
+static void look(uint32_t seq, int64_t now, const uint8_t *buf, size_t len, unsigned int copy_us)
+{
+    jpeg_info info{};
+    motion_box boxes[MOTION_MAX_BOXES];
+
+    int64_t start = esp_timer_get_time();
+    if (!decode_luma(buf, len, &info))
+    {
+        ++n_errors;
+        ESP_LOGD(TAG, "could not decode frame %lu", static_cast<unsigned long>(seq));
+        return;
+    }
+    int64_t decoded = esp_timer_get_time();
+    int n_boxes = analyse(boxes);
+    int64_t end = esp_timer_get_time();
+
+    unsigned int us = copy_us + end - start;
+    ++n_frames;
+    last_width = info.width;
+    last_height = info.height;
+    total_copy_us += copy_us;
+    total_decode_us += decoded - start;
+    total_analyse_us += end - decoded;
+    max_us = std::max(max_us, us);
+    ESP_LOGD(TAG, "%dx%d frame of %u bytes: copy %u us decode %lld us analyse %lld us, %d regions",
+             info.width, info.height, len, copy_us, decoded - start, end - decoded, n_boxes);
+
+    if (n_boxes > 0)
+    {
+        last_motion = now;
+        if (!active || now - last_event >= MOTION_REPEAT_MS * 1000ll)
+        {
+            active = true;
+            last_event = now;
+            report(seq, &info, boxes, n_boxes, us);
+        }
+    }
+    else if (active && now - last_motion >= MOTION_HOLD_MS * 1000ll)
+    {
+        active = false;
+        last_event = now;
+        report(seq, &info, boxes, 0, us);
+    }
+}
+
+void motion_look(uint32_t seq, int64_t timestamp, const uint8_t *buf, size_t len)
+{
+    look(seq, timestamp, buf, len, 0);
+}
+
+// Runs on the capture task. Frames are taken no more often than the interval and only when the
+// detector is idle, so it never holds back the capture or anyone else.
+static void on_frame(capture_frame *frame, void *)
+{
+    if (frame->timestamp - last_look < MOTION_INTERVAL_MS * 1000ll)
+    {
+        return;
+    }
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    bool idle = pending == nullptr;
+    if (idle)
+    {
+        capture_frame_ref(frame);
+        pending = frame;
+        last_look = frame->timestamp;
+    }
+    else
+    {
+        ++n_skipped;
+    }
+    xSemaphoreGive(mutex);
+
+    if (idle)
+    {
+        xTaskNotifyGive(task);
+    }
+}
+
+static void motion_task(void *)
+{
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        capture_frame *frame = pending;
+        xSemaphoreGive(mutex);
+        if (frame == nullptr)
+        {
+            continue;
+        }
+
+        // Copied out so the camera buffer goes straight back to the driver rather than being
+        // held for the whole decode.
+        int64_t start = esp_timer_get_time();
+        size_t len = frame->len;
+        if (len > copy_size)
+        {
+            heap_caps_free(copy);
+            copy = static_cast<uint8_t *>(heap_caps_malloc(len, MALLOC_CAP_SPIRAM));
+            copy_size = copy != nullptr ? len : 0;
+        }
+        if (copy != nullptr)
+        {
+            memcpy(copy, frame->buf, len);
+        }
+        unsigned int copy_us = esp_timer_get_time() - start;
+        uint32_t seq = frame->seq;
+        int64_t timestamp = frame->timestamp;
+
+        capture_frame_unref(frame);
+        if (copy != nullptr)
+        {
+            look(seq, timestamp, copy, len, copy_us);
+        }
+        else
+        {
+            ++n_errors;
+        }
+
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        pending = nullptr;
+        xSemaphoreGive(mutex);
+    }
+}
+
+void motion_print_info(int (*printfn)(const char *format, ...))
+{
+    if (task == nullptr)
+    {
+        return;
+    }
+
+    printfn("Motion: %s frames %u skipped %u errors %u events %u\n", active ? "active" : "idle", n_frames, n_skipped, n_errors, n_events);
+    if (n_frames > 0)
+    {
+        printfn("Motion cost at %ux%u: copy %lld us decode %lld us analyse %lld us average, %u us max\n", last_width, last_height,
+                total_copy_us / n_frames, total_decode_us / n_frames, total_analyse_us / n_frames, max_us);
+    }
+}
+
+esp_err_t motion_init()
+{
+    mutex = xSemaphoreCreateMutex();
+    // below the stream, transcode and recorder tasks, it only ever gets time nobody else wants
+    if (xTaskCreate(motion_task, "motion", 4096, nullptr, 2, &task) != pdPASS)
+    {
+        ESP_LOGE(TAG, "failed to create motion task");
+        return ESP_FAIL;
+    }
+    if (!capture_add_consumer(on_frame, nullptr))
+    {
+        ESP_LOGE(TAG, "failed to add capture consumer");
+        return ESP_FAIL;
+    }
+
+    capture_acquire();
+    return ESP_OK;
+}
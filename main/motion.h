@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+esp_err_t motion_init();
+void motion_print_info(int (*printfn)(const char *format, ...));
+
+// Decodes and analyses one frame as the motion task does after its copy, so the cost per frame
+// can be measured off the board. timestamp is the capture time in microseconds.
+void motion_look(uint32_t seq, int64_t timestamp, const uint8_t *buf, size_t len);
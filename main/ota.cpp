@@ -18,6 +18,8 @@
 #include "string.h"
 
 #include "ota.h"
+#include "session.h"
+#include "www.h"
 
 //#include <sys/socket.h>
 
@@ -38,79 +40,6 @@ static const char *TAG = "ota";
 
 #define OTA_URL_SIZE 256
 
-static char title[64] = "Firmware Update";
-
-// Note this has two %s substitutions bot for the title
-static const char *update_page = R"!(<html>
-	<head>
-		<meta http-equiv="content-type" content="text/html; charset=utf-8" />
-        <link rel="icon" href="favicon.ico" type="image/x-icon" />
-		<title>%s</title>
-		<script>
-function startUpload() {
-    var otafile = document.getElementById("otafile").files;
-
-    if (otafile.length == 0) {
-        alert("No file selected!");
-    } else {
-        document.getElementById("otafile").disabled = true;
-        document.getElementById("upload").disabled = true;
-
-        var file = otafile[0];
-        var xhr = new XMLHttpRequest();
-        xhr.onreadystatechange = function() {
-            if (xhr.readyState == 4) {
-                if (xhr.status == 200) {
-                    document.open();
-                    document.write(xhr.responseText);
-                    document.close();
-                } else if (xhr.status == 0) {
-                    alert("Server closed the connection abruptly!");
-                    location.reload()
-                } else {
-                    alert(xhr.status + " Error!\n" + xhr.responseText);
-                    location.reload()
-                }
-            }
-        };
-
-        xhr.upload.onprogress = function (e) {
-            let percent = (e.loaded / e.total * 100).toFixed(0);
-            let progress2 = document.getElementById("progress2");
-            progress2.textContent = "" + percent + "%";
-            let progress = document.getElementById("progress");
-            progress.value = percent;
-            progress.textContent = "" + percent + "%";
-        };
-        xhr.open("POST", "/post_update", true);
-        xhr.send(file);
-    }
-}
-		</script>
-<style>
-body, textarea, label, button, input[type=file] {font-family: arial, sans-serif;}
-label, input[type=file] { line-height:2.4rem; font-size:1.2rem; }
-input::file-selector-button, button { border: 0; border-radius: 0.3rem; background:#1fa3ec; color:#ffffff; line-height:2.4rem; font-size:1.2rem; width:180px;
--webkit-transition-duration:0.4s;transition-duration:0.4s;cursor:pointer;}
-button:hover{background:#0b73aa;}
-</style>
-	</head>
-	<body>
-		<h1 style="text-align: center">%s</h1>
-        <div style="margin-left:auto; margin-right: auto; display: table;">
-            <div style="padding: 6px">
-                <label for="otafile" class="file">Update firmware:&nbsp</label>
-                <input type="file" id="otafile" name="otafile" />
-            </div>
-            <span>
-                <button id="upload" type="button" onclick="startUpload()">Upload</button>
-            </span><span>
-            <progress id="progress" value="0" max="100"></progress></span>
-            <span id="progress2"></span>
-        </div>
-	</body>
-</html>)!";
-
 #if 0
 static esp_err_t _http_event_handler(esp_http_client_event_t *evt)
 {
@@ -158,20 +87,7 @@ static esp_err_t update_handler(httpd_req_t *req)
     	return httpd_resp_send(req, nullptr, 0);
     }
 
-    esp_err_t res = httpd_resp_set_type(req, "text/html");
-    if(res != ESP_OK)
-    {
-        return res;
-    }
-
-    res = httpd_resp_set_hdr(req, "Connection", "close");
-
-    len = strlen(update_page) + 2 * strlen(title) + 1; // bit too big
-    char *page = static_cast<char *>(malloc(len));
-    snprintf(page, len, update_page, title, title);
-	auto err = httpd_resp_send(req, page, strlen(page));
-    free(page);
-    return err;
+    return www_send(req, www_find("update.html"));
 }
 
 #if 0
@@ -370,17 +286,17 @@ extern void ota_add_endpoints(httpd_handle_t server)
     update.uri	  = "/update";
     update.method   = HTTP_GET;
     update.handler  = update_handler;
-    httpd_register_uri_handler(server, &update);
+    session_register_uri_handler(server, &update);
 
     httpd_uri_t post_update{};
     post_update.uri	  = "/post_update";
     post_update.method   = HTTP_POST;
     post_update.handler  = update_post_handler;
-    httpd_register_uri_handler(server, &post_update);
+    session_register_uri_handler(server, &post_update);
 
     httpd_uri_t restart{};
     restart.uri	  = "/restart";
     restart.method   = HTTP_GET;
     restart.handler  = restart_handler;
-    httpd_register_uri_handler(server, &restart);
+    session_register_uri_handler(server, &restart);
 }
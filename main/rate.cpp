@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <esp_log.h>
+#include "capture.h"
+#include "rate.h"
+#include "sse.h"
+
+#include "esp_camera.h"
+#include "freertos/semphr.h"
+#include "freertos/timers.h"
+
+#define TAG "rate"
+
+// Every window the controller looks at the frame size and rate coming off the sensor and at how
+// fast the slowest full size stream client took its frames. In fps mode the quality gets worse
+// when that client's link cannot carry the target rate at the current frame size, and better when
+// it has room to spare. In bit rate mode it holds the captured stream to the target.
+#define RATE_WINDOW_MS 2000
+#define RATE_DEFAULT_FPS 15
+#define RATE_DEFAULT_BEST 10
+#define RATE_DEFAULT_WORST 40
+#define RATE_STEP 2
+#define RATE_HYSTERESIS 10      // percent either side of the target where nothing changes
+// A step better makes frames roughly this much bigger, in percent, so stepping up needs that much
+// headroom on top of the band or the next window would only step back down
+#define RATE_STEP_GROWTH 15
+#define RATE_HOLD_WINDOWS 2     // windows in a row out of the band before a change is made
+
+struct rate_link
+{
+    int fd;
+    uint64_t bytes;
+    int64_t busy_us;
+    unsigned int parts;     // 0 for an unused entry
+};
+
+static SemaphoreHandle_t mutex = nullptr;
+static rate_link links[CONFIG_LWIP_MAX_SOCKETS];
+static uint64_t captured_bytes;
+static unsigned int captured_frames;
+
+static unsigned int target_fps = RATE_DEFAULT_FPS;
+static unsigned int target_kbps;
+static int best = RATE_DEFAULT_BEST;
+static int worst = RATE_DEFAULT_WORST;
+static int quality = -1;
+static int pending_direction;   // 1 to make it worse, -1 better
+static unsigned int pending_windows;
+static unsigned int n_changes;
+
+// what the last window saw, fps in tenths
+static unsigned int capture_fps10;
+static unsigned int frame_bytes;
+static unsigned int stream_kbps;
+static unsigned int client_fps10;
+static unsigned int client_kbps;
+
+// Runs on the capture task
+static void on_frame(capture_frame *frame, void *)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    captured_bytes += frame->len;
+    ++captured_frames;
+    xSemaphoreGive(mutex);
+}
+
+void rate_part_sent(int fd, size_t bytes, int64_t send_us)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    rate_link *link = nullptr;
+    for (auto &l : links)
+    {
+        if (l.parts != 0 && l.fd == fd)
+        {
+            link = &l;
+            break;
+        }
+        if (l.parts == 0 && link == nullptr)
+        {
+            link = &l;
+        }
+    }
+    if (link != nullptr)
+    {
+        if (link->parts == 0)
+        {
+            link->fd = fd;
+        }
+        link->bytes += bytes;
+        link->busy_us += send_us;
+        ++link->parts;
+    }
+    xSemaphoreGive(mutex);
+}
+
+// 1 to make the quality worse, -1 better, 0 to leave it. Called with the mutex held.
+static int direction(unsigned int n_links)
+{
+    if (target_kbps != 0)
+    {
+        if (captured_frames == 0)
+        {
+            return 0;
+        }
+        if (stream_kbps * 100ull > target_kbps * (100ull + RATE_HYSTERESIS))
+        {
+            return 1;
+        }
+        if (stream_kbps * (100ull + RATE_STEP_GROWTH) < target_kbps * (100ull - RATE_HYSTERESIS))
+        {
+            return -1;
+        }
+        return 0;
+    }
+
+    if (target_fps == 0 || n_links == 0 || frame_bytes == 0)
+    {
+        return 0;
+    }
+
+    // no point asking for more than the sensor gives
+    uint64_t goal10 = std::min(target_fps * 10, capture_fps10);
+    // frames a second the slowest link could carry at the current size
+    uint64_t possible10 = client_kbps * 1250ull / frame_bytes;
+    if (possible10 * 100 < goal10 * (100 - RATE_HYSTERESIS))
+    {
+        return 1;
+    }
+    if (possible10 * 100 * 100 > goal10 * (100 + RATE_HYSTERESIS) * (100 + RATE_STEP_GROWTH))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+static void control(TimerHandle_t)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    if (quality < 0)
+    {
+        sensor_t *s = esp_camera_sensor_get();
+        quality = s != nullptr ? s->status.quality : best;
+    }
+
+    capture_fps10 = captured_frames * 10000 / RATE_WINDOW_MS;
+    frame_bytes = captured_frames != 0 ? captured_bytes / captured_frames : 0;
+    stream_kbps = captured_bytes * 8 / RATE_WINDOW_MS;
+
+    unsigned int n_links = 0;
+    for (auto &l : links)
+    {
+        if (l.parts == 0)
+        {
+            continue;
+        }
+        unsigned int kbps = l.busy_us > 0 ? l.bytes * 8000 / l.busy_us : UINT32_MAX;
+        unsigned int fps10 = l.parts * 10000 / RATE_WINDOW_MS;
+        client_kbps = n_links == 0 ? kbps : std::min(client_kbps, kbps);
+        client_fps10 = n_links == 0 ? fps10 : std::min(client_fps10, fps10);
+        ++n_links;
+        l = rate_link{};
+    }
+    if (n_links == 0)
+    {
+        client_kbps = client_fps10 = 0;
+    }
+
+    bool enabled = target_fps != 0 || target_kbps != 0;
+    int change = enabled ? direction(n_links) : 0;
+    captured_bytes = 0;
+    captured_frames = 0;
+
+    if (change == 0 || change != pending_direction)
+    {
+        pending_direction = change;
+        pending_windows = change != 0;
+    }
+    else
+    {
+        ++pending_windows;
+    }
+
+    int next = enabled ? std::clamp(quality, best, worst) : quality;
+    if (change != 0 && pending_windows >= RATE_HOLD_WINDOWS)
+    {
+        next = std::clamp(quality + change * RATE_STEP, best, worst);
+        pending_direction = 0;
+        pending_windows = 0;
+    }
+    bool changed = next != quality;
+    if (changed)
+    {
+        ESP_LOGI(TAG, "quality %d -> %d: capture %u.%u fps %u bytes, slowest client %u.%u fps %u kbps", quality, next,
+                 capture_fps10 / 10, capture_fps10 % 10, frame_bytes, client_fps10 / 10, client_fps10 % 10, client_kbps);
+        ++n_changes;
+        // this runs on the timer task so only asks, the capture task makes the change before its next frame
+        quality = next;
+        capture_set_quality(next);
+    }
+    xSemaphoreGive(mutex);
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    char buf[224];
+    int len = snprintf(buf, sizeof(buf), "{ \"quality\": %d, \"best\": %d, \"worst\": %d, \"target_fps\": %u, \"target_kbps\": %u, "
+                       "\"capture_fps\": %u.%u, \"frame_bytes\": %u, \"stream_kbps\": %u, \"client_fps\": %u.%u, \"client_kbps\": %u }",
+                       quality, best, worst, target_fps, target_kbps, capture_fps10 / 10, capture_fps10 % 10, frame_bytes, stream_kbps,
+                       client_fps10 / 10, client_fps10 % 10, client_kbps);
+    xSemaphoreGive(mutex);
+
+    // sse_broadcast copies the event into a message of its own, so broadcasting from the timer
+    // task alongside the status ticker is safe; a truncated event is dropped rather than sent
+    if (enabled && len > 0 && len < static_cast<int>(sizeof(buf)))
+    {
+        sse_broadcast("rate", buf, len);
+    }
+}
+
+void rate_set_target(unsigned int fps, unsigned int kbps)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    target_fps = fps;
+    target_kbps = kbps;
+    pending_direction = 0;
+    pending_windows = 0;
+    xSemaphoreGive(mutex);
+}
+
+void rate_set_bounds(int new_best, int new_worst)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    best = std::clamp(std::min(new_best, new_worst), 0, 63);
+    worst = std::clamp(std::max(new_best, new_worst), 0, 63);
+    xSemaphoreGive(mutex);
+}
+
+void rate_set_quality(int q)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    target_fps = 0;
+    target_kbps = 0;
+    quality = std::clamp(q, 0, 63);
+    capture_set_quality(quality);
+    xSemaphoreGive(mutex);
+}
+
+void rate_print_info(int (*printfn)(const char *format, ...))
+{
+    if (mutex == nullptr)
+    {
+        return;
+    }
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    printfn("Rate: quality %d (%d-%d) target %u fps %u kbps, %u changes\n", quality, best, worst, target_fps, target_kbps, n_changes);
+    printfn("Rate: capture %u.%u fps %u bytes %u kbps, slowest client %u.%u fps %u kbps\n", capture_fps10 / 10, capture_fps10 % 10,
+            frame_bytes, stream_kbps, client_fps10 / 10, client_fps10 % 10, client_kbps);
+    xSemaphoreGive(mutex);
+}
+
+esp_err_t rate_init()
+{
+    mutex = xSemaphoreCreateMutex();
+    if (!capture_add_consumer(on_frame, nullptr))
+    {
+        ESP_LOGE(TAG, "failed to add capture consumer");
+        return ESP_FAIL;
+    }
+
+    auto timer = xTimerCreate("rate timer", pdMS_TO_TICKS(RATE_WINDOW_MS), pdTRUE, nullptr, control);
+    if (timer == nullptr || xTimerStart(timer, 0) != pdPASS)
+    {
+        ESP_LOGE(TAG, "failed to start rate timer");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
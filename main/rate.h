@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// Moves the sensor's jpeg quality between two bounds to hold a frame rate on the slowest full
+// size stream client or, if one is set, a bit rate for the stream as captured
+esp_err_t rate_init();
+void rate_print_info(int (*printfn)(const char *format, ...));
+
+// Called by the stream engine when a client has been sent a whole full size frame
+void rate_part_sent(int fd, size_t bytes, int64_t send_us);
+
+// A kbps of 0 means hold fps, an fps of 0 as well turns the controller off
+void rate_set_target(unsigned int fps, unsigned int kbps);
+// Quality numbers as the sensor takes them, lower is better
+void rate_set_bounds(int best, int worst);
+// Fixes the quality and turns the controller off
+void rate_set_quality(int quality);
@@ -0,0 +1,336 @@
+#include <algorithm>
+#include <dirent.h>
+#include <esp_log.h>
+#include <unistd.h>
+#include "avi.h"
+#include "capture.h"
+#include "recorder.h"
+
+#include "driver/sdmmc_host.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_vfs_fat.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "sdmmc_cmd.h"
+
+#define TAG "recorder"
+
+// Records everything to AVI files on the SD card, if there is one, starting a new file every
+// few minutes and deleting the oldest when the card gets full
+#define RECORD_MOUNT "/sdcard"
+#define RECORD_FILE_SECONDS 300
+#define RECORD_SYNC_SECONDS 5
+#define RECORD_MAX_FRAMES 8192
+
+// Before each file there has to be room on the card for all of it: the bytes a second of the last
+// file (or the first frame times RECORD_GUESS_FPS to start with) for RECORD_FILE_SECONDS, no more
+// than RECORD_MAX_FRAMES of them, plus the index and some spare for the bit rate going up
+#define RECORD_GUESS_FPS 25
+#define RECORD_SPARE (16ull * 1024 * 1024)
+
+// Each write is a whole number of FAT sectors (4K in this configuration) and SD blocks, and big
+// enough that the card is not asked to program a part of an erase unit for every frame
+#define RECORD_BATCH (32 * 1024)
+
+static SemaphoreHandle_t mutex = nullptr;
+static TaskHandle_t task = nullptr;
+static capture_frame *pending;
+static bool busy;                   // from taking a frame until it is written
+static unsigned int file_number;
+
+// the recorder task's own copy of the frame it is writing
+static uint8_t *copy;
+static size_t copy_size;
+
+static unsigned int n_files;
+static unsigned int n_recorded;
+static unsigned int n_skipped;
+static unsigned int n_deleted;
+
+// Runs on the capture task. A frame that arrives while the recorder is still busy with the last
+// one is skipped.
+static void on_frame(capture_frame *frame, void *)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    bool idle = !busy;
+    if (idle)
+    {
+        capture_frame_ref(frame);
+        pending = frame;
+        busy = true;
+    }
+    else
+    {
+        ++n_skipped;
+    }
+    xSemaphoreGive(mutex);
+
+    if (idle)
+    {
+        xTaskNotifyGive(task);
+    }
+}
+
+static bool parse_file_number(const char *name, unsigned int *number)
+{
+    return sscanf(name, "REC%5u.AVI", number) == 1;
+}
+
+static void file_path(char *path, size_t size, unsigned int number)
+{
+    snprintf(path, size, RECORD_MOUNT "/REC%05u.AVI", number);
+}
+
+// Finds the oldest and newest recordings on the card
+static bool scan_files(unsigned int *oldest, unsigned int *newest)
+{
+    DIR *dir = opendir(RECORD_MOUNT);
+    if (dir == nullptr)
+    {
+        return false;
+    }
+
+    bool found = false;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr)
+    {
+        unsigned int number;
+        if (parse_file_number(entry->d_name, &number))
+        {
+            *oldest = found ? std::min(*oldest, number) : number;
+            *newest = found ? std::max(*newest, number) : number;
+            found = true;
+        }
+    }
+    closedir(dir);
+    return found;
+}
+
+// Deletes the oldest recordings until there are at least needed bytes free
+static void make_room(uint64_t needed)
+{
+    for (;;)
+    {
+        uint64_t total = 0, free_bytes = 0;
+        unsigned int oldest, newest;
+        if (esp_vfs_fat_info(RECORD_MOUNT, &total, &free_bytes) != ESP_OK || free_bytes >= needed || !scan_files(&oldest, &newest))
+        {
+            if (free_bytes < needed)
+            {
+                ESP_LOGW(TAG, "only %llu MB free for a file of %llu MB", free_bytes / (1024 * 1024), needed / (1024 * 1024));
+            }
+            return;
+        }
+
+        char path[32];
+        file_path(path, sizeof(path), oldest);
+        ESP_LOGI(TAG, "%llu MB free, deleting %s", free_bytes / (1024 * 1024), path);
+        if (unlink(path) != 0)
+        {
+            return;
+        }
+        ++n_deleted;
+    }
+}
+
+static avi_writer *open_file(size_t width, size_t height, uint64_t bytes_per_second, size_t frame_len)
+{
+    uint64_t frames = std::min<uint64_t>(RECORD_MAX_FRAMES, bytes_per_second * RECORD_FILE_SECONDS / frame_len + 1);
+    uint64_t expected = std::min<uint64_t>(bytes_per_second * RECORD_FILE_SECONDS, frames * frame_len);
+    make_room(expected + frames * 24 + RECORD_SPARE);
+
+    char path[32];
+    file_path(path, sizeof(path), ++file_number);
+    avi_writer *w = avi_open(path, width, height, RECORD_MAX_FRAMES, RECORD_BATCH);
+    if (w == nullptr)
+    {
+        ESP_LOGE(TAG, "failed to open %s", path);
+        return nullptr;
+    }
+
+    ESP_LOGI(TAG, "recording to %s", path);
+    ++n_files;
+    return w;
+}
+
+static void close_file(avi_writer *w)
+{
+    size_t frames = avi_frame_count(w);
+    if (!avi_close(w))
+    {
+        ESP_LOGE(TAG, "failed to finish file %u", file_number);
+        return;
+    }
+    ESP_LOGI(TAG, "finished file %u with %u frames", file_number, frames);
+}
+
+// The recorder task's state for the file being written
+static avi_writer *writer;
+static int64_t file_start;
+static int64_t last_sync;
+static size_t width, height;
+static uint64_t file_bytes;
+static uint64_t bytes_per_second;   // of the last file, 0 until there is one
+
+static void write_frame(const uint8_t *buf, size_t len, size_t frame_width, size_t frame_height, int64_t timestamp)
+{
+    // a change of frame size starts a new file as the size is in the file header
+    bool resized = frame_width != width || frame_height != height;
+    if (writer != nullptr && (avi_full(writer) || resized || timestamp - file_start > RECORD_FILE_SECONDS * 1000000ll))
+    {
+        if (!resized && timestamp > file_start)
+        {
+            bytes_per_second = file_bytes * 1000000 / (timestamp - file_start);
+        }
+        close_file(writer);
+        writer = nullptr;
+    }
+
+    if (writer == nullptr)
+    {
+        if (resized)
+        {
+            bytes_per_second = 0;
+        }
+        writer = open_file(frame_width, frame_height, bytes_per_second != 0 ? bytes_per_second : len * RECORD_GUESS_FPS, len);
+        width = frame_width;
+        height = frame_height;
+        file_start = timestamp;
+        last_sync = timestamp;
+        file_bytes = 0;
+    }
+
+    if (writer != nullptr)
+    {
+        int64_t start = esp_timer_get_time();
+        if (!avi_add_frame(writer, buf, len, timestamp))
+        {
+            ESP_LOGE(TAG, "write failed on file %u", file_number);
+            close_file(writer);
+            writer = nullptr;
+        }
+        else
+        {
+            ++n_recorded;
+            file_bytes += len + 8;
+            if (timestamp - last_sync > RECORD_SYNC_SECONDS * 1000000ll)
+            {
+                // a cheap header rewrite so a power loss costs at most the last few seconds
+                avi_sync(writer);
+                last_sync = timestamp;
+            }
+            ESP_LOGD(TAG, "wrote %u bytes in %lld us", len, esp_timer_get_time() - start);
+        }
+    }
+}
+
+static void record_task(void *)
+{
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        capture_frame *frame = pending;
+        pending = nullptr;
+        xSemaphoreGive(mutex);
+        if (frame == nullptr)
+        {
+            continue;
+        }
+
+        // Copied out so the camera buffer goes back to the driver now rather than after the card
+        // has taken it, which can be tens of milliseconds and much longer when it is erasing.
+        size_t len = frame->len;
+        if (len > copy_size)
+        {
+            heap_caps_free(copy);
+            copy = static_cast<uint8_t *>(heap_caps_malloc(len, MALLOC_CAP_SPIRAM));
+            copy_size = copy != nullptr ? len : 0;
+        }
+        if (copy != nullptr)
+        {
+            memcpy(copy, frame->buf, len);
+        }
+        size_t frame_width = frame->fb->width;
+        size_t frame_height = frame->fb->height;
+        int64_t timestamp = frame->timestamp;
+        capture_frame_unref(frame);
+
+        if (copy == nullptr)
+        {
+            ++n_skipped;
+        }
+        else
+        {
+            write_frame(copy, len, frame_width, frame_height, timestamp);
+        }
+
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        busy = false;
+        xSemaphoreGive(mutex);
+    }
+}
+
+static esp_err_t mount_card()
+{
+    esp_vfs_fat_sdmmc_mount_config_t mount_config{};
+    mount_config.format_if_mount_failed = false;
+    mount_config.max_files = 2;
+
+    sdmmc_host_t host = SDMMC_HOST_DEFAULT();
+    sdmmc_slot_config_t slot_config = SDMMC_SLOT_CONFIG_DEFAULT();
+    // one data line leaves GPIO 4 alone for the flash LED on the AI Thinker board
+    slot_config.width = 1;
+#ifndef CONFIG_IDF_TARGET_ESP32
+    // Freenove ESP32-S3 board
+    slot_config.clk = GPIO_NUM_39;
+    slot_config.cmd = GPIO_NUM_38;
+    slot_config.d0 = GPIO_NUM_40;
+#endif
+
+    sdmmc_card_t *card;
+    return esp_vfs_fat_sdmmc_mount(RECORD_MOUNT, &host, &slot_config, &mount_config, &card);
+}
+
+void recorder_print_info(int (*printfn)(const char *format, ...))
+{
+    if (task == nullptr)
+    {
+        return;
+    }
+
+    printfn("Recorder: file %u files %u frames %u skipped %u deleted %u\n", file_number, n_files, n_recorded, n_skipped, n_deleted);
+}
+
+esp_err_t recorder_init()
+{
+    esp_err_t err = mount_card();
+    if (err != ESP_OK)
+    {
+        ESP_LOGI(TAG, "no SD card, not recording: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    unsigned int oldest;
+    if (!scan_files(&oldest, &file_number))
+    {
+        file_number = 0;
+    }
+
+    mutex = xSemaphoreCreateMutex();
+    if (xTaskCreate(record_task, "recorder", 4096, nullptr, 3, &task) != pdPASS)
+    {
+        ESP_LOGE(TAG, "failed to create recorder task");
+        return ESP_FAIL;
+    }
+    if (!capture_add_consumer(on_frame, nullptr))
+    {
+        ESP_LOGE(TAG, "failed to add capture consumer");
+        return ESP_FAIL;
+    }
+
+    capture_acquire();
+    return ESP_OK;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include "esp_err.h"
+
+esp_err_t recorder_init();
+void recorder_print_info(int (*printfn)(const char *format, ...));
@@ -0,0 +1,663 @@
+#include <algorithm>
+#include <dirent.h>
+#include <esp_log.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include "capture.h"
+#include "httpd_util.h"
+#include "replay.h"
+
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#define TAG "replay"
+
+// One more buffer than the capture task can hold, as with fb_count for the driver, and as many
+// again for frames still out from a recording that has been stopped
+#define REPLAY_FBS (CAPTURE_MAX_FRAMES + 1)
+#define REPLAY_SLOTS (2 * REPLAY_FBS)
+#define REPLAY_MAX_FRAMES 16384
+#define REPLAY_MAX_FRAME_LEN (512 * 1024)
+#define REPLAY_DEFAULT_FPS 10
+#define REPLAY_PATH_LEN 64
+
+// Where a frame is: its offset in the file, or for a directory where its name is in names
+struct replay_entry
+{
+    uint32_t offset;
+    uint32_t len;
+};
+
+struct replay_fb
+{
+    camera_fb_t fb;
+    uint8_t *data;
+    bool current;   // for the recording playing now, otherwise freed when it comes back
+    bool in_use;
+};
+
+static SemaphoreHandle_t mutex = nullptr;
+static replay_fb fbs[REPLAY_SLOTS];
+
+static bool active;
+static unsigned int generation;     // of the recording, bumped by every start and stop
+static char path[REPLAY_PATH_LEN];
+static FILE *file;                  // null for a directory
+static replay_entry *entries;
+static unsigned int n_entries;
+static char *names;
+static size_t names_len;
+static unsigned int max_len;
+
+static replay_config config;
+static int64_t period_us;           // 0 when unpaced
+static int64_t jitter_us;
+static int64_t stall_us;
+static int64_t start_us;
+static uint32_t next_frame;         // sensor frames since the start, the recording wraps under it
+
+static unsigned int n_replayed;
+static unsigned int n_missed;
+static unsigned int n_read_errors;
+
+static bool add_entry(uint32_t offset, uint32_t len)
+{
+    if (n_entries == REPLAY_MAX_FRAMES || len == 0 || len > REPLAY_MAX_FRAME_LEN)
+    {
+        return false;
+    }
+    if ((n_entries & (n_entries - 1)) == 0)
+    {
+        size_t capacity = n_entries == 0 ? 64 : n_entries * 2;
+        auto *grown = static_cast<replay_entry *>(realloc(entries, capacity * sizeof(replay_entry)));
+        if (grown == nullptr)
+        {
+            return false;
+        }
+        entries = grown;
+    }
+    entries[n_entries].offset = offset;
+    entries[n_entries].len = len;
+    ++n_entries;
+    if (len > max_len)
+    {
+        max_len = len;
+    }
+    return true;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (uint32_t(p[3]) << 24);
+}
+
+// Walks the chunks of an AVI, going into every LIST, to find the frames and the frame rate. A
+// file the recorder did not get to close is read up to its last whole chunk.
+static bool index_avi(int64_t *us_per_frame)
+{
+    uint8_t h[12];
+    if (fread(h, 1, 12, file) != 12 || memcmp(h, "RIFF", 4) != 0 || memcmp(h + 8, "AVI ", 4) != 0)
+    {
+        return false;
+    }
+
+    while (fread(h, 1, 8, file) == 8)
+    {
+        uint32_t size = get32(h + 4);
+        if (memcmp(h, "LIST", 4) == 0)
+        {
+            if (fread(h, 1, 4, file) != 4)
+            {
+                break;
+            }
+            continue;
+        }
+        if (memcmp(h, "idx1", 4) == 0)
+        {
+            break;
+        }
+
+        long offset = ftell(file);
+        if (memcmp(h, "avih", 4) == 0 && size >= 4 && fread(h, 1, 4, file) == 4)
+        {
+            *us_per_frame = get32(h);
+            offset += 4;
+            size -= 4;
+        }
+        else if (h[2] == 'd' && h[3] == 'c' && !add_entry(offset, size))
+        {
+            break;
+        }
+        if (fseek(file, size + (size & 1), SEEK_CUR) != 0)
+        {
+            break;
+        }
+    }
+    return n_entries > 0;
+}
+
+// Follows the segments of a JPEG whose SOI has just been read and then the entropy coded data to
+// the EOI, so an EOI in a thumbnail is not taken for the end. Returns the offset just past the
+// EOI, or 0 if it is not a whole JPEG.
+static long jpeg_end()
+{
+    bool in_scan = false;
+    for (;;)
+    {
+        int c = getc(file);
+        if (c == EOF || (c != 0xff && !in_scan))
+        {
+            return 0;
+        }
+        if (c != 0xff)
+        {
+            continue;
+        }
+        while ((c = getc(file)) == 0xff)
+        {
+        }
+        if (c == EOF)
+        {
+            return 0;
+        }
+        if (c == 0x00 || (c >= 0xd0 && c <= 0xd7))
+        {
+            // a stuffed byte or a restart marker, part of the scan
+            if (!in_scan)
+            {
+                return 0;
+            }
+            continue;
+        }
+        if (c == 0xd9)
+        {
+            return ftell(file);
+        }
+
+        int hi = getc(file);
+        int lo = getc(file);
+        if (lo == EOF || fseek(file, ((hi << 8) | lo) - 2, SEEK_CUR) != 0)
+        {
+            return 0;
+        }
+        in_scan = c == 0xda;
+    }
+}
+
+// Whatever is between the images, such as part headers, is skipped
+static bool index_jpegs()
+{
+    int prev = EOF;
+    int c;
+    while ((c = getc(file)) != EOF && n_entries < REPLAY_MAX_FRAMES)
+    {
+        if (prev == 0xff && c == 0xd8)
+        {
+            long start = ftell(file) - 2;
+            long end = jpeg_end();
+            if (end > 0)
+            {
+                add_entry(start, end - start);
+            }
+            c = EOF;
+        }
+        prev = c;
+    }
+    return n_entries > 0;
+}
+
+static bool is_jpeg_name(const char *name)
+{
+    const char *dot = strrchr(name, '.');
+    return dot != nullptr && (strcasecmp(dot, ".jpg") == 0 || strcasecmp(dot, ".jpeg") == 0);
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(names + static_cast<const replay_entry *>(a)->offset, names + static_cast<const replay_entry *>(b)->offset);
+}
+
+static bool index_directory()
+{
+    DIR *dir = opendir(path);
+    if (dir == nullptr)
+    {
+        return false;
+    }
+
+    struct dirent *e;
+    while ((e = readdir(dir)) != nullptr)
+    {
+        if (!is_jpeg_name(e->d_name))
+        {
+            continue;
+        }
+        char frame_path[REPLAY_PATH_LEN + 256];
+        struct stat st;
+        snprintf(frame_path, sizeof(frame_path), "%s/%s", path, e->d_name);
+        if (stat(frame_path, &st) != 0)
+        {
+            continue;
+        }
+
+        size_t len = strlen(e->d_name) + 1;
+        auto *grown = static_cast<char *>(realloc(names, names_len + len));
+        if (grown == nullptr)
+        {
+            break;
+        }
+        names = grown;
+        memcpy(names + names_len, e->d_name, len);
+        if (!add_entry(names_len, st.st_size))
+        {
+            continue;
+        }
+        names_len += len;
+    }
+    closedir(dir);
+
+    qsort(entries, n_entries, sizeof(replay_entry), compare_names);
+    return n_entries > 0;
+}
+
+static void free_index()
+{
+    if (file != nullptr)
+    {
+        fclose(file);
+        file = nullptr;
+    }
+    free(entries);
+    entries = nullptr;
+    n_entries = 0;
+    free(names);
+    names = nullptr;
+    names_len = 0;
+    max_len = 0;
+}
+
+// Frees the buffers nobody has, the rest go when they are returned
+static void free_buffers()
+{
+    for (auto &f : fbs)
+    {
+        f.current = false;
+        if (!f.in_use && f.data != nullptr)
+        {
+            heap_caps_free(f.data);
+            f.data = nullptr;
+        }
+    }
+}
+
+static bool alloc_buffers()
+{
+    int n = 0;
+    for (auto &f : fbs)
+    {
+        if (n < REPLAY_FBS && f.data == nullptr)
+        {
+            f.data = static_cast<uint8_t *>(heap_caps_malloc(max_len, MALLOC_CAP_SPIRAM));
+            if (f.data == nullptr)
+            {
+                return false;
+            }
+            f.current = true;
+            ++n;
+        }
+    }
+    return n == REPLAY_FBS;
+}
+
+static bool jpeg_size(const uint8_t *buf, size_t len, size_t *width, size_t *height)
+{
+    const uint8_t *end = buf + len;
+    const uint8_t *p = buf + 2;
+    while (p + 9 <= end && p[0] == 0xff)
+    {
+        if (p[1] >= 0xc0 && p[1] <= 0xc2)
+        {
+            *height = (p[5] << 8) | p[6];
+            *width = (p[7] << 8) | p[8];
+            return true;
+        }
+        p += 2 + ((p[2] << 8) | p[3]);
+    }
+    return false;
+}
+
+static uint32_t mix(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+// When sensor frame k is due. Only depends on k and the config, so a run can be repeated exactly.
+static int64_t due_time(uint32_t k)
+{
+    int64_t t = start_us + k * period_us;
+    if (config.stall_every > 0)
+    {
+        t += (k / config.stall_every) * stall_us;
+    }
+    if (jitter_us > 0)
+    {
+        t += static_cast<int64_t>(mix(config.seed ^ (k * 0x9e3779b9u)) % (2 * jitter_us + 1)) - jitter_us;
+    }
+    return t;
+}
+
+esp_err_t replay_start(const replay_config *new_config)
+{
+    if (new_config->path == nullptr || strlen(new_config->path) >= REPLAY_PATH_LEN)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    active = false;
+    ++generation;
+    free_index();
+    free_buffers();
+
+    strcpy(path, new_config->path);
+    config = *new_config;
+    config.path = path;
+
+    int64_t us_per_frame = 1000000 / REPLAY_DEFAULT_FPS;
+    bool indexed = false;
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode))
+    {
+        indexed = index_directory();
+    }
+    else if ((file = fopen(path, "rb")) != nullptr)
+    {
+        indexed = index_avi(&us_per_frame);
+        if (!indexed)
+        {
+            n_entries = 0;
+            max_len = 0;
+            rewind(file);
+            indexed = index_jpegs();
+        }
+    }
+
+    if (!indexed)
+    {
+        ESP_LOGE(TAG, "no frames found in %s", path);
+        free_index();
+        xSemaphoreGive(mutex);
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (!alloc_buffers())
+    {
+        ESP_LOGE(TAG, "no memory for %u byte frames", max_len);
+        free_index();
+        free_buffers();
+        xSemaphoreGive(mutex);
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (config.fps == REPLAY_UNPACED)
+    {
+        period_us = 0;
+    }
+    else
+    {
+        period_us = config.fps > 0 ? 1000000 / config.fps : us_per_frame;
+    }
+    // frames stay in order however much they move
+    jitter_us = period_us > 0 ? std::min<int64_t>(config.jitter_ms * 1000ll, period_us / 2 - 1) : 0;
+    stall_us = period_us > 0 ? config.stall_ms * 1000ll : 0;
+    start_us = esp_timer_get_time();
+    next_frame = 0;
+    n_replayed = 0;
+    n_missed = 0;
+    n_read_errors = 0;
+    active = true;
+    xSemaphoreGive(mutex);
+
+    ESP_LOGI(TAG, "replaying %u frames from %s, %lld us a frame", n_entries, path, period_us);
+    return ESP_OK;
+}
+
+void replay_stop()
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    if (active)
+    {
+        ESP_LOGI(TAG, "stopped %s after %u frames", path, n_replayed);
+    }
+    active = false;
+    ++generation;
+    free_index();
+    free_buffers();
+    xSemaphoreGive(mutex);
+}
+
+bool replay_active()
+{
+    return active;
+}
+
+static bool read_frame(const replay_entry &e, uint8_t *data)
+{
+    if (file != nullptr)
+    {
+        return fseek(file, e.offset, SEEK_SET) == 0 && fread(data, 1, e.len, file) == e.len;
+    }
+
+    char frame_path[REPLAY_PATH_LEN + 256];
+    snprintf(frame_path, sizeof(frame_path), "%s/%s", path, names + e.offset);
+    FILE *f = fopen(frame_path, "rb");
+    if (f == nullptr)
+    {
+        return false;
+    }
+    bool ok = fread(data, 1, e.len, f) == e.len;
+    fclose(f);
+    return ok;
+}
+
+// Runs on the capture task. Like the driver in CAMERA_GRAB_LATEST mode the sensor keeps going
+// whether or not frames are taken, so this waits for the next frame to be due or hands over the
+// newest one if the capture task is behind, stamped with when it was due.
+camera_fb_t *replay_fb_get()
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    if (!active)
+    {
+        xSemaphoreGive(mutex);
+        return nullptr;
+    }
+
+    unsigned int gen = generation;
+    uint32_t k = next_frame;
+    int64_t now = esp_timer_get_time();
+    int64_t due = now;
+    if (period_us > 0)
+    {
+        // jump most of the way after a long time with nobody wanting frames
+        int64_t frame_us = period_us + (config.stall_every > 0 ? stall_us / config.stall_every : 0);
+        int64_t behind = (now - start_us) / frame_us - 2;
+        if (behind > k)
+        {
+            k = behind;
+        }
+        while (due_time(k + 1) <= now)
+        {
+            ++k;
+        }
+        due = due_time(k);
+        n_missed += k - next_frame;
+    }
+    xSemaphoreGive(mutex);
+
+    if (due > now)
+    {
+        vTaskDelay(pdMS_TO_TICKS((due - now + 999) / 1000));
+    }
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    if (!active || generation != gen)
+    {
+        xSemaphoreGive(mutex);
+        return nullptr;
+    }
+    if (!config.loop && k >= n_entries)
+    {
+        ESP_LOGI(TAG, "end of %s after %u frames, back to the sensor", path, n_replayed);
+        active = false;
+        ++generation;
+        free_index();
+        free_buffers();
+        xSemaphoreGive(mutex);
+        return nullptr;
+    }
+
+    replay_fb *free_fb = nullptr;
+    for (auto &f : fbs)
+    {
+        if (f.current && !f.in_use)
+        {
+            free_fb = &f;
+            break;
+        }
+    }
+    const replay_entry &e = entries[k % n_entries];
+    next_frame = k + 1;
+    if (free_fb == nullptr || !read_frame(e, free_fb->data))
+    {
+        ++n_read_errors;
+        xSemaphoreGive(mutex);
+        return nullptr;
+    }
+
+    camera_fb_t &fb = free_fb->fb;
+    fb.buf = free_fb->data;
+    fb.len = e.len;
+    fb.width = 0;
+    fb.height = 0;
+    jpeg_size(fb.buf, fb.len, &fb.width, &fb.height);
+    fb.format = PIXFORMAT_JPEG;
+    if (period_us == 0)
+    {
+        due = esp_timer_get_time();
+    }
+    fb.timestamp.tv_sec = due / 1000000;
+    fb.timestamp.tv_usec = due % 1000000;
+    free_fb->in_use = true;
+    ++n_replayed;
+    xSemaphoreGive(mutex);
+    return &fb;
+}
+
+bool replay_fb_return(camera_fb_t *fb)
+{
+    bool ours = false;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (auto &f : fbs)
+    {
+        if (&f.fb == fb)
+        {
+            f.in_use = false;
+            if (!f.current)
+            {
+                heap_caps_free(f.data);
+                f.data = nullptr;
+            }
+            ours = true;
+        }
+    }
+    xSemaphoreGive(mutex);
+    return ours;
+}
+
+// /replay?path=/sdcard/REC00001.AVI&fps=15&jitter=20&stall=200&every=50&seed=1&loop=0 starts a
+// replay, fps=max for no pacing. /replay on its own goes back to the sensor.
+esp_err_t replay_handler(httpd_req_t *req)
+{
+    char replay_path[REPLAY_PATH_LEN] = "";
+    replay_config c{};
+    c.seed = 1;
+    c.loop = true;
+
+    size_t buf_len = httpd_req_get_url_query_len(req) + 1;
+    if (buf_len > 1)
+    {
+        char *buf = (char *)malloc(buf_len);
+        if (httpd_req_get_url_query_str(req, buf, buf_len) == ESP_OK)
+        {
+            char param[16];
+            httpd_query_key_value(buf, "path", replay_path, sizeof(replay_path));
+            if (httpd_query_key_value(buf, "fps", param, sizeof(param)) == ESP_OK)
+            {
+                c.fps = strcmp(param, "max") == 0 ? REPLAY_UNPACED : atoi(param);
+            }
+            if (httpd_query_key_value(buf, "jitter", param, sizeof(param)) == ESP_OK)
+            {
+                c.jitter_ms = atoi(param);
+            }
+            if (httpd_query_key_value(buf, "stall", param, sizeof(param)) == ESP_OK)
+            {
+                c.stall_ms = atoi(param);
+            }
+            if (httpd_query_key_value(buf, "every", param, sizeof(param)) == ESP_OK)
+            {
+                c.stall_every = atoi(param);
+            }
+            if (httpd_query_key_value(buf, "seed", param, sizeof(param)) == ESP_OK)
+            {
+                c.seed = strtoul(param, nullptr, 10);
+            }
+            if (httpd_query_key_value(buf, "loop", param, sizeof(param)) == ESP_OK)
+            {
+                c.loop = atoi(param) != 0;
+            }
+        }
+        free(buf);
+    }
+
+    if (replay_path[0] == '\0')
+    {
+        replay_stop();
+        return httpd_resp_send(req, "OK", HTTPD_RESP_USE_STRLEN);
+    }
+
+    c.path = replay_path;
+    esp_err_t res = replay_start(&c);
+    if (res != ESP_OK)
+    {
+        return httpd_resp_send_err(req, res == ESP_ERR_NOT_FOUND ? HTTPD_404_NOT_FOUND : HTTPD_500_INTERNAL_SERVER_ERROR, esp_err_to_name(res));
+    }
+
+    char reply[48];
+    snprintf(reply, sizeof(reply), "OK %u frames", n_entries);
+    return httpd_resp_send(req, reply, HTTPD_RESP_USE_STRLEN);
+}
+
+void replay_print_info(int (*printfn)(const char *format, ...))
+{
+    if (!active)
+    {
+        return;
+    }
+    printfn("Replay: %s %u frames, %lld us a frame, %u replayed %u missed %u read errors\n", path, n_entries, period_us, n_replayed, n_missed, n_read_errors);
+}
+
+esp_err_t replay_init()
+{
+    mutex = xSemaphoreCreateMutex();
+    return mutex != nullptr ? ESP_OK : ESP_FAIL;
+}
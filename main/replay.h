@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_camera.h"
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+// Plays recorded frames to the capture task in place of the sensor. The recording can be an AVI
+// from the recorder, a file of JPEGs one after another (an .mjpeg, or a /stream response saved
+// with its part headers) or a directory of .jpg files taken in name order.
+#define REPLAY_UNPACED -1
+
+struct replay_config
+{
+    const char *path;
+    int fps;            // 0 for the recording's own rate, REPLAY_UNPACED for as fast as frames are taken
+    int jitter_ms;      // each frame comes up to this much early or late
+    int stall_ms;       // and the sensor falls this much further behind every stall_every frames
+    int stall_every;
+    uint32_t seed;      // the same seed gives the same timings every time
+    bool loop;          // otherwise the sensor takes over again at the end
+};
+
+extern esp_err_t replay_init();
+extern esp_err_t replay_start(const replay_config *config);
+extern void replay_stop();
+extern bool replay_active();
+
+// As esp_camera_fb_get and esp_camera_fb_return. Return is false for a buffer that is not one of
+// the replay's.
+extern camera_fb_t *replay_fb_get();
+extern bool replay_fb_return(camera_fb_t *fb);
+
+extern esp_err_t replay_handler(httpd_req_t *req);
+extern void replay_print_info(int (*printfn)(const char *format, ...));
@@ -0,0 +1,967 @@
+#include <algorithm>
+#include <esp_log.h>
+#include "camera.h"
+#include "capture.h"
+#include "httpd_util.h"
+#include "lwip/sockets.h"
+#include "rtsp.h"
+
+#include "esp_heap_caps.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#define TAG "rtsp"
+
+// RTSP with the frames sent as RTP/JPEG (RFC 2435), either over UDP or interleaved on the
+// RTSP connection. The capture frames are shared with the HTTP streams, each session just
+// keeps its own place in them the same way a stream sink does.
+#ifndef RTSP_PORT
+#define RTSP_PORT 554
+#endif
+#ifndef RTSP_RTP_PORT
+#define RTSP_RTP_PORT 6970          // server end of UDP transport, RTCP would be the port above
+#endif
+#define RTSP_TIMEOUT_S 60           // a UDP session with no requests in this long is dropped
+#define RTSP_REQUEST_MAX 1024
+#define RTSP_REPLY_MAX 1024
+
+#define RTSP_UDP_PACKET 1400        // RTP headers included, with IP and UDP's stays inside one ethernet frame
+#define RTSP_TCP_PAYLOAD 16384      // no fragmentation to worry about so fewer, bigger packets
+#define RTSP_MAX_TCP_PACKETS 64
+
+// interleave prefix, RTP header, JPEG header and restart marker header, then the quantization
+// table header which is only in the first packet of a frame
+#define RTSP_PACKET_HEADER_MAX (4 + 12 + 8 + 4)
+#define RTSP_QTABLE_HEADER_MAX (4 + 128)
+static_assert(RTSP_UDP_PACKET > RTSP_PACKET_HEADER_MAX + RTSP_QTABLE_HEADER_MAX, "no room for scan data in the first UDP packet");
+
+#define RTSP_DETACH_US 200000
+#define RTSP_RETRY_MS 10
+#define RTSP_TASK_CORE (portNUM_PROCESSORS - 1)
+
+// What RFC 2435 needs from a JPEG, found once per frame and shared by every session
+struct rtsp_jpeg
+{
+    const uint8_t *scan;    // entropy coded data between the SOS header and EOI
+    size_t scan_len;
+    uint8_t type;
+    uint8_t width;          // in 8 pixel blocks
+    uint8_t height;
+    uint16_t restart_interval;
+    uint8_t qtables[128];
+    size_t qtables_len;
+};
+
+struct rtsp_session
+{
+    int fd;                 // the RTSP connection
+    uint32_t id;
+    uint32_t ssrc;
+    uint16_t seq;
+    bool playing;
+    bool tcp;
+    uint8_t channel;        // interleaved channel for RTP
+    struct sockaddr_in dest; // client RTP port for UDP
+    int64_t last_request;
+
+    char request[RTSP_REQUEST_MAX];
+    size_t request_len;
+    // replies to requests made while a frame is going out on an interleaved connection wait for
+    // the end of the frame so they do not land in the middle of it
+    char reply[RTSP_REPLY_MAX];
+    size_t reply_start;
+    size_t reply_len;
+    bool replying;
+
+    capture_frame *frame;   // frame being sent, the session holds a reference to it
+    const rtsp_jpeg *jpeg;
+    uint32_t timestamp;
+    size_t offset;          // UDP: how far through the scan data
+    uint8_t headers[RTSP_MAX_TCP_PACKETS * RTSP_PACKET_HEADER_MAX + RTSP_QTABLE_HEADER_MAX];
+    struct iovec iov[2 * RTSP_MAX_TCP_PACKETS];
+    struct iovec *next;
+    int iovcnt;
+    size_t pending;
+    uint8_t *detached;
+    int64_t part_start;
+    bool blocked;
+    bool closing;
+    unsigned int sent;
+    unsigned int dropped;
+};
+
+static SemaphoreHandle_t mutex = nullptr;
+static TaskHandle_t task = nullptr;
+static int udp_fd = -1;
+static rtsp_session *sessions[RTSP_MAX_SESSIONS];
+static rtsp_jpeg jpegs[CAPTURE_MAX_FRAMES];
+
+static void set16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static void set32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+// Picks out the quantization tables, size, sampling and scan data. Only baseline 8 bit JPEGs with
+// the standard Huffman tables can be sent, which is what the sensor makes.
+static bool parse_jpeg(const uint8_t *buf, size_t len, rtsp_jpeg *jpeg)
+{
+    if (len < 4 || buf[0] != 0xff || buf[1] != 0xd8)
+    {
+        return false;
+    }
+
+    bool have_size = false;
+    jpeg->restart_interval = 0;
+    jpeg->qtables_len = 0;
+    size_t i = 2;
+    while (i + 4 <= len)
+    {
+        if (buf[i] != 0xff)
+        {
+            return false;
+        }
+        uint8_t marker = buf[i + 1];
+        size_t seg_len = (buf[i + 2] << 8) | buf[i + 3];
+        const uint8_t *seg = buf + i + 4;
+        if (seg_len < 2 || i + 2 + seg_len > len)
+        {
+            return false;
+        }
+
+        switch (marker)
+        {
+        case 0xdb: // DQT, possibly more than one table
+            for (size_t j = 0; j + 65 <= seg_len - 2; j += 65)
+            {
+                int table = seg[j] & 0x0f;
+                if ((seg[j] >> 4) != 0 || table > 1)
+                {
+                    return false;
+                }
+                memcpy(jpeg->qtables + 64 * table, seg + j + 1, 64);
+                jpeg->qtables_len = std::max(jpeg->qtables_len, (size_t)(64 * (table + 1)));
+            }
+            break;
+        case 0xc0: // SOF0
+        {
+            int height = (seg[1] << 8) | seg[2];
+            int width = (seg[3] << 8) | seg[4];
+            if (width > 2040 || height > 2040 || seg[5] != 3)
+            {
+                return false;
+            }
+            if (seg[7] == 0x21)
+            {
+                jpeg->type = 0;
+            }
+            else if (seg[7] == 0x22)
+            {
+                jpeg->type = 1;
+            }
+            else
+            {
+                return false;
+            }
+            jpeg->width = (width + 7) / 8;
+            jpeg->height = (height + 7) / 8;
+            have_size = true;
+            break;
+        }
+        case 0xc1: case 0xc2: case 0xc3: case 0xc5: case 0xc6: case 0xc7:
+        case 0xc9: case 0xca: case 0xcb: case 0xcd: case 0xce: case 0xcf:
+            return false;
+        case 0xdd: // DRI
+            jpeg->restart_interval = (seg[0] << 8) | seg[1];
+            break;
+        case 0xda: // SOS, the scan runs to the EOI at the end
+        {
+            jpeg->scan = buf + i + 2 + seg_len;
+            size_t end = len;
+            while (end > 2 && !(buf[end - 2] == 0xff && buf[end - 1] == 0xd9))
+            {
+                --end;
+            }
+            if (end <= 2 || buf + end - 2 < jpeg->scan)
+            {
+                return false;
+            }
+            jpeg->scan_len = buf + end - 2 - jpeg->scan;
+            return have_size && jpeg->qtables_len > 0;
+        }
+        default:
+            break;
+        }
+        i += 2 + seg_len;
+    }
+    return false;
+}
+
+// RTP and JPEG headers for the packet carrying scan bytes offset .. offset + len
+// The length format_packet_header gives for a packet at offset, without the interleave prefix
+static size_t packet_header_len(const rtsp_jpeg *jpeg, size_t offset)
+{
+    return 20 + (jpeg->restart_interval != 0 ? 4 : 0) + (offset == 0 ? 4 + jpeg->qtables_len : 0);
+}
+
+static size_t format_packet_header(uint8_t *p, const rtsp_session *s, uint16_t seq, size_t offset, size_t len)
+{
+    const rtsp_jpeg *jpeg = s->jpeg;
+    p[0] = 0x80;
+    p[1] = 26 | (offset + len == jpeg->scan_len ? 0x80 : 0);
+    set16(p + 2, seq);
+    set32(p + 4, s->timestamp);
+    set32(p + 8, s->ssrc);
+
+    p[12] = 0;
+    p[13] = offset >> 16;
+    p[14] = offset >> 8;
+    p[15] = offset;
+    p[16] = jpeg->type | (jpeg->restart_interval != 0 ? 64 : 0);
+    p[17] = 255; // tables are sent in the first packet
+    p[18] = jpeg->width;
+    p[19] = jpeg->height;
+    size_t n = 20;
+
+    if (jpeg->restart_interval != 0)
+    {
+        // packets are not lined up with restart intervals
+        set16(p + n, jpeg->restart_interval);
+        set16(p + n + 2, 0xffff);
+        n += 4;
+    }
+
+    if (offset == 0)
+    {
+        p[n] = 0;
+        p[n + 1] = 0;
+        set16(p + n + 2, jpeg->qtables_len);
+        memcpy(p + n + 4, jpeg->qtables, jpeg->qtables_len);
+        n += 4 + jpeg->qtables_len;
+    }
+    return n;
+}
+
+// On an interleaved connection the whole frame is one iovec list of packet headers and slices
+// of the scan data, sent the same way as a stream part
+static void start_tcp_frame(rtsp_session *s)
+{
+    const rtsp_jpeg *jpeg = s->jpeg;
+    uint8_t *header = s->headers;
+    int n = 0;
+    size_t pending = 0;
+    for (size_t offset = 0; offset < jpeg->scan_len && n < 2 * RTSP_MAX_TCP_PACKETS; offset += RTSP_TCP_PAYLOAD)
+    {
+        size_t len = std::min(jpeg->scan_len - offset, (size_t)RTSP_TCP_PAYLOAD);
+        size_t header_len = format_packet_header(header + 4, s, s->seq++, offset, len);
+        header[0] = '$';
+        header[1] = s->channel;
+        set16(header + 2, header_len + len);
+
+        s->iov[n].iov_base = header;
+        s->iov[n++].iov_len = 4 + header_len;
+        s->iov[n].iov_base = const_cast<uint8_t *>(jpeg->scan + offset);
+        s->iov[n++].iov_len = len;
+        pending += 4 + header_len + len;
+        header += 4 + header_len;
+    }
+    s->next = s->iov;
+    s->iovcnt = n;
+    s->pending = pending;
+}
+
+static void start_reply(rtsp_session *s)
+{
+    s->iov[0].iov_base = s->reply + s->reply_start;
+    s->iov[0].iov_len = s->reply_len - s->reply_start;
+    s->next = s->iov;
+    s->iovcnt = 1;
+    s->pending = s->iov[0].iov_len;
+    s->reply_start = s->reply_len;
+    s->replying = true;
+}
+
+static void start_frame(rtsp_session *s, capture_frame *frame, const rtsp_jpeg *jpeg)
+{
+    capture_frame_ref(frame);
+    s->frame = frame;
+    s->jpeg = jpeg;
+    s->timestamp = (uint32_t)(frame->timestamp * 9 / 100); // 90kHz clock
+    s->offset = 0;
+    s->part_start = esp_timer_get_time();
+    if (s->tcp)
+    {
+        start_tcp_frame(s);
+    }
+    else
+    {
+        s->pending = jpeg->scan_len;
+    }
+}
+
+static void detach_frame(rtsp_session *s)
+{
+    auto *copy = static_cast<uint8_t *>(heap_caps_malloc(s->pending, MALLOC_CAP_SPIRAM));
+    if (copy == nullptr)
+    {
+        return;
+    }
+
+    size_t offset = 0;
+    for (int i = 0; i < s->iovcnt; ++i)
+    {
+        memcpy(copy + offset, s->next[i].iov_base, s->next[i].iov_len);
+        offset += s->next[i].iov_len;
+    }
+
+    s->detached = copy;
+    s->iov[0].iov_base = copy;
+    s->iov[0].iov_len = s->pending;
+    s->next = s->iov;
+    s->iovcnt = 1;
+    capture_frame_unref(s->frame);
+    s->frame = nullptr;
+}
+
+static void drop_frame(rtsp_session *s)
+{
+    if (s->frame != nullptr)
+    {
+        capture_frame_unref(s->frame);
+        s->frame = nullptr;
+    }
+    free(s->detached);
+    s->detached = nullptr;
+    s->pending = 0;
+    s->blocked = false;
+}
+
+static void finish_part(rtsp_session *s)
+{
+    if (!s->replying)
+    {
+        ++s->sent;
+    }
+    s->replying = false;
+    drop_frame(s);
+
+    if (s->reply_start < s->reply_len)
+    {
+        start_reply(s);
+    }
+    else
+    {
+        s->reply_start = 0;
+        s->reply_len = 0;
+    }
+}
+
+// Sends RTP packets to the client's port until the frame is done or lwip runs out of buffers.
+// Returns the scan bytes sent or -1 on error.
+static int send_udp(rtsp_session *s)
+{
+    static uint8_t header[RTSP_PACKET_HEADER_MAX + RTSP_QTABLE_HEADER_MAX];
+    size_t start = s->offset;
+
+    while (s->offset < s->jpeg->scan_len)
+    {
+        // the first packet carries the quantization tables so has that much less room for data
+        size_t room = RTSP_UDP_PACKET - packet_header_len(s->jpeg, s->offset);
+        size_t len = std::min(s->jpeg->scan_len - s->offset, room);
+        size_t header_len = format_packet_header(header, s, s->seq, s->offset, len);
+
+        struct iovec iov[2];
+        iov[0].iov_base = header;
+        iov[0].iov_len = header_len;
+        iov[1].iov_base = const_cast<uint8_t *>(s->jpeg->scan + s->offset);
+        iov[1].iov_len = len;
+        struct msghdr msg{};
+        msg.msg_name = &s->dest;
+        msg.msg_namelen = sizeof(s->dest);
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2;
+        if (sendmsg(udp_fd, &msg, MSG_DONTWAIT) < 0)
+        {
+            if (errno == ENOMEM || errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            return -1;
+        }
+        ++s->seq;
+        s->offset += len;
+    }
+    return s->offset - start;
+}
+
+// Pushes as much of every pending frame as the sockets will take without blocking.
+// Returns true if some session could not take all of its frame.
+static bool pump()
+{
+    bool blocked = false;
+    int64_t now = esp_timer_get_time();
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (int i = 0; i < RTSP_MAX_SESSIONS; ++i)
+    {
+        rtsp_session *s = sessions[i];
+        if (s == nullptr || s->pending == 0 || s->closing)
+        {
+            continue;
+        }
+
+        int len = s->tcp ? socket_sendv_some(s->fd, &s->next, &s->iovcnt) : send_udp(s);
+        if (len < 0)
+        {
+            ESP_LOGI(TAG, "Send err %d, closing %d", errno, s->fd);
+            drop_frame(s);
+            s->closing = true;
+            // wakes the control task which closes the connection
+            shutdown(s->fd, SHUT_RDWR);
+            continue;
+        }
+
+        s->pending -= len;
+        if (s->pending == 0)
+        {
+            finish_part(s);
+            continue;
+        }
+
+        s->blocked = true;
+        blocked = true;
+        if (s->tcp && s->frame != nullptr && now - s->part_start > RTSP_DETACH_US)
+        {
+            detach_frame(s);
+        }
+    }
+    xSemaphoreGive(mutex);
+
+    return blocked;
+}
+
+static void wait_writable()
+{
+    fd_set writable;
+    FD_ZERO(&writable);
+    int max_fd = -1;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (int i = 0; i < RTSP_MAX_SESSIONS; ++i)
+    {
+        if (sessions[i] != nullptr && sessions[i]->blocked && sessions[i]->tcp)
+        {
+            FD_SET(sessions[i]->fd, &writable);
+            max_fd = std::max(max_fd, sessions[i]->fd);
+        }
+    }
+    xSemaphoreGive(mutex);
+
+    if (max_fd < 0)
+    {
+        // only UDP sessions waiting for lwip to free some buffers
+        vTaskDelay(pdMS_TO_TICKS(RTSP_RETRY_MS));
+        return;
+    }
+
+    struct timeval tv{};
+    tv.tv_usec = RTSP_RETRY_MS * 1000;
+    select(max_fd + 1, nullptr, &writable, nullptr, &tv);
+}
+
+static void send_task(void *)
+{
+    bool blocked = false;
+    for (;;)
+    {
+        if (blocked)
+        {
+            if (ulTaskNotifyTake(pdTRUE, 0) == 0)
+            {
+                wait_writable();
+            }
+        }
+        else
+        {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+
+        blocked = pump();
+    }
+}
+
+// Runs on the capture task
+static void on_frame(capture_frame *frame, void *)
+{
+    // nobody can be using this slot's entry, the last frame in the slot has been released
+    rtsp_jpeg *jpeg = &jpegs[frame->index];
+    bool parsed = false;
+    bool started = false;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (int i = 0; i < RTSP_MAX_SESSIONS; ++i)
+    {
+        rtsp_session *s = sessions[i];
+        if (s == nullptr || !s->playing || s->closing)
+        {
+            continue;
+        }
+
+        if (s->pending != 0)
+        {
+            ++s->dropped;
+            continue;
+        }
+
+        if (!parsed)
+        {
+            parsed = true;
+            if (!parse_jpeg(frame->buf, frame->len, jpeg))
+            {
+                ESP_LOGE(TAG, "frame %lu can not be sent as RTP/JPEG", frame->seq);
+                break;
+            }
+        }
+        start_frame(s, frame, jpeg);
+        started = true;
+    }
+    xSemaphoreGive(mutex);
+
+    if (started)
+    {
+        xTaskNotifyGive(task);
+    }
+}
+
+// Called with the mutex held. Small enough to go straight out unless a frame is on its way on the
+// same connection.
+static void send_reply(rtsp_session *s, const char *reply, size_t len)
+{
+    if (!s->tcp || s->pending == 0)
+    {
+        struct iovec iov{};
+        iov.iov_base = const_cast<char *>(reply);
+        iov.iov_len = len;
+        if (socket_sendv_all(s->fd, &iov, 1) != ESP_OK)
+        {
+            s->closing = true;
+        }
+        return;
+    }
+
+    if (s->reply_len + len > sizeof(s->reply))
+    {
+        ESP_LOGE(TAG, "no room for reply on %d", s->fd);
+        return;
+    }
+    memcpy(s->reply + s->reply_len, reply, len);
+    s->reply_len += len;
+}
+
+static void reply(rtsp_session *s, const char *status, const char *cseq, const char *headers, const char *body)
+{
+    char buf[RTSP_REPLY_MAX];
+    size_t len = snprintf(buf, sizeof(buf), "RTSP/1.0 %s\r\nCSeq: %s\r\nServer: esp32_cam\r\n%s", status, cseq, headers);
+    if (body != nullptr)
+    {
+        len += snprintf(buf + len, sizeof(buf) - len, "Content-Length: %u\r\n\r\n%s", strlen(body), body);
+    }
+    else
+    {
+        len += snprintf(buf + len, sizeof(buf) - len, "\r\n");
+    }
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    send_reply(s, buf, std::min(len, sizeof(buf) - 1));
+    xSemaphoreGive(mutex);
+}
+
+static bool get_header(const char *request, const char *name, char *value, size_t size)
+{
+    size_t name_len = strlen(name);
+    for (const char *line = strstr(request, "\r\n"); line != nullptr; line = strstr(line, "\r\n"))
+    {
+        line += 2;
+        if (strncasecmp(line, name, name_len) == 0 && line[name_len] == ':')
+        {
+            const char *v = line + name_len + 1;
+            while (*v == ' ')
+            {
+                ++v;
+            }
+            size_t n = std::min(strcspn(v, "\r\n"), size - 1);
+            memcpy(value, v, n);
+            value[n] = '\0';
+            return true;
+        }
+    }
+    return false;
+}
+
+static void handle_setup(rtsp_session *s, const char *request, const char *cseq)
+{
+    char transport[128];
+    if (!get_header(request, "Transport", transport, sizeof(transport)))
+    {
+        reply(s, "400 Bad Request", cseq, "", nullptr);
+        return;
+    }
+
+    char headers[256];
+    const char *p;
+    if (strstr(transport, "RTP/AVP/TCP") != nullptr)
+    {
+        int channel = 0;
+        if ((p = strstr(transport, "interleaved=")) != nullptr)
+        {
+            channel = atoi(p + strlen("interleaved="));
+        }
+        s->tcp = true;
+        s->channel = channel;
+        snprintf(headers, sizeof(headers), "Transport: RTP/AVP/TCP;unicast;interleaved=%d-%d;ssrc=%08lX\r\nSession: %08lX;timeout=%d\r\n",
+            channel, channel + 1, s->ssrc, s->id, RTSP_TIMEOUT_S);
+    }
+    else if ((p = strstr(transport, "client_port=")) != nullptr && strstr(transport, "multicast") == nullptr)
+    {
+        int port = atoi(p + strlen("client_port="));
+        socklen_t addr_len = sizeof(s->dest);
+        getpeername(s->fd, reinterpret_cast<struct sockaddr *>(&s->dest), &addr_len);
+        s->dest.sin_port = htons(port);
+        s->tcp = false;
+        snprintf(headers, sizeof(headers), "Transport: RTP/AVP;unicast;client_port=%d-%d;server_port=%d-%d;ssrc=%08lX\r\nSession: %08lX;timeout=%d\r\n",
+            port, port + 1, RTSP_RTP_PORT, RTSP_RTP_PORT + 1, s->ssrc, s->id, RTSP_TIMEOUT_S);
+    }
+    else
+    {
+        reply(s, "461 Unsupported Transport", cseq, "", nullptr);
+        return;
+    }
+
+    reply(s, "200 OK", cseq, headers, nullptr);
+}
+
+static void handle_request(rtsp_session *s, const char *request)
+{
+    char method[16];
+    char url[128];
+    if (sscanf(request, "%15s %127s", method, url) != 2)
+    {
+        reply(s, "400 Bad Request", "0", "", nullptr);
+        return;
+    }
+    char cseq[16] = "0";
+    get_header(request, "CSeq", cseq, sizeof(cseq));
+    s->last_request = esp_timer_get_time();
+    ESP_LOGI(TAG, "%d: %s %s", s->fd, method, url);
+
+    char headers[256];
+    if (strcmp(method, "OPTIONS") == 0)
+    {
+        reply(s, "200 OK", cseq, "Public: OPTIONS, DESCRIBE, SETUP, PLAY, TEARDOWN, GET_PARAMETER\r\n", nullptr);
+    }
+    else if (strcmp(method, "DESCRIBE") == 0)
+    {
+        struct sockaddr_in local{};
+        socklen_t addr_len = sizeof(local);
+        getsockname(s->fd, reinterpret_cast<struct sockaddr *>(&local), &addr_len);
+        char ip[16];
+        inet_ntop(AF_INET, &local.sin_addr, ip, sizeof(ip));
+
+        char sdp[384];
+        snprintf(sdp, sizeof(sdp),
+            "v=0\r\no=- %lu 1 IN IP4 %s\r\ns=%s\r\nc=IN IP4 0.0.0.0\r\nt=0 0\r\na=control:*\r\n"
+            "m=video 0 RTP/AVP 26\r\na=control:track0\r\n",
+            s->id, ip, camera_name[0] != '\0' ? camera_name : "esp32_cam");
+        snprintf(headers, sizeof(headers), "Content-Type: application/sdp\r\nContent-Base: %s/\r\n", url);
+        reply(s, "200 OK", cseq, headers, sdp);
+    }
+    else if (strcmp(method, "SETUP") == 0)
+    {
+        handle_setup(s, request, cseq);
+    }
+    else if (strcmp(method, "PLAY") == 0)
+    {
+        snprintf(headers, sizeof(headers), "Session: %08lX\r\nRange: npt=0.000-\r\n", s->id);
+        reply(s, "200 OK", cseq, headers, nullptr);
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        bool start = !s->playing;
+        s->playing = true;
+        xSemaphoreGive(mutex);
+        if (start)
+        {
+            capture_acquire();
+        }
+    }
+    else if (strcmp(method, "TEARDOWN") == 0)
+    {
+        snprintf(headers, sizeof(headers), "Session: %08lX\r\n", s->id);
+        reply(s, "200 OK", cseq, headers, nullptr);
+        s->closing = true;
+    }
+    else if (strcmp(method, "GET_PARAMETER") == 0)
+    {
+        snprintf(headers, sizeof(headers), "Session: %08lX\r\n", s->id);
+        reply(s, "200 OK", cseq, headers, nullptr);
+    }
+    else
+    {
+        reply(s, "501 Not Implemented", cseq, "", nullptr);
+    }
+}
+
+// Works through whatever has arrived on the connection. Interleaved RTCP from the client is
+// skipped, anything else is a request.
+static void process_input(rtsp_session *s)
+{
+    for (;;)
+    {
+        if (s->request_len >= 4 && s->request[0] == '$')
+        {
+            size_t len = 4 + (((uint8_t)s->request[2] << 8) | (uint8_t)s->request[3]);
+            if (len > sizeof(s->request))
+            {
+                s->closing = true;
+                return;
+            }
+            if (s->request_len < len)
+            {
+                return;
+            }
+            memmove(s->request, s->request + len, s->request_len - len);
+            s->request_len -= len;
+            continue;
+        }
+
+        char *end = static_cast<char *>(memmem(s->request, s->request_len, "\r\n\r\n", 4));
+        if (end == nullptr)
+        {
+            if (s->request_len == sizeof(s->request))
+            {
+                ESP_LOGI(TAG, "request too long on %d", s->fd);
+                s->closing = true;
+            }
+            return;
+        }
+
+        size_t len = end + 4 - s->request;
+        char request[RTSP_REQUEST_MAX + 1];
+        memcpy(request, s->request, len);
+        request[len] = '\0';
+
+        char content_length[12];
+        if (get_header(request, "Content-Length", content_length, sizeof(content_length)))
+        {
+            len += atoi(content_length);
+            if (len > sizeof(s->request))
+            {
+                s->closing = true;
+                return;
+            }
+            if (s->request_len < len)
+            {
+                return;
+            }
+        }
+
+        memmove(s->request, s->request + len, s->request_len - len);
+        s->request_len -= len;
+        handle_request(s, request);
+    }
+}
+
+static void close_session(int index)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    rtsp_session *s = sessions[index];
+    sessions[index] = nullptr;
+    xSemaphoreGive(mutex);
+
+    ESP_LOGI(TAG, "closing session %d, sent %u dropped %u", s->fd, s->sent, s->dropped);
+    drop_frame(s);
+    if (s->playing)
+    {
+        capture_release();
+    }
+    close(s->fd);
+    free(s);
+}
+
+static void accept_session(int listen_fd)
+{
+    int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    auto *s = static_cast<rtsp_session *>(heap_caps_calloc(1, sizeof(rtsp_session), MALLOC_CAP_SPIRAM));
+    if (s == nullptr)
+    {
+        close(fd);
+        return;
+    }
+    s->fd = fd;
+    s->id = esp_random();
+    s->ssrc = esp_random();
+    s->seq = esp_random();
+    s->last_request = esp_timer_get_time();
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    bool added = false;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (int i = 0; i < RTSP_MAX_SESSIONS; ++i)
+    {
+        if (sessions[i] == nullptr)
+        {
+            sessions[i] = s;
+            added = true;
+            break;
+        }
+    }
+    xSemaphoreGive(mutex);
+
+    if (!added)
+    {
+        ESP_LOGI(TAG, "no free session for %d", fd);
+        close(fd);
+        free(s);
+        return;
+    }
+    ESP_LOGI(TAG, "session on %d", fd);
+}
+
+// Accepts connections and handles requests, the RTP goes out on the send task
+static void control_task(void *arg)
+{
+    int listen_fd = (int)(intptr_t)arg;
+    for (;;)
+    {
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(listen_fd, &readable);
+        int max_fd = listen_fd;
+        int64_t now = esp_timer_get_time();
+
+        for (int i = 0; i < RTSP_MAX_SESSIONS; ++i)
+        {
+            rtsp_session *s = sessions[i];
+            if (s == nullptr)
+            {
+                continue;
+            }
+            if (s->closing || (!s->tcp && now - s->last_request > RTSP_TIMEOUT_S * 1000000ll))
+            {
+                close_session(i);
+                continue;
+            }
+            FD_SET(s->fd, &readable);
+            max_fd = std::max(max_fd, s->fd);
+        }
+
+        struct timeval tv{};
+        tv.tv_sec = 1;
+        if (select(max_fd + 1, &readable, nullptr, nullptr, &tv) <= 0)
+        {
+            continue;
+        }
+
+        if (FD_ISSET(listen_fd, &readable))
+        {
+            accept_session(listen_fd);
+        }
+
+        // only this task adds or removes sessions so they can be looked at without the lock
+        for (int i = 0; i < RTSP_MAX_SESSIONS; ++i)
+        {
+            rtsp_session *s = sessions[i];
+            if (s == nullptr || !FD_ISSET(s->fd, &readable))
+            {
+                continue;
+            }
+
+            int len = recv(s->fd, s->request + s->request_len, sizeof(s->request) - s->request_len, 0);
+            if (len <= 0)
+            {
+                s->closing = true;
+                continue;
+            }
+            s->request_len += len;
+            process_input(s);
+        }
+    }
+}
+
+void rtsp_print_info(int (*printfn)(const char *format, ...))
+{
+    if (mutex == nullptr)
+    {
+        return;
+    }
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (int i = 0; i < RTSP_MAX_SESSIONS; ++i)
+    {
+        const rtsp_session *s = sessions[i];
+        if (s != nullptr)
+        {
+            printfn("RTSP: fd %d %s %s sent %u dropped %u\n", s->fd, s->tcp ? "tcp" : "udp", s->playing ? "playing" : "idle", s->sent, s->dropped);
+        }
+    }
+    xSemaphoreGive(mutex);
+}
+
+esp_err_t rtsp_init()
+{
+    mutex = xSemaphoreCreateMutex();
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (listen_fd < 0 || udp_fd < 0)
+    {
+        ESP_LOGE(TAG, "failed to create sockets");
+        return ESP_FAIL;
+    }
+
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(RTSP_PORT);
+    if (bind(listen_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 || listen(listen_fd, 2) != 0)
+    {
+        ESP_LOGE(TAG, "failed to listen on port %d", RTSP_PORT);
+        return ESP_FAIL;
+    }
+    addr.sin_port = htons(RTSP_RTP_PORT);
+    bind(udp_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+
+    if (xTaskCreatePinnedToCore(send_task, "rtsp_send", 4096, nullptr, 5, &task, RTSP_TASK_CORE) != pdPASS)
+    {
+        ESP_LOGE(TAG, "failed to create send task");
+        return ESP_FAIL;
+    }
+    if (xTaskCreatePinnedToCore(control_task, "rtsp", 6144, (void *)(intptr_t)listen_fd, 4, nullptr, 0) != pdPASS)
+    {
+        ESP_LOGE(TAG, "failed to create control task");
+        return ESP_FAIL;
+    }
+    if (!capture_add_consumer(on_frame, nullptr))
+    {
+        ESP_LOGE(TAG, "failed to add capture consumer");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
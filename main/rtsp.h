@@ -0,0 +1,10 @@
+#pragma once
+
+#include "esp_err.h"
+
+#define RTSP_MAX_SESSIONS 4
+// lwip sockets RTSP can have open at once: the listener, the UDP socket for RTP and a connection a session
+#define RTSP_SOCKETS (2 + RTSP_MAX_SESSIONS)
+
+esp_err_t rtsp_init();
+void rtsp_print_info(int (*printfn)(const char *format, ...));
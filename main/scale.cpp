@@ -0,0 +1,123 @@
+#include <esp_log.h>
+#include "scale.h"
+#include "esp_jpg_decode.h"
+#include "img_converters.h"
+
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+
+#define TAG "scale"
+
+struct scale_decoder
+{
+    const uint8_t *input;
+    uint8_t *output;
+    size_t output_size;
+    uint16_t width;
+    uint16_t height;
+};
+
+// Decoded pixels of the reduced image, kept between frames and only grown when the frame size goes up
+static uint8_t *scratch = nullptr;
+static size_t scratch_size = 0;
+
+static size_t read_jpeg(void *arg, size_t index, uint8_t *buf, size_t len)
+{
+    scale_decoder *dec = static_cast<scale_decoder *>(arg);
+    if (buf != nullptr)
+    {
+        memcpy(buf, dec->input + index, len);
+    }
+    return len;
+}
+
+static bool write_pixels(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data)
+{
+    scale_decoder *dec = static_cast<scale_decoder *>(arg);
+    if (data == nullptr)
+    {
+        // called with no data at the start, with the output size, and at the end
+        if (x == 0 && y == 0)
+        {
+            size_t needed = (size_t)w * h * 3;
+            if (needed > scratch_size)
+            {
+                heap_caps_free(scratch);
+                scratch = static_cast<uint8_t *>(heap_caps_malloc(needed, MALLOC_CAP_SPIRAM));
+                scratch_size = scratch != nullptr ? needed : 0;
+                if (scratch == nullptr)
+                {
+                    ESP_LOGE(TAG, "no memory for %ux%u scaled image", w, h);
+                    return false;
+                }
+            }
+            dec->width = w;
+            dec->height = h;
+            dec->output = scratch;
+        }
+        return true;
+    }
+
+    // the encoder wants RGB888 stored as BGR
+    size_t stride = (size_t)dec->width * 3;
+    for (uint16_t iy = 0; iy < h; ++iy)
+    {
+        uint8_t *o = dec->output + (y + iy) * stride + x * 3;
+        for (uint16_t ix = 0; ix < w; ++ix)
+        {
+            o[0] = data[2];
+            o[1] = data[1];
+            o[2] = data[0];
+            o += 3;
+            data += 3;
+        }
+    }
+    return true;
+}
+
+bufpool_buf *scale_jpeg(const uint8_t *jpg, size_t len, int scale, uint8_t quality)
+{
+    int64_t start = esp_timer_get_time();
+
+    scale_decoder dec{};
+    dec.input = jpg;
+    esp_err_t err = esp_jpg_decode(len, static_cast<jpg_scale_t>(scale), read_jpeg, write_pixels, &dec);
+    if (err != ESP_OK || dec.output == nullptr)
+    {
+        ESP_LOGE(TAG, "decode at 1/%d failed %d", 1 << scale, err);
+        return nullptr;
+    }
+
+    int64_t decoded = esp_timer_get_time();
+
+    bufpool_buf *buf = bufpool_get();
+    if (buf == nullptr)
+    {
+        return nullptr;
+    }
+
+    if (!fmt2jpg_cb(dec.output, (size_t)dec.width * dec.height * 3, dec.width, dec.height, PIXFORMAT_RGB888, quality, bufpool_append, buf))
+    {
+        ESP_LOGE(TAG, "encode of %ux%u failed", dec.width, dec.height);
+        bufpool_put(buf);
+        return nullptr;
+    }
+
+    int64_t end = esp_timer_get_time();
+    ESP_LOGD(TAG, "1/%d: %u -> %u bytes %ux%u decode %lldus encode %lldus", 1 << scale, len, buf->len, dec.width, dec.height, decoded - start, end - decoded);
+    return buf;
+}
+
+bool scale_parse(const char *param, int *scale)
+{
+    static const char *names[] = { "1", "1/2", "1/4", "1/8" };
+    for (int i = 0; i <= SCALE_MAX; ++i)
+    {
+        if (strcmp(param, names[i]) == 0)
+        {
+            *scale = i;
+            return true;
+        }
+    }
+    return false;
+}
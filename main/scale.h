@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bufpool.h"
+
+// Downscaled copies of a jpeg frame for low resolution substreams. The decoder works at the
+// reduced size in the DCT domain (only the DC term at 1/8) so no full size image is produced,
+// only the small image is re-encoded.
+// scale is a power of two shift: 1 = 1/2, 2 = 1/4, 3 = 1/8
+#define SCALE_MAX 3
+
+extern bufpool_buf *scale_jpeg(const uint8_t *jpg, size_t len, int scale, uint8_t quality);
+extern bool scale_parse(const char *param, int *scale);
@@ -0,0 +1,247 @@
+#include <esp_log.h>
+#include "lwip/sockets.h"
+#include "session.h"
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/timers.h"
+
+#define TAG "session"
+
+#define SESSION_CHECK_MS 1000
+
+// Raise CONFIG_LWIP_MAX_SOCKETS rather than let httpd take sockets RTSP is counting on
+static_assert(SESSION_MAX_OPEN + 3 + RTSP_SOCKETS <= CONFIG_LWIP_MAX_SOCKETS, "httpd and RTSP need more sockets than lwip has");
+static_assert(SESSION_MAX_OPEN > SESSION_STREAM_RESERVE, "no sockets left for short requests after the stream reserve");
+
+struct session
+{
+    httpd_handle_t hd;
+    int fd;             // -1 for a free slot
+    int holds;
+    bool in_request;
+    unsigned int requests;
+    int64_t last_active;
+};
+
+static SemaphoreHandle_t mutex = nullptr;
+static session sessions[SESSION_MAX_OPEN];
+static unsigned int n_requests;
+static unsigned int n_reused;       // requests on a connection which had already had one
+static unsigned int n_idle_closed;
+static unsigned int n_budget_closed;
+
+static session *find(int fd)
+{
+    for (int i = 0; i < SESSION_MAX_OPEN; ++i)
+    {
+        if (sessions[i].fd == fd)
+        {
+            return &sessions[i];
+        }
+    }
+    return nullptr;
+}
+
+static bool closable(const session &s)
+{
+    return s.fd >= 0 && s.holds == 0 && !s.in_request;
+}
+
+// Keeps a free socket for the next client as well as the reserve for streams, so httpd's own
+// least recently used purge, which could pick a stream, is left for when every socket is held
+esp_err_t session_open(httpd_handle_t hd, int fd)
+{
+    // httpd sends the headers and the body separately, and on a kept connection the body would
+    // otherwise wait for the client's delayed ack of the headers
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    int victim = -1;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    session *s = find(-1);
+    if (s != nullptr)
+    {
+        *s = session{ hd, fd, 0, false, 0, esp_timer_get_time() };
+    }
+
+    int n_open = 0;
+    int n_short = 0;
+    session *idlest = nullptr;
+    for (int i = 0; i < SESSION_MAX_OPEN; ++i)
+    {
+        const session &o = sessions[i];
+        if (o.fd < 0)
+        {
+            continue;
+        }
+        ++n_open;
+        if (o.holds == 0)
+        {
+            ++n_short;
+        }
+        if (o.fd != fd && closable(o) && (idlest == nullptr || o.last_active < idlest->last_active))
+        {
+            idlest = &sessions[i];
+        }
+    }
+    if (idlest != nullptr && (n_open >= SESSION_MAX_OPEN || n_short > SESSION_MAX_OPEN - SESSION_STREAM_RESERVE))
+    {
+        victim = idlest->fd;
+        // not free until close_fn comes round but it will not be picked twice
+        idlest->holds = 1;
+        ++n_budget_closed;
+    }
+    xSemaphoreGive(mutex);
+
+    if (victim >= 0)
+    {
+        ESP_LOGI(TAG, "closing idle %d to make room for %d", victim, fd);
+        httpd_sess_trigger_close(hd, victim);
+    }
+    return ESP_OK;
+}
+
+void session_closed(int fd)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    session *s = find(fd);
+    if (s != nullptr)
+    {
+        s->fd = -1;
+    }
+    xSemaphoreGive(mutex);
+}
+
+void session_hold(int fd)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    session *s = find(fd);
+    if (s != nullptr)
+    {
+        ++s->holds;
+    }
+    xSemaphoreGive(mutex);
+}
+
+void session_release(int fd)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    session *s = find(fd);
+    if (s != nullptr && s->holds > 0)
+    {
+        --s->holds;
+        s->last_active = esp_timer_get_time();
+    }
+    xSemaphoreGive(mutex);
+}
+
+static esp_err_t dispatch(httpd_req_t *req)
+{
+    int fd = httpd_req_to_sockfd(req);
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    session *s = find(fd);
+    if (s != nullptr)
+    {
+        s->in_request = true;
+        ++n_requests;
+        if (s->requests++ > 0)
+        {
+            ++n_reused;
+        }
+    }
+    xSemaphoreGive(mutex);
+
+    auto handler = reinterpret_cast<esp_err_t (*)(httpd_req_t *)>(req->user_ctx);
+    esp_err_t res = handler(req);
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    s = find(fd);
+    if (s != nullptr)
+    {
+        s->in_request = false;
+        s->last_active = esp_timer_get_time();
+    }
+    xSemaphoreGive(mutex);
+    return res;
+}
+
+esp_err_t session_register_uri_handler(httpd_handle_t hd, httpd_uri_t *uri)
+{
+    uri->user_ctx = reinterpret_cast<void *>(uri->handler);
+    uri->handler = dispatch;
+    return httpd_register_uri_handler(hd, uri);
+}
+
+static void check_idle(TimerHandle_t)
+{
+    struct
+    {
+        httpd_handle_t hd;
+        int fd;
+    } idle[SESSION_MAX_OPEN];
+    int n_idle = 0;
+    int64_t now = esp_timer_get_time();
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (int i = 0; i < SESSION_MAX_OPEN; ++i)
+    {
+        session &s = sessions[i];
+        if (closable(s) && now - s.last_active > SESSION_IDLE_MS * 1000ll)
+        {
+            idle[n_idle].hd = s.hd;
+            idle[n_idle++].fd = s.fd;
+            s.holds = 1;
+            ++n_idle_closed;
+        }
+    }
+    xSemaphoreGive(mutex);
+
+    for (int i = 0; i < n_idle; ++i)
+    {
+        ESP_LOGD(TAG, "closing idle %d", idle[i].fd);
+        httpd_sess_trigger_close(idle[i].hd, idle[i].fd);
+    }
+}
+
+esp_err_t session_init()
+{
+    mutex = xSemaphoreCreateMutex();
+    for (int i = 0; i < SESSION_MAX_OPEN; ++i)
+    {
+        sessions[i].fd = -1;
+    }
+    auto timer = xTimerCreate("session timer", pdMS_TO_TICKS(SESSION_CHECK_MS), pdTRUE, nullptr, check_idle);
+    if (timer == nullptr || xTimerStart(timer, 0) != pdPASS)
+    {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+void session_print_info(int (*printfn)(const char *format, ...))
+{
+    if (mutex == nullptr)
+    {
+        return;
+    }
+
+    int n_open = 0;
+    int n_held = 0;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (int i = 0; i < SESSION_MAX_OPEN; ++i)
+    {
+        if (sessions[i].fd >= 0)
+        {
+            ++n_open;
+            if (sessions[i].holds > 0)
+            {
+                ++n_held;
+            }
+        }
+    }
+    xSemaphoreGive(mutex);
+    printfn("Sessions: %d open %d held of %d, %u requests %u on kept connections, closed %u idle %u for room\n", n_open, n_held, SESSION_MAX_OPEN,
+            n_requests, n_reused, n_idle_closed, n_budget_closed);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "esp_http_server.h"
+#include "rtsp.h"
+#include "sdkconfig.h"
+
+// Keeps track of the server's connections so they can be kept alive between requests without the
+// short ones crowding out streams. A connection that is idle for SESSION_IDLE_MS is closed, and the
+// short ones together never take more than SESSION_MAX_OPEN - SESSION_STREAM_RESERVE sockets: when a
+// new one would go over, the one idle the longest is closed. A connection carrying a stream, events,
+// a clip or a long poll is held and left alone.
+// httpd keeps three of lwip's sockets for itself and RTSP needs its own
+#define SESSION_MAX_OPEN (CONFIG_LWIP_MAX_SOCKETS - 3 - RTSP_SOCKETS)
+#define SESSION_STREAM_RESERVE 4
+#define SESSION_IDLE_MS 15000
+
+extern esp_err_t session_init();
+
+// As httpd's open_fn, and to be called from its close_fn
+extern esp_err_t session_open(httpd_handle_t hd, int fd);
+extern void session_closed(int fd);
+
+// As httpd_register_uri_handler, with the handler wrapped so the connection's requests are seen.
+// Takes the handler's user_ctx for itself.
+extern esp_err_t session_register_uri_handler(httpd_handle_t hd, httpd_uri_t *uri);
+
+// For a handler that takes the socket over, or answers later. A held connection is not closed
+// for being idle or to make room, until it is released as many times as it was held.
+extern void session_hold(int fd);
+extern void session_release(int fd);
+
+extern void session_print_info(int (*printfn)(const char *format, ...));
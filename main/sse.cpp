@@ -1,9 +1,13 @@
 #include <esp_log.h>
-#include "camera.h"
+#include "capture.h"
 #include "httpd_util.h"
+#include "metrics.h"
 #include "lwip/sockets.h"
+#include "session.h"
 #include "sse.h"
 #include "temp.h"
+#include "trace.h"
+#include <atomic>
 #include <time.h>
 
 #include "freertos/timers.h"
@@ -54,6 +58,7 @@ esp_err_t sse_handler(httpd_req_t *req)
         }
     }
     xSemaphoreGive(mutex);
+    session_hold(aer->fd);
 
     //ESP_LOGI(TAG, "Queuing work fd : %d", aer->fd);
     //res = httpd_queue_work(req->handle, send_next_event, aer);
@@ -97,9 +102,8 @@ static void send_heartbeat(void *data)
         return;
     }
 
-    ESP_LOGI(TAG, "send heartbeat: %d", aer->fd);
-
     auto res = socket_send_chunk(aer->hd, aer->fd, heartbeat_msg, sizeof(heartbeat_msg) - 1);
+    trace(TRACE_SSE_SEND, aer->fd, res == ESP_OK ? sizeof(heartbeat_msg) - 1 : 0);
     if (res != ESP_OK)
     {
         ESP_LOGI(TAG, "send heartbeat failed %d", res);
@@ -107,27 +111,55 @@ static void send_heartbeat(void *data)
     }
 }
 
-static char *current_broadcast = nullptr;
+// An event as it goes out, shared by the work queued for every sink and freed when the last of
+// them has sent it. Broadcasts come from the timers, httpd and the motion task, so each has a
+// message of its own rather than one that the next broadcast would replace under a queued send.
+struct sse_message
+{
+    std::atomic<int> refs;
+    size_t len;
+    char text[];
+};
+
+// What one queued send needs, the sink's slot as it may be gone by the time the work runs
+struct sse_work
+{
+    async_event_resp **sink;
+    sse_message *message;
+};
+
 static int sse_id = 0;
 
+static void message_unref(sse_message *message)
+{
+    if (message->refs.fetch_sub(1) == 1)
+    {
+        free(message);
+    }
+}
+
 static void send_message(void *data)
 {
-    async_event_resp *aer = *static_cast<async_event_resp **>(data);
+    auto *work = static_cast<sse_work *>(data);
+    async_event_resp *aer = *work->sink;
 
     if (aer == nullptr)
     {
-        ESP_LOGI(TAG, "sink %d has been deleted", static_cast<async_event_resp **>(data)-sinks);
-        return;
+        ESP_LOGI(TAG, "sink %d has been deleted", work->sink - sinks);
     }
-
-    ESP_LOGI(TAG, "send message to: %p %d:  on core %d %s", aer, aer->fd, xPortGetCoreID(), current_broadcast);
-
-    auto res = socket_send_chunk(aer->hd, aer->fd, current_broadcast, strlen(current_broadcast));
-    if (res != ESP_OK)
+    else
     {
-        ESP_LOGI(TAG, "send message failed %d", res);
-        sse_remove_sink(aer->fd);
+        auto res = socket_send_chunk(aer->hd, aer->fd, work->message->text, work->message->len);
+        trace(TRACE_SSE_SEND, aer->fd, res == ESP_OK ? work->message->len : 0);
+        if (res != ESP_OK)
+        {
+            ESP_LOGI(TAG, "send message failed %d", res);
+            sse_remove_sink(aer->fd);
+        }
     }
+
+    message_unref(work->message);
+    free(work);
 }
 
 void sse_broadcast(const char *type, const char *data, unsigned int len)
@@ -136,23 +168,46 @@ void sse_broadcast(const char *type, const char *data, unsigned int len)
     const char *msg = "event: %s\nid: %d\ndata: %.*s\n\n";
 
     size_t buflen = strlen(msg) + strlen(type) + len + 12;
-    free(current_broadcast);
-    current_broadcast = (char *)malloc(buflen);
-    ++sse_id;
-    snprintf(current_broadcast, buflen, msg, type, sse_id, len, data);
+    auto *message = static_cast<sse_message *>(malloc(sizeof(sse_message) + buflen));
+    if (message == nullptr)
+    {
+        ESP_LOGE(TAG, "no memory for \"%s\" event", type);
+        return;
+    }
+    // the broadcast holds a reference until every send is queued
+    message->refs.store(1);
+
     xSemaphoreTake(mutex, portMAX_DELAY);
+    message->len = snprintf(message->text, buflen, msg, type, ++sse_id, len, data);
     for (int i = 0; i < CONFIG_LWIP_MAX_SOCKETS; ++i)
     {
         if (sinks[i] != nullptr)
         {
-            esp_err_t res = httpd_queue_work(sinks[i]->hd, send_message, sinks + i);
+            auto *work = static_cast<sse_work *>(malloc(sizeof(sse_work)));
+            esp_err_t res = ESP_ERR_NO_MEM;
+            if (work != nullptr)
+            {
+                work->sink = sinks + i;
+                work->message = message;
+                message->refs.fetch_add(1);
+                res = httpd_queue_work(sinks[i]->hd, send_message, work);
+                if (res != ESP_OK)
+                {
+                    message->refs.fetch_sub(1);
+                    free(work);
+                }
+            }
+            trace(TRACE_QUEUE_WORK, sinks[i]->fd, res);
             if (res != ESP_OK)
             {
                 ESP_LOGI(TAG, "Queuing sse broadcast work failed : %d", res);
+                metrics_sse_queue_failures.fetch_add(1, std::memory_order_relaxed);
+                metrics_httpd_queue_failures.fetch_add(1, std::memory_order_relaxed);
             }
         }
     }
     xSemaphoreGive(mutex);
+    message_unref(message);
 }
 
 static void time_ticker(TimerHandle_t arg)
@@ -162,7 +217,7 @@ static void time_ticker(TimerHandle_t arg)
     struct tm t;
     localtime_r(&now, &t);
     char buf[128];
-    unsigned int frames = camera_get_frame_count(true);
+    unsigned int frames = capture_get_frame_count(true);
 
     float celsius = temp_read();
     if (snprintf(buf, sizeof(buf), "{ \"time\": \"%4d:%02d:%02d-%02d:%02d:%02d\", \"frames\": %u, \"tempc\": %.2g }", 
@@ -181,9 +236,11 @@ static void ticker(TimerHandle_t arg)
         if (sinks[i] != nullptr)
         {
             esp_err_t res = httpd_queue_work(sinks[i]->hd, send_heartbeat, sinks + i);
+            trace(TRACE_QUEUE_WORK, sinks[i]->fd, res);
             if (res != ESP_OK)
             {
                 ESP_LOGI(TAG, "Queuing work failed : %d", res);
+                metrics_httpd_queue_failures.fetch_add(1, std::memory_order_relaxed);
             }
         }
     }
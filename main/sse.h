@@ -5,6 +5,7 @@
 esp_err_t sse_handler(httpd_req_t *req);
 esp_err_t sse_init();
 bool sse_remove_sink(int fd);
+// Copies the event, so may be called from any task and data need not outlive the call
 void sse_broadcast(const char *type, const char *data, unsigned int len);
 
 
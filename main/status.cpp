@@ -16,6 +16,7 @@
 #include <time.h>
 
 #include "ota.h"
+#include "session.h"
 #include "wifi.h"
 
 static const char *TAG = "status";
@@ -156,7 +157,6 @@ static esp_err_t status_handler(httpd_req_t *req)
     if(res != ESP_OK){
         return res;
     }
-    res = httpd_resp_set_hdr(req, "Connection", "close");
 	return httpd_resp_send(req, page_buf, buf_offset);
 }
 
@@ -166,6 +166,6 @@ void status_add_endpoints(httpd_handle_t server)
     status.uri       = "/status";
     status.method    = HTTP_GET;
     status.handler   = status_handler;
-    httpd_register_uri_handler(server, &status);
+    session_register_uri_handler(server, &status);
 }
 
@@ -0,0 +1,425 @@
+#include <atomic>
+#include <esp_log.h>
+#include "capture.h"
+#include "exif.h"
+#include "httpd_util.h"
+#include "session.h"
+#include "still.h"
+
+#include "esp_heap_caps.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#define TAG "still"
+
+// A still younger than this is served again rather than waiting for a new capture, a request
+// can ask for something fresher with ?maxage=ms
+#define STILL_MAX_AGE_MS 1000
+#define STILL_WAIT_MS 2000
+
+#define STILL_FRESH_BIT 1
+
+// Long polls with ?after=seq are parked here until a newer frame turns up, rather than holding
+// up the httpd task. One that waits this long gets a 204 and can ask again.
+#define STILL_MAX_POLLERS 4
+#define STILL_POLL_TIMEOUT_MS 10000
+
+// A copy of a capture frame with its exif header ready to go, shared by every request that
+// comes in while it is fresh. Freed when the last request using it is done.
+struct still_image
+{
+    std::atomic<int> refs;
+    uint32_t seq;
+    int64_t timestamp;
+    char etag[24];
+    size_t jfif_len;        // 0 if the image is sent as it is
+    exif_header exif;
+    size_t len;
+    uint8_t data[];
+};
+
+struct still_poller
+{
+    httpd_req_t *req;       // from httpd_req_async_handler_begin
+    uint32_t after;
+    int64_t deadline;
+};
+
+static SemaphoreHandle_t mutex = nullptr;
+static EventGroupHandle_t events = nullptr;
+static TaskHandle_t poll_task = nullptr;
+static still_image *latest;
+static int waiters;
+static uint32_t boot_id;
+static still_poller pollers[STILL_MAX_POLLERS];
+static int n_pollers;
+static uint32_t last_seq;
+
+static unsigned int n_served;
+static unsigned int n_captured;
+static unsigned int n_not_modified;
+static unsigned int n_polls;
+
+static void still_unref(still_image *image)
+{
+    if (image->refs.fetch_sub(1) == 1)
+    {
+        free(image);
+    }
+}
+
+static still_image *make_image(const capture_frame *frame)
+{
+    auto *image = static_cast<still_image *>(heap_caps_malloc(sizeof(still_image) + frame->len, MALLOC_CAP_SPIRAM));
+    if (image == nullptr)
+    {
+        return nullptr;
+    }
+
+    image->refs.store(1);
+    image->seq = frame->seq;
+    image->timestamp = frame->timestamp;
+    snprintf(image->etag, sizeof(image->etag), "\"%08lx-%lu\"", boot_id, frame->seq);
+    image->len = frame->len;
+    memcpy(image->data, frame->buf, frame->len);
+    image->jfif_len = exif_jfif_len(image->data, image->len);
+    if (image->jfif_len != 0)
+    {
+        exif_fields fields;
+        capture_exif_fields(frame, &fields);
+        exif_init(&image->exif);
+        exif_update(&image->exif, &fields);
+    }
+    return image;
+}
+
+// Runs on the capture task. Frames are only copied while some request is waiting for one, the
+// copy is made outside the lock so requests are not held up by it.
+static void on_frame(capture_frame *frame, void *)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    last_seq = frame->seq;
+    bool wanted = waiters > 0;
+    xSemaphoreGive(mutex);
+    if (!wanted)
+    {
+        return;
+    }
+
+    still_image *image = make_image(frame);
+    if (image == nullptr)
+    {
+        return;
+    }
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    still_image *old = latest;
+    latest = image;
+    ++n_captured;
+    bool polled = n_pollers > 0;
+    xSemaphoreGive(mutex);
+
+    xEventGroupSetBits(events, STILL_FRESH_BIT);
+    if (polled)
+    {
+        xTaskNotifyGive(poll_task);
+    }
+    if (old != nullptr)
+    {
+        still_unref(old);
+    }
+}
+
+// Frames are captured and copied while anyone is waiting for one. Called with the mutex held.
+static void add_waiter()
+{
+    if (waiters++ == 0)
+    {
+        xEventGroupClearBits(events, STILL_FRESH_BIT);
+        capture_acquire();
+    }
+}
+
+static void remove_waiter()
+{
+    if (--waiters == 0)
+    {
+        capture_release();
+    }
+}
+
+// Returns a reference to a still no older than max_age. Requests that arrive together all wait
+// for the same capture.
+static still_image *get_still(int64_t max_age)
+{
+    still_image *image = nullptr;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    if (latest != nullptr && esp_timer_get_time() - latest->timestamp <= max_age)
+    {
+        image = latest;
+        image->refs.fetch_add(1);
+    }
+    else
+    {
+        add_waiter();
+    }
+    xSemaphoreGive(mutex);
+
+    if (image != nullptr)
+    {
+        return image;
+    }
+
+    EventBits_t bits = xEventGroupWaitBits(events, STILL_FRESH_BIT, pdFALSE, pdFALSE, pdMS_TO_TICKS(STILL_WAIT_MS));
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    remove_waiter();
+    if ((bits & STILL_FRESH_BIT) != 0 && latest != nullptr)
+    {
+        image = latest;
+        image->refs.fetch_add(1);
+    }
+    xSemaphoreGive(mutex);
+
+    return image;
+}
+
+static esp_err_t send_image(httpd_req_t *req, const still_image *image)
+{
+    char seq[12];
+    snprintf(seq, sizeof(seq), "%lu", image->seq);
+    auto res = httpd_resp_set_type(req, "image/jpeg");
+    if (res == ESP_OK)
+    {
+        res = httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
+    }
+    if (res == ESP_OK)
+    {
+        // the client may keep it but has to check back, which the etag makes cheap
+        res = httpd_resp_set_hdr(req, "Cache-control", "no-cache");
+    }
+    if (res == ESP_OK)
+    {
+        res = httpd_resp_set_hdr(req, "ETag", image->etag);
+    }
+    if (res == ESP_OK)
+    {
+        res = httpd_resp_set_hdr(req, "X-Frame-Seq", seq);
+    }
+    if (res != ESP_OK)
+    {
+        return res;
+    }
+
+    if (image->jfif_len == 0)
+    {
+        return httpd_resp_send(req, (const char *)image->data, image->len);
+    }
+
+    // the body is sent here rather than by httpd so the jfif header can be swapped for the exif one without a copy
+    res = resp_send_headers(req, image->len + EXIF_HEADER_LEN - image->jfif_len);
+    if (res != ESP_OK)
+    {
+        ESP_LOGI(TAG, "jpeg header send status %d", res);
+        return res;
+    }
+    struct iovec iov[2];
+    iov[0].iov_base = const_cast<uint8_t *>(image->exif.data);
+    iov[0].iov_len = EXIF_HEADER_LEN;
+    iov[1].iov_base = const_cast<uint8_t *>(image->data + image->jfif_len);
+    iov[1].iov_len = image->len - image->jfif_len;
+    return socket_sendv_all(httpd_req_to_sockfd(req), iov, 2);
+}
+
+// Answers a long poll with the latest still, or a 204 if nothing new came in time
+static void finish_poll(const still_poller &poller, still_image *image)
+{
+    esp_err_t res;
+    if (image != nullptr)
+    {
+        ++n_served;
+        res = send_image(poller.req, image);
+        still_unref(image);
+    }
+    else
+    {
+        // the latest sequence number lets a client that asked for one from before a restart catch up
+        char seq[12];
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        snprintf(seq, sizeof(seq), "%lu", last_seq);
+        xSemaphoreGive(mutex);
+        httpd_resp_set_status(poller.req, "204 No Content");
+        httpd_resp_set_hdr(poller.req, "X-Frame-Seq", seq);
+        res = httpd_resp_send(poller.req, nullptr, 0);
+    }
+    ESP_LOGI(TAG, "poll after %lu done - res %d", poller.after, res);
+    session_release(httpd_req_to_sockfd(poller.req));
+    httpd_req_async_handler_complete(poller.req);
+}
+
+static esp_err_t start_poll(httpd_req_t *req, uint32_t after)
+{
+    still_image *image = nullptr;
+    httpd_req_t *async = nullptr;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    ++n_polls;
+    if (latest != nullptr && latest->seq > after)
+    {
+        image = latest;
+        image->refs.fetch_add(1);
+    }
+    else if (n_pollers < STILL_MAX_POLLERS && httpd_req_async_handler_begin(req, &async) == ESP_OK)
+    {
+        still_poller &poller = pollers[n_pollers++];
+        poller.req = async;
+        poller.after = after;
+        poller.deadline = esp_timer_get_time() + STILL_POLL_TIMEOUT_MS * 1000ll;
+        add_waiter();
+        session_hold(httpd_req_to_sockfd(req));
+    }
+    xSemaphoreGive(mutex);
+
+    if (image != nullptr)
+    {
+        ++n_served;
+        esp_err_t res = send_image(req, image);
+        still_unref(image);
+        return res;
+    }
+    if (async == nullptr)
+    {
+        return resp_send_busy(req, "too many waiting");
+    }
+    return ESP_OK;
+}
+
+// Hands newly captured stills to the long polls waiting for them
+static void poll_task_fn(void *)
+{
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+
+        still_poller done[STILL_MAX_POLLERS];
+        still_image *images[STILL_MAX_POLLERS];
+        int n_done = 0;
+        int64_t now = esp_timer_get_time();
+
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        for (int i = 0; i < n_pollers; )
+        {
+            bool ready = latest != nullptr && latest->seq > pollers[i].after;
+            if (!ready && now < pollers[i].deadline)
+            {
+                ++i;
+                continue;
+            }
+
+            images[n_done] = ready ? latest : nullptr;
+            if (ready)
+            {
+                latest->refs.fetch_add(1);
+            }
+            done[n_done++] = pollers[i];
+            pollers[i] = pollers[--n_pollers];
+            remove_waiter();
+        }
+        xSemaphoreGive(mutex);
+
+        for (int i = 0; i < n_done; ++i)
+        {
+            finish_poll(done[i], images[i]);
+        }
+    }
+}
+
+esp_err_t still_handler(httpd_req_t *req)
+{
+    ESP_LOGI(TAG, "still_httpd req: %d", httpd_req_to_sockfd(req));
+    int64_t fr_start = esp_timer_get_time();
+
+    int64_t max_age = STILL_MAX_AGE_MS * 1000ll;
+    bool poll = false;
+    uint32_t after = 0;
+    size_t buf_len = httpd_req_get_url_query_len(req) + 1;
+    if (buf_len > 1)
+    {
+        char *buf = (char *)malloc(buf_len);
+        if (httpd_req_get_url_query_str(req, buf, buf_len) == ESP_OK)
+        {
+            char param[12];
+            if (httpd_query_key_value(buf, "maxage", param, sizeof(param)) == ESP_OK)
+            {
+                max_age = atoi(param) * 1000ll;
+            }
+            if (httpd_query_key_value(buf, "after", param, sizeof(param)) == ESP_OK)
+            {
+                after = strtoul(param, nullptr, 10);
+                poll = true;
+            }
+        }
+        free(buf);
+    }
+
+    if (poll)
+    {
+        return start_poll(req, after);
+    }
+
+    still_image *image = get_still(max_age);
+    if (image == nullptr)
+    {
+        ESP_LOGE(TAG, "Camera capture failed");
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    esp_err_t res;
+    char if_none_match[sizeof(image->etag)];
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match, sizeof(if_none_match)) == ESP_OK
+        && strcmp(if_none_match, image->etag) == 0)
+    {
+        ++n_not_modified;
+        res = resp_send_not_modified(req, image->etag, "Cache-Control: no-cache\r\n");
+    }
+    else
+    {
+        ++n_served;
+        res = send_image(req, image);
+    }
+
+    int64_t fr_end = esp_timer_get_time();
+    ESP_LOGI(TAG, "JPG: %ub seq %lu age %lums %lums - res %d", image->len, image->seq, (uint32_t)((fr_start - image->timestamp) / 1000),
+        (uint32_t)((fr_end - fr_start) / 1000), res);
+    still_unref(image);
+    return res;
+}
+
+void still_print_info(int (*printfn)(const char *format, ...))
+{
+    printfn("Still: served %u not modified %u captured %u polls %u waiting %d\n", n_served, n_not_modified, n_captured, n_polls, n_pollers);
+}
+
+esp_err_t still_init()
+{
+    mutex = xSemaphoreCreateMutex();
+    events = xEventGroupCreate();
+    // etags carry a per boot id as the sequence numbers start again after a restart
+    boot_id = esp_random();
+    if (xTaskCreate(poll_task_fn, "still_poll", 4096, nullptr, 4, &poll_task) != pdPASS)
+    {
+        ESP_LOGE(TAG, "failed to create poll task");
+        return ESP_FAIL;
+    }
+    if (!capture_add_consumer(on_frame, nullptr))
+    {
+        ESP_LOGE(TAG, "failed to add capture consumer");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "esp_http_server.h"
+
+esp_err_t still_init();
+esp_err_t still_handler(httpd_req_t *req);
+void still_print_info(int (*printfn)(const char *format, ...));
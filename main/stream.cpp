@@ -0,0 +1,905 @@
+#include <algorithm>
+#include <esp_log.h>
+#include "camera.h"
+#include "capture.h"
+#include "exif.h"
+#include "httpd_util.h"
+#include "metrics.h"
+#include "rate.h"
+#include "lwip/sockets.h"
+#include "scale.h"
+#include "session.h"
+#include "stream.h"
+#include "trace.h"
+
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#define TAG "stream"
+#define PART_BOUNDARY "123456789000000000000987654321"
+
+#define _STREAM_CONTENT_TYPE "multipart/x-mixed-replace;boundary=" PART_BOUNDARY
+
+// A client still sending its part after this long copies the rest out of the camera buffer
+// so the capture task is never starved of frames by a slow viewer
+#define STREAM_DETACH_US 200000
+#define STREAM_RETRY_MS 10
+
+// Sending runs on its own task away from the httpd task, wifi and lwip which live on core 0
+#define STREAM_TASK_CORE (portNUM_PROCESSORS - 1)
+#define STREAM_TASK_PRIORITY 5
+
+// Substreams are transcoded at a lower priority on the same core so they only use time the
+// full resolution clients leave over
+#define STREAM_TRANSCODE_PRIORITY 4
+#define STREAM_SCALE_QUALITY 60
+
+// WebSocket clients get each frame as one binary message, this header then the jpeg. All little
+// endian: sequence number, jpeg size, capture time in microseconds since boot, and the latency of
+// the last frame the client acknowledged, from capture to its ack arriving back.
+#define STREAM_WS_META_LEN 24
+#define STREAM_WS_MAX_CREDITS 8
+#define STREAM_WS_MAX_CONTROL 125   // payload of a control frame, as RFC 6455 limits it
+
+static const char* _STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
+// Capture and send times are wall clock seconds so clients can work out latency and, from gaps in the
+// sequence numbers, how many frames they missed
+static const char* _STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\nX-Frame-Seq: %lu\r\n"
+                                  "X-Capture-Time: %lld.%06lld\r\nX-Send-Time: %lld.%06lld\r\n\r\n";
+
+struct stream_sink
+{
+    httpd_handle_t hd;
+    int fd;
+    int scale;              // 0 for the sensor image, otherwise the 1/2^scale substream
+    int64_t interval;       // microseconds between frames for a paced client, 0 for every frame
+    int64_t credit;         // token bucket for pacing, in microseconds of capture time
+    int64_t last_timestamp; // capture time of the last frame offered
+    bool ws;                // WebSocket client, only sent frames it has given credit for
+    int credits;
+    uint32_t latency;       // microseconds
+    uint8_t ws_header[10 + STREAM_WS_META_LEN];
+    uint8_t control[2 + STREAM_WS_MAX_CONTROL];   // pong or close to go out between frames
+    size_t control_len;
+    bool sending_control;   // the part pending is the control frame, not an image
+    bool close_after;       // the control frame is a close, the session goes once it is sent
+    char header[256];       // boundary and part header chunk then the size line of the image chunk
+    capture_frame *frame;   // frame being sent, the sink holds a reference to it
+    struct iovec iov[4];    // what is left of the current part
+    struct iovec *next;
+    int iovcnt;
+    size_t pending;         // bytes of the current part the socket has not taken yet
+    size_t part_len;
+    uint8_t *detached;      // private copy of the rest of the part once the frame has been let go
+    int64_t part_start;
+    bool blocked;           // socket was full last time round
+    bool closing;           // send failed, waiting for httpd to close the session
+    unsigned int sent;
+    unsigned int dropped;
+    unsigned int paced;     // frames passed over to keep to the requested rate
+    uint64_t bytes;
+};
+
+// Everything that is the same for every client is formatted once per frame
+struct stream_part
+{
+    int64_t capture_time;   // wall clock, microseconds
+    size_t multipart_len;   // size of the image as sent in a multipart stream, exif included
+    exif_header exif;
+    bool use_exif;
+    const uint8_t *body;
+    size_t body_len;
+    const uint8_t *image;   // the jpeg as it is, for WebSocket clients
+    size_t image_len;
+};
+
+static SemaphoreHandle_t mutex = nullptr;
+static TaskHandle_t task = nullptr;
+static TaskHandle_t transcode_task = nullptr;
+static stream_sink *sinks[CONFIG_LWIP_MAX_SOCKETS];
+static stream_part parts[CAPTURE_MAX_FRAMES][SCALE_MAX + 1];
+static int scale_sinks[SCALE_MAX + 1];
+static capture_frame *transcode_frame = nullptr;
+
+static void format_part(stream_part *part, const capture_frame *frame, const uint8_t *buf, size_t len)
+{
+    part->capture_time = capture_wall_time(frame->timestamp);
+    part->image = buf;
+    part->image_len = len;
+    size_t image_len = len;
+    size_t jfif_len = exif_jfif_len(buf, len);
+    part->use_exif = jfif_len != 0;
+    if (part->use_exif)
+    {
+        exif_fields fields;
+        capture_exif_fields(frame, &fields);
+        exif_update(&part->exif, &fields);
+        image_len += EXIF_HEADER_LEN - jfif_len;
+        part->body = buf + jfif_len;
+        part->body_len = len - jfif_len;
+    }
+    else
+    {
+        part->body = buf;
+        part->body_len = len;
+    }
+    part->multipart_len = image_len;
+}
+
+// The part header is per client as it has the time this client's copy started out
+static size_t format_part_header(stream_sink *sink, const stream_part *part)
+{
+    char part_buf[224];
+    size_t boundary_len = strlen(_STREAM_BOUNDARY);
+    memcpy(part_buf, _STREAM_BOUNDARY, boundary_len);
+    int64_t send_time = capture_wall_time(esp_timer_get_time());
+    size_t part_len = boundary_len + snprintf(part_buf + boundary_len, sizeof(part_buf) - boundary_len, _STREAM_PART,
+                                              (unsigned)part->multipart_len, (unsigned long)sink->frame->seq,
+                                              part->capture_time / 1000000, part->capture_time % 1000000,
+                                              send_time / 1000000, send_time % 1000000);
+
+    return snprintf(sink->header, sizeof(sink->header), "%x\r\n%.*s\r\n%x\r\n", (unsigned)part_len, (int)part_len, part_buf, (unsigned)part->multipart_len);
+}
+
+static void put_le(uint8_t *p, uint64_t v, int n)
+{
+    for (int i = 0; i < n; ++i)
+    {
+        p[i] = v >> (8 * i);
+    }
+}
+
+// Unmasked binary frame header followed by the frame metadata
+static size_t format_ws_header(stream_sink *sink, const stream_part *part)
+{
+    uint8_t *p = sink->ws_header;
+    size_t payload_len = STREAM_WS_META_LEN + part->image_len;
+    size_t n = 0;
+    p[n++] = 0x82;
+    if (payload_len < 126)
+    {
+        p[n++] = payload_len;
+    }
+    else if (payload_len < 65536)
+    {
+        p[n++] = 126;
+        p[n++] = payload_len >> 8;
+        p[n++] = payload_len;
+    }
+    else
+    {
+        p[n++] = 127;
+        for (int i = 7; i >= 0; --i)
+        {
+            p[n++] = (uint64_t)payload_len >> (8 * i);
+        }
+    }
+
+    memset(p + n, 0, STREAM_WS_META_LEN);
+    put_le(p + n, sink->frame->seq, 4);
+    put_le(p + n + 4, part->image_len, 4);
+    put_le(p + n + 8, sink->frame->timestamp, 8);
+    put_le(p + n + 16, sink->latency, 4);
+    return n + STREAM_WS_META_LEN;
+}
+
+// The whole part is one iovec list: chunk framing, boundary, headers, exif and image
+static void start_part(stream_sink *sink, const stream_part *part)
+{
+    int n = 0;
+    if (sink->ws)
+    {
+        sink->iov[n].iov_base = sink->ws_header;
+        sink->iov[n++].iov_len = format_ws_header(sink, part);
+        sink->iov[n].iov_base = const_cast<uint8_t *>(part->image);
+        sink->iov[n++].iov_len = part->image_len;
+    }
+    else
+    {
+        sink->iov[n].iov_base = sink->header;
+        sink->iov[n++].iov_len = format_part_header(sink, part);
+        if (part->use_exif)
+        {
+            sink->iov[n].iov_base = const_cast<uint8_t *>(part->exif.data);
+            sink->iov[n++].iov_len = EXIF_HEADER_LEN;
+        }
+        sink->iov[n].iov_base = const_cast<uint8_t *>(part->body);
+        sink->iov[n++].iov_len = part->body_len;
+        sink->iov[n].iov_base = const_cast<char *>("\r\n"); // end of chunk
+        sink->iov[n++].iov_len = 2;
+    }
+
+    sink->next = sink->iov;
+    sink->iovcnt = n;
+    sink->part_len = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        sink->part_len += sink->iov[i].iov_len;
+    }
+    sink->pending = sink->part_len;
+    sink->part_start = esp_timer_get_time();
+    trace(TRACE_SEND_START, sink->fd, sink->frame->seq);
+}
+
+// Copy what is left of the part so the camera buffer can go back to the driver
+static void detach_part(stream_sink *sink)
+{
+    auto *copy = static_cast<uint8_t *>(heap_caps_malloc(sink->pending, MALLOC_CAP_SPIRAM));
+    if (copy == nullptr)
+    {
+        return;
+    }
+
+    size_t offset = 0;
+    for (int i = 0; i < sink->iovcnt; ++i)
+    {
+        memcpy(copy + offset, sink->next[i].iov_base, sink->next[i].iov_len);
+        offset += sink->next[i].iov_len;
+    }
+
+    sink->detached = copy;
+    sink->iov[0].iov_base = copy;
+    sink->iov[0].iov_len = sink->pending;
+    sink->next = sink->iov;
+    sink->iovcnt = 1;
+    capture_frame_unref(sink->frame);
+    sink->frame = nullptr;
+    trace(TRACE_SEND_DETACH, sink->fd, sink->pending);
+}
+
+static void drop_part(stream_sink *sink)
+{
+    if (sink->frame != nullptr)
+    {
+        capture_frame_unref(sink->frame);
+        sink->frame = nullptr;
+    }
+    free(sink->detached);
+    sink->detached = nullptr;
+    sink->pending = 0;
+    sink->blocked = false;
+}
+
+// Control frames go out whole between images, never in the middle of one
+static void start_control(stream_sink *sink)
+{
+    sink->iov[0].iov_base = sink->control;
+    sink->iov[0].iov_len = sink->control_len;
+    sink->next = sink->iov;
+    sink->iovcnt = 1;
+    sink->pending = sink->control_len;
+    sink->part_start = esp_timer_get_time();
+    sink->sending_control = true;
+}
+
+static void finish_part(stream_sink *sink)
+{
+    drop_part(sink);
+    if (sink->sending_control)
+    {
+        sink->sending_control = false;
+        sink->control_len = 0;
+        return;
+    }
+    ++sink->sent;
+    sink->bytes += sink->part_len;
+
+    int64_t send_time = esp_timer_get_time() - sink->part_start;
+    metrics_frames_sent.fetch_add(1, std::memory_order_relaxed);
+    metrics_add(&metrics_bytes_sent, sink->part_len);
+    metrics_observe(&metrics_send_latency, send_time);
+    if (sink->scale == 0)
+    {
+        rate_part_sent(sink->fd, sink->part_len, send_time);
+    }
+    trace(TRACE_SEND_END, sink->fd, sink->part_len);
+}
+
+// Pushes as much of every pending part as the sockets will take without blocking.
+// Returns true if some client could not take all of its part.
+static bool pump()
+{
+    struct
+    {
+        httpd_handle_t hd;
+        int fd;
+    } failed[CONFIG_LWIP_MAX_SOCKETS];
+    int n_failed = 0;
+    bool blocked = false;
+    int64_t now = esp_timer_get_time();
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (int i = 0; i < CONFIG_LWIP_MAX_SOCKETS; ++i)
+    {
+        stream_sink *sink = sinks[i];
+        // a sink that failed has nothing more to send, one closing on request still has its close
+        if (sink == nullptr || (sink->pending == 0 && sink->control_len == 0) || (sink->closing && !sink->close_after))
+        {
+            continue;
+        }
+        if (sink->pending == 0)
+        {
+            start_control(sink);
+        }
+
+        int len = socket_sendv_some(sink->fd, &sink->next, &sink->iovcnt);
+        if (len < 0)
+        {
+            ESP_LOGI(TAG, "Send err %d, closing %d", errno, sink->fd);
+            failed[n_failed].hd = sink->hd;
+            failed[n_failed++].fd = sink->fd;
+            drop_part(sink);
+            sink->closing = true;
+            continue;
+        }
+
+        sink->pending -= len;
+        if (sink->pending == 0)
+        {
+            bool close = sink->sending_control && sink->close_after;
+            finish_part(sink);
+            if (close)
+            {
+                failed[n_failed].hd = sink->hd;
+                failed[n_failed++].fd = sink->fd;
+            }
+            continue;
+        }
+
+        sink->blocked = true;
+        blocked = true;
+        if (sink->frame != nullptr && now - sink->part_start > STREAM_DETACH_US)
+        {
+            detach_part(sink);
+        }
+    }
+    xSemaphoreGive(mutex);
+
+    // the session is closed by the httpd task which then removes the sink
+    for (int i = 0; i < n_failed; ++i)
+    {
+        httpd_sess_trigger_close(failed[i].hd, failed[i].fd);
+    }
+
+    return blocked;
+}
+
+// Waits until a blocked socket can take more data, giving up after the retry interval so new
+// frames are not held up behind it
+static void wait_writable()
+{
+    fd_set writable;
+    FD_ZERO(&writable);
+    int max_fd = -1;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (int i = 0; i < CONFIG_LWIP_MAX_SOCKETS; ++i)
+    {
+        if (sinks[i] != nullptr && sinks[i]->blocked)
+        {
+            FD_SET(sinks[i]->fd, &writable);
+            max_fd = std::max(max_fd, sinks[i]->fd);
+        }
+    }
+    xSemaphoreGive(mutex);
+
+    if (max_fd < 0)
+    {
+        return;
+    }
+
+    struct timeval tv{};
+    tv.tv_usec = STREAM_RETRY_MS * 1000;
+    select(max_fd + 1, nullptr, &writable, nullptr, &tv);
+}
+
+// The streaming engine, owns the sockets of every stream client once stream_handler has
+// sent the response header
+static void stream_task(void *)
+{
+    bool blocked = false;
+    for (;;)
+    {
+        if (blocked)
+        {
+            if (ulTaskNotifyTake(pdTRUE, 0) == 0)
+            {
+                wait_writable();
+            }
+        }
+        else
+        {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+
+        blocked = pump();
+    }
+}
+
+// Pacing works on capture timestamps rather than send times so the frames picked are evenly spaced
+// whatever the link does. The bucket holds at most one frame so a client which fell behind does not
+// burst to catch up, and a frame within half a capture period of being due is taken rather than
+// waiting a whole period for the next.
+static bool pace_due(stream_sink *sink, int64_t timestamp)
+{
+    if (sink->interval == 0)
+    {
+        return true;
+    }
+
+    int64_t period = timestamp - sink->last_timestamp;
+    sink->last_timestamp = timestamp;
+    sink->credit = std::min(sink->credit + period, sink->interval);
+    return sink->credit >= sink->interval - std::min(period, sink->interval) / 2;
+}
+
+// Idle clients of the given scale start on the frame, anyone still busy with an older one
+// skips it and picks up whichever frame is newest once they catch up. Called with the mutex held.
+static bool start_frame(capture_frame *frame, int scale)
+{
+    bool started = false;
+    for (int i = 0; i < CONFIG_LWIP_MAX_SOCKETS; ++i)
+    {
+        stream_sink *sink = sinks[i];
+        if (sink == nullptr || sink->closing || sink->scale != scale)
+        {
+            continue;
+        }
+
+        if (!pace_due(sink, frame->timestamp) || (sink->ws && sink->credits == 0))
+        {
+            ++sink->paced;
+            continue;
+        }
+
+        if (sink->pending != 0)
+        {
+            ++sink->dropped;
+            metrics_frames_dropped.fetch_add(1, std::memory_order_relaxed);
+            trace(TRACE_SEND_DROP, sink->fd, frame->seq);
+            continue;
+        }
+
+        sink->credit -= sink->interval;
+        if (sink->ws)
+        {
+            --sink->credits;
+        }
+        capture_frame_ref(frame);
+        sink->frame = frame;
+        start_part(sink, &parts[frame->index][scale]);
+        started = true;
+    }
+    return started;
+}
+
+// Runs on the capture task
+static void on_frame(capture_frame *frame, void *)
+{
+    format_part(&parts[frame->index][0], frame, frame->buf, frame->len);
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    bool started = start_frame(frame, 0);
+
+    // substreams are made from whichever frame is current when the transcoder is free
+    bool want_scaled = false;
+    for (int i = 1; i <= SCALE_MAX; ++i)
+    {
+        want_scaled |= scale_sinks[i] > 0;
+    }
+    if (want_scaled && transcode_frame == nullptr)
+    {
+        capture_frame_ref(frame);
+        transcode_frame = frame;
+        xTaskNotifyGive(transcode_task);
+    }
+    xSemaphoreGive(mutex);
+
+    if (started)
+    {
+        xTaskNotifyGive(task);
+    }
+}
+
+// Makes each substream that has clients once per frame, however many clients there are
+static void transcode(void *)
+{
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        bool wanted[SCALE_MAX + 1];
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        capture_frame *frame = transcode_frame;
+        for (int i = 1; i <= SCALE_MAX; ++i)
+        {
+            wanted[i] = scale_sinks[i] > 0;
+        }
+        xSemaphoreGive(mutex);
+
+        if (frame == nullptr)
+        {
+            continue;
+        }
+
+        for (int i = 1; i <= SCALE_MAX; ++i)
+        {
+            if (wanted[i])
+            {
+                frame->scaled[i] = scale_jpeg(frame->buf, frame->len, i, STREAM_SCALE_QUALITY);
+                if (frame->scaled[i] != nullptr)
+                {
+                    format_part(&parts[frame->index][i], frame, frame->scaled[i]->data, frame->scaled[i]->len);
+                }
+            }
+        }
+
+        bool started = false;
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        for (int i = 1; i <= SCALE_MAX; ++i)
+        {
+            if (frame->scaled[i] != nullptr)
+            {
+                started |= start_frame(frame, i);
+            }
+        }
+        transcode_frame = nullptr;
+        xSemaphoreGive(mutex);
+
+        if (started)
+        {
+            xTaskNotifyGive(task);
+        }
+        capture_frame_unref(frame);
+    }
+}
+
+int stream_get_client_stats(stream_client_stats *stats, int max)
+{
+    if (mutex == nullptr)
+    {
+        return 0;
+    }
+
+    int n = 0;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (int i = 0; i < CONFIG_LWIP_MAX_SOCKETS && n < max; ++i)
+    {
+        const stream_sink *sink = sinks[i];
+        if (sink != nullptr)
+        {
+            stream_client_stats &s = stats[n++];
+            s.fd = sink->fd;
+            s.scale = sink->scale;
+            s.ws = sink->ws;
+            s.sent = sink->sent;
+            s.dropped = sink->dropped;
+            s.paced = sink->paced;
+            s.bytes = sink->bytes;
+        }
+    }
+    xSemaphoreGive(mutex);
+    return n;
+}
+
+void stream_print_info(int (*printfn)(const char *format, ...))
+{
+    if (mutex == nullptr)
+    {
+        return;
+    }
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (int i = 0; i < CONFIG_LWIP_MAX_SOCKETS; ++i)
+    {
+        const stream_sink *sink = sinks[i];
+        if (sink != nullptr)
+        {
+            printfn("Stream: fd %d%s scale 1/%d sent %u dropped %u paced %u pending %u\n", sink->fd, sink->ws ? " ws" : "", 1 << sink->scale, sink->sent, sink->dropped, sink->paced, sink->pending);
+            if (sink->ws)
+            {
+                printfn("Stream: fd %d credits %d latency %lu ms\n", sink->fd, sink->credits, sink->latency / 1000);
+            }
+        }
+    }
+    xSemaphoreGive(mutex);
+}
+
+// Options shared by the multipart and WebSocket streams, returns an error message for a bad one
+static const char *parse_options(httpd_req_t *req, int *scale, float *fps)
+{
+    const char *error = nullptr;
+    size_t buf_len = httpd_req_get_url_query_len(req) + 1;
+    if (buf_len > 1)
+    {
+        char *buf = (char *)malloc(buf_len);
+        if (httpd_req_get_url_query_str(req, buf, buf_len) == ESP_OK)
+        {
+            char param[8];
+            if (httpd_query_key_value(buf, "scale", param, sizeof(param)) == ESP_OK && !scale_parse(param, scale))
+            {
+                error = "scale must be 1/2, 1/4 or 1/8";
+            }
+            if (httpd_query_key_value(buf, "fps", param, sizeof(param)) == ESP_OK)
+            {
+                *fps = atof(param);
+                if (*fps <= 0)
+                {
+                    error = "fps must be a positive number";
+                }
+            }
+        }
+        free(buf);
+    }
+    return error;
+}
+
+// Hands the session over to the stream task, from here on only it writes to the socket
+static esp_err_t add_sink(httpd_req_t *req, int fd, int scale, float fps, bool ws)
+{
+    auto *sink = static_cast<stream_sink*>(calloc(1, sizeof(struct stream_sink)));
+    if (sink == nullptr)
+    {
+        ESP_LOGE(TAG, "no memory for stream sink for %d", fd);
+        return ESP_ERR_NO_MEM;
+    }
+    sink->hd = req->handle;
+    sink->fd = fd;
+    sink->scale = scale;
+    if (fps > 0)
+    {
+        sink->interval = (int64_t)(1000000 / fps);
+        sink->credit = sink->interval;
+        sink->last_timestamp = esp_timer_get_time();
+    }
+    sink->ws = ws;
+    // enough for a client that never sends credit to still see something
+    sink->credits = 1;
+
+    bool added = false;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (int i = 0; i < CONFIG_LWIP_MAX_SOCKETS; ++i)
+    {
+        if (sinks[i] == nullptr)
+        {
+            sinks[i] = sink;
+            ++scale_sinks[scale];
+            added = true;
+            break;
+        }
+    }
+    xSemaphoreGive(mutex);
+
+    if (!added)
+    {
+        ESP_LOGI(TAG, "no free stream sink for %d", fd);
+        free(sink);
+        return ESP_FAIL;
+    }
+
+    capture_acquire();
+    session_hold(fd);
+    return ESP_OK;
+}
+
+esp_err_t stream_handler(httpd_req_t *req)
+{
+    ESP_LOGI(TAG, "stream req: %d", httpd_req_to_sockfd(req));
+    int fd = httpd_req_to_sockfd(req);
+    if (fd < 0)
+    {
+        return ESP_FAIL;
+    }
+
+    int scale = 0;
+    float fps = 0;
+    const char *error = parse_options(req, &scale, &fps);
+    if (error != nullptr)
+    {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, error);
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    const char *httpd_hdr_str = "HTTP/1.1 200 ok\r\nContent-Type: " _STREAM_CONTENT_TYPE "\r\nTransfer-Encoding: chunked\r\nConnection: close\r\nAccess-Control-Allow-Origin: *\r\n\r\n";
+    auto res = socket_send_all(req->handle, fd, httpd_hdr_str, strlen(httpd_hdr_str));
+    if (res != ESP_OK)
+    {
+        ESP_LOGI(TAG, "send header failed : %d", res);
+        return res;
+    }
+
+    return add_sink(req, fd, scale, fps, false);
+}
+
+// Text messages from a WebSocket client: "credit N" lets the server send N more frames and
+// "ack SEQ CAPTURE" says a frame has been shown, which is worth one more credit and gives the
+// latency reported back in the next frame
+static void ws_message(int fd, const char *text)
+{
+    int credits = 0;
+    unsigned long seq;
+    long long capture = 0;
+    if (sscanf(text, "ack %lu %lld", &seq, &capture) == 2)
+    {
+        credits = 1;
+    }
+    else if (sscanf(text, "credit %d", &credits) != 1)
+    {
+        ESP_LOGI(TAG, "unknown ws message on %d: %s", fd, text);
+        return;
+    }
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (int i = 0; i < CONFIG_LWIP_MAX_SOCKETS; ++i)
+    {
+        stream_sink *sink = sinks[i];
+        if (sink != nullptr && sink->fd == fd)
+        {
+            sink->credits = std::min(std::max(sink->credits + credits, 0), STREAM_WS_MAX_CREDITS);
+            if (capture != 0)
+            {
+                sink->latency = esp_timer_get_time() - capture;
+            }
+            break;
+        }
+    }
+    xSemaphoreGive(mutex);
+}
+
+// Queues a pong or close for the stream task to send, as only it writes to the socket. A ping
+// while the last pong is still waiting replaces it, one while it is going out is answered by it.
+static esp_err_t ws_control(int fd, httpd_ws_type_t type, const uint8_t *payload, size_t len)
+{
+    bool queued = false;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (int i = 0; i < CONFIG_LWIP_MAX_SOCKETS; ++i)
+    {
+        stream_sink *sink = sinks[i];
+        if (sink != nullptr && sink->fd == fd)
+        {
+            if (!sink->sending_control && !sink->close_after)
+            {
+                sink->control[0] = 0x80 | type;
+                sink->control[1] = len;
+                memcpy(sink->control + 2, payload, len);
+                sink->control_len = 2 + len;
+                if (type == HTTPD_WS_TYPE_CLOSE)
+                {
+                    // no more frames once a close has been asked for
+                    sink->close_after = true;
+                    sink->closing = true;
+                }
+            }
+            queued = true;
+            break;
+        }
+    }
+    xSemaphoreGive(mutex);
+
+    if (!queued)
+    {
+        return type == HTTPD_WS_TYPE_CLOSE ? ESP_FAIL : ESP_OK;
+    }
+    xTaskNotifyGive(task);
+    return ESP_OK;
+}
+
+esp_err_t stream_ws_handler(httpd_req_t *req)
+{
+    int fd = httpd_req_to_sockfd(req);
+    if (req->method == HTTP_GET)
+    {
+        // the handshake has been done by httpd, a bad option just closes the connection
+        ESP_LOGI(TAG, "ws stream req: %d", fd);
+        int scale = 0;
+        float fps = 0;
+        const char *error = parse_options(req, &scale, &fps);
+        if (error != nullptr)
+        {
+            ESP_LOGI(TAG, "ws stream %d: %s", fd, error);
+            return ESP_FAIL;
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        return add_sink(req, fd, scale, fps, true);
+    }
+
+    httpd_ws_frame_t frame{};
+    esp_err_t res = httpd_ws_recv_frame(req, &frame, 0);
+    if (res != ESP_OK)
+    {
+        return res;
+    }
+    // big enough for any control frame, messages are much shorter
+    char text[STREAM_WS_MAX_CONTROL + 1];
+    if (frame.len >= sizeof(text))
+    {
+        ESP_LOGI(TAG, "ws message too long on %d", fd);
+        return ESP_FAIL;
+    }
+    frame.payload = reinterpret_cast<uint8_t *>(text);
+    res = httpd_ws_recv_frame(req, &frame, sizeof(text) - 1);
+    if (res != ESP_OK)
+    {
+        return res;
+    }
+    text[frame.len] = '\0';
+
+    switch (frame.type)
+    {
+    case HTTPD_WS_TYPE_TEXT:
+        ws_message(fd, text);
+        break;
+    case HTTPD_WS_TYPE_PING:
+        return ws_control(fd, HTTPD_WS_TYPE_PONG, frame.payload, frame.len);
+    case HTTPD_WS_TYPE_CLOSE:
+        // the close is echoed with the client's status code, then the stream task closes the session
+        return ws_control(fd, HTTPD_WS_TYPE_CLOSE, frame.payload, frame.len);
+    default:
+        break;
+    }
+    return ESP_OK;
+}
+
+bool stream_remove_sink(int fd)
+{
+    stream_sink *sink = nullptr;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (int i = 0; i < CONFIG_LWIP_MAX_SOCKETS; ++i)
+    {
+        if (sinks[i] != nullptr && sinks[i]->fd == fd)
+        {
+            sink = sinks[i];
+            sinks[i] = nullptr;
+            --scale_sinks[sink->scale];
+            break;
+        }
+    }
+    xSemaphoreGive(mutex);
+
+    if (sink == nullptr)
+    {
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Freeing sink %p, sent %u dropped %u paced %u", sink, sink->sent, sink->dropped, sink->paced);
+    drop_part(sink);
+    free(sink);
+    capture_release();
+    return true;
+}
+
+esp_err_t stream_init()
+{
+    for (auto &frame_parts : parts)
+    {
+        for (auto &part : frame_parts)
+        {
+            exif_init(&part.exif);
+        }
+    }
+
+    mutex = xSemaphoreCreateMutex();
+    if (xTaskCreatePinnedToCore(stream_task, "stream", 4096, nullptr, STREAM_TASK_PRIORITY, &task, STREAM_TASK_CORE) != pdPASS)
+    {
+        ESP_LOGE(TAG, "failed to create stream task");
+        return ESP_FAIL;
+    }
+    if (xTaskCreatePinnedToCore(transcode, "transcode", 8192, nullptr, STREAM_TRANSCODE_PRIORITY, &transcode_task, STREAM_TASK_CORE) != pdPASS)
+    {
+        ESP_LOGE(TAG, "failed to create transcode task");
+        return ESP_FAIL;
+    }
+    if (!capture_add_consumer(on_frame, nullptr))
+    {
+        ESP_LOGE(TAG, "failed to add capture consumer");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "esp_http_server.h"
+
+struct stream_client_stats
+{
+    int fd;
+    int scale;
+    bool ws;
+    unsigned int sent;
+    unsigned int dropped;
+    unsigned int paced;
+    uint64_t bytes;
+};
+
+esp_err_t stream_handler(httpd_req_t *req);
+esp_err_t stream_ws_handler(httpd_req_t *req);
+esp_err_t stream_init();
+bool stream_remove_sink(int fd);
+// Copies the numbers for up to max clients, returns how many there were
+int stream_get_client_stats(stream_client_stats *stats, int max);
+void stream_print_info(int (*printfn)(const char *format, ...));
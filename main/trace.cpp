@@ -0,0 +1,183 @@
+#include <esp_log.h>
+#include <stdarg.h>
+#include <string.h>
+#include "trace.h"
+
+#include "esp_heap_caps.h"
+
+#define TAG "trace"
+
+// the most distinct sockets named in one dump
+#define TRACE_MAX_FDS 32
+
+trace_record *trace_ring;
+std::atomic<uint32_t> trace_next;
+
+esp_err_t trace_init()
+{
+    size_t size = TRACE_RECORDS * sizeof(trace_record);
+    void *ring = heap_caps_calloc(1, size, MALLOC_CAP_SPIRAM);
+    if (ring == nullptr)
+    {
+        ring = heap_caps_calloc(1, size, MALLOC_CAP_INTERNAL);
+    }
+    if (ring == nullptr)
+    {
+        ESP_LOGE(TAG, "no memory for %u trace records", TRACE_RECORDS);
+        return ESP_ERR_NO_MEM;
+    }
+    trace_ring = static_cast<trace_record *>(ring);
+    return ESP_OK;
+}
+
+void trace_print_info(int (*printfn)(const char *format, ...))
+{
+    printfn("Trace: %lu records of %u\n", (uint32_t)trace_next.load(), TRACE_RECORDS);
+}
+
+// As metrics, the JSON goes out a chunk at a time
+struct trace_writer
+{
+    httpd_req_t *req;
+    esp_err_t res;
+    size_t len;
+    char buf[1024];
+    int fds[TRACE_MAX_FDS];
+    int n_fds;
+    bool first;
+    trace_record records[TRACE_RECORDS];
+};
+
+static void flush(trace_writer *w)
+{
+    if (w->res == ESP_OK && w->len > 0)
+    {
+        w->res = httpd_resp_send_chunk(w->req, w->buf, w->len);
+    }
+    w->len = 0;
+}
+
+static void out(trace_writer *w, const char *format, ...)
+{
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(w->buf + w->len, sizeof(w->buf) - w->len, format, args);
+        va_end(args);
+        if (n >= 0 && w->len + n < sizeof(w->buf))
+        {
+            w->len += n;
+            return;
+        }
+        flush(w);
+    }
+}
+
+// Each socket is a thread of its own in the viewer, named the first time it turns up, and the
+// capture task is thread 0
+static void name_thread(trace_writer *w, int fd)
+{
+    for (int i = 0; i < w->n_fds; ++i)
+    {
+        if (w->fds[i] == fd)
+        {
+            return;
+        }
+    }
+    if (w->n_fds < TRACE_MAX_FDS)
+    {
+        w->fds[w->n_fds++] = fd;
+    }
+    if (fd < 0)
+    {
+        out(w, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"capture\"}}", w->first ? "" : ",\n");
+    }
+    else
+    {
+        out(w, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"fd %d\"}}", w->first ? "" : ",\n", fd, fd);
+    }
+    w->first = false;
+}
+
+static void out_record(trace_writer *w, const trace_record *r)
+{
+    static const struct
+    {
+        const char *name;
+        const char *phase;
+        const char *arg;
+    } events[] =
+    {
+        { "capture", "B", nullptr },
+        { "capture", "E", "seq" },
+        { "frame", "B", "seq" },
+        { "frame", "E", "bytes" },
+        { "detach", "i", "bytes" },
+        { "drop", "i", "seq" },
+        { "queue work", "i", "result" },
+        { "event", "i", "bytes" },
+    };
+    if (r->event >= sizeof(events) / sizeof(events[0]))
+    {
+        return;
+    }
+
+    const auto &e = events[r->event];
+    int tid = r->fd < 0 ? 0 : r->fd;
+    name_thread(w, r->fd);
+    out(w, ",\n{\"name\":\"%s\",\"ph\":\"%s\",%s\"ts\":%lld,\"pid\":1,\"tid\":%d,\"args\":{\"core\":%u", e.name, e.phase,
+        e.phase[0] == 'i' ? "\"s\":\"t\"," : "", r->time, tid, r->core);
+    if (e.arg != nullptr)
+    {
+        out(w, ",\"%s\":%ld", e.arg, (int32_t)r->arg);
+    }
+    out(w, "}}");
+}
+
+// The ring is copied out first so the dump does not hold anything up. Slots written over while
+// the copy was being made are left out.
+esp_err_t trace_handler(httpd_req_t *req)
+{
+    if (trace_ring == nullptr)
+    {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Tracing is not running");
+    }
+
+    auto *w = static_cast<trace_writer *>(heap_caps_malloc(sizeof(trace_writer), MALLOC_CAP_SPIRAM));
+    if (w == nullptr)
+    {
+        w = static_cast<trace_writer *>(malloc(sizeof(trace_writer)));
+    }
+    if (w == nullptr)
+    {
+        return httpd_resp_send_500(req);
+    }
+
+    uint32_t last = trace_next.load();
+    memcpy(w->records, trace_ring, sizeof(w->records));
+    uint32_t end = trace_next.load();
+    uint32_t first = end > TRACE_RECORDS ? end - TRACE_RECORDS : 0;
+
+    w->req = req;
+    w->res = httpd_resp_set_type(req, "application/json");
+    w->len = 0;
+    w->n_fds = 0;
+    w->first = true;
+    out(w, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    name_thread(w, -1);
+    for (uint32_t i = first; i < last; ++i)
+    {
+        out_record(w, &w->records[i & (TRACE_RECORDS - 1)]);
+    }
+    out(w, "\n]}\n");
+
+    flush(w);
+    esp_err_t res = w->res == ESP_OK ? httpd_resp_send_chunk(req, nullptr, 0) : w->res;
+    free(w);
+    if (res != ESP_OK)
+    {
+        ESP_LOGI(TAG, "trace send failed %d", res);
+    }
+    return res;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+// A ring of small binary records of what the hot paths did and when, cheap enough to leave on for
+// every frame in place of logging. /trace gives the records as Chrome trace event JSON, to load into
+// chrome://tracing or ui.perfetto.dev.
+#define TRACE_RECORDS 1024 // a power of 2
+
+enum trace_event : uint8_t
+{
+    TRACE_CAPTURE_START,    // the capture task asks the sensor for a frame
+    TRACE_CAPTURE_END,      // and hands it to the consumers, arg is the frame sequence number
+    TRACE_SEND_START,       // a part is started for fd, arg is the frame sequence number
+    TRACE_SEND_END,         // and the socket has taken all of it, arg is its length
+    TRACE_SEND_DETACH,      // the rest of a slow part was copied, arg is the bytes left
+    TRACE_SEND_DROP,        // fd was still sending when a frame came, arg is the frame sequence number
+    TRACE_QUEUE_WORK,       // httpd_queue_work for fd, arg is what it returned
+    TRACE_SSE_SEND,         // an event went to fd, arg is its length or 0 if the send failed
+};
+
+struct trace_record
+{
+    int64_t time;   // esp_timer_get_time
+    uint32_t arg;
+    int16_t fd;
+    trace_event event;
+    uint8_t core;
+};
+
+extern trace_record *trace_ring;
+extern std::atomic<uint32_t> trace_next;
+
+// Claims the next slot and fills it in. Nothing is taken but the one atomic add, so records can come
+// from any task on either core.
+static inline void trace(trace_event event, int fd = -1, uint32_t arg = 0)
+{
+    if (trace_ring == nullptr)
+    {
+        return;
+    }
+    trace_record *r = trace_ring + (trace_next.fetch_add(1, std::memory_order_relaxed) & (TRACE_RECORDS - 1));
+    r->time = esp_timer_get_time();
+    r->arg = arg;
+    r->fd = fd;
+    r->event = event;
+    r->core = xPortGetCoreID();
+}
+
+extern esp_err_t trace_init();
+extern esp_err_t trace_handler(httpd_req_t *req);
+extern void trace_print_info(int (*printfn)(const char *format, ...));
@@ -0,0 +1,165 @@
+#include <esp_log.h>
+#include <string.h>
+#include <strings.h>
+#include "httpd_util.h"
+#include "session.h"
+#include "www.h"
+#include "www_assets.h"
+
+#define TAG "www"
+
+// A request naming the version it wants can keep it for good, the version changes with the content
+#define WWW_IMMUTABLE "public, max-age=31536000, immutable"
+
+static unsigned int n_sent;
+static unsigned int n_not_modified;
+static unsigned int n_not_acceptable;
+
+const www_asset *www_find(const char *name)
+{
+    for (const auto &asset : www_assets)
+    {
+        if (strcmp(asset.name, name) == 0)
+        {
+            return &asset;
+        }
+    }
+    return nullptr;
+}
+
+static bool versioned(httpd_req_t *req, const www_asset *asset)
+{
+    char query[48];
+    char v[24];
+    return httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK && httpd_query_key_value(query, "v", v, sizeof(v)) == ESP_OK &&
+           strcmp(v, asset->version) == 0;
+}
+
+// Whether Accept-Encoding allows gzip: named or as *, without q=0. No header at all means any
+// coding will do. A value too long for the buffer is taken as allowing it, browsers' never are.
+static bool accepts_gzip(httpd_req_t *req)
+{
+    char value[128];
+    esp_err_t res = httpd_req_get_hdr_value_str(req, "Accept-Encoding", value, sizeof(value));
+    if (res == ESP_ERR_NOT_FOUND || res == ESP_ERR_HTTPD_RESULT_TRUNC)
+    {
+        return true;
+    }
+    if (res != ESP_OK)
+    {
+        return false;
+    }
+
+    int gzip = -1;      // as the header names gzip itself, -1 if it does not
+    int any = -1;       // the same for *
+    for (char *save = nullptr, *item = strtok_r(value, ",", &save); item != nullptr; item = strtok_r(nullptr, ",", &save))
+    {
+        item += strspn(item, " \t");
+        size_t len = strcspn(item, " \t;");
+        const char *q = strstr(item + len, "q=");
+        bool allowed = q == nullptr || strtod(q + 2, nullptr) > 0;
+        if ((len == 4 && strncasecmp(item, "gzip", 4) == 0) || (len == 6 && strncasecmp(item, "x-gzip", 6) == 0))
+        {
+            gzip = allowed;
+        }
+        else if (len == 1 && item[0] == '*')
+        {
+            any = allowed;
+        }
+    }
+    return gzip >= 0 ? gzip : any > 0;
+}
+
+// Every browser takes gzip, so there is no plain copy to fall back on: anything that will not
+// gets a 406
+esp_err_t www_send(httpd_req_t *req, const www_asset *asset)
+{
+    if (asset == nullptr)
+    {
+        return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, nullptr);
+    }
+
+    if (asset->gzipped && !accepts_gzip(req))
+    {
+        ++n_not_acceptable;
+        httpd_resp_set_status(req, "406 Not Acceptable");
+        httpd_resp_set_type(req, "text/plain");
+        httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+        return httpd_resp_send(req, "only available gzipped", HTTPD_RESP_USE_STRLEN);
+    }
+
+    const char *cache_control = versioned(req, asset) ? WWW_IMMUTABLE : "no-cache";
+    char match[24];
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", match, sizeof(match)) == ESP_OK && strcmp(match, asset->etag) == 0)
+    {
+        ++n_not_modified;
+        char headers[96];
+        snprintf(headers, sizeof(headers), "Cache-Control: %s\r\n%s", cache_control, asset->gzipped ? "Vary: Accept-Encoding\r\n" : "");
+        return resp_send_not_modified(req, asset->etag, headers);
+    }
+
+    esp_err_t res = httpd_resp_set_hdr(req, "ETag", asset->etag);
+    if (res == ESP_OK)
+    {
+        res = httpd_resp_set_hdr(req, "Cache-Control", cache_control);
+    }
+    if (res == ESP_OK)
+    {
+        res = httpd_resp_set_type(req, asset->type);
+    }
+    if (res == ESP_OK && asset->gzipped)
+    {
+        res = httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    }
+    if (res == ESP_OK && asset->gzipped)
+    {
+        // the answer would have been a 406 for a client that does not take gzip
+        res = httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+    }
+    if (res != ESP_OK)
+    {
+        return res;
+    }
+    ++n_sent;
+    return httpd_resp_send(req, reinterpret_cast<const char *>(asset->data), asset->len);
+}
+
+static esp_err_t www_handler(httpd_req_t *req)
+{
+    const char *name = strcmp(req->uri, "/") == 0 || strncmp(req->uri, "/?", 2) == 0 ? "index.html" : req->uri + 1;
+    size_t len = strcspn(name, "?");
+    char buf[32];
+    if (len >= sizeof(buf))
+    {
+        return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, nullptr);
+    }
+    memcpy(buf, name, len);
+    buf[len] = '\0';
+    return www_send(req, www_find(buf));
+}
+
+void www_add_endpoints(httpd_handle_t server)
+{
+    httpd_uri_t index{};
+    index.uri       = "/";
+    index.method    = HTTP_GET;
+    index.handler   = www_handler;
+    session_register_uri_handler(server, &index);
+
+    httpd_uri_t fav{};
+    fav.uri       = "/favicon.ico";
+    fav.method    = HTTP_GET;
+    fav.handler   = www_handler;
+    session_register_uri_handler(server, &fav);
+}
+
+void www_print_info(int (*printfn)(const char *format, ...))
+{
+    size_t total = 0;
+    for (const auto &asset : www_assets)
+    {
+        total += asset.len;
+    }
+    printfn("Web: %u assets %u bytes, sent %u not modified %u not acceptable %u\n", sizeof(www_assets) / sizeof(www_assets[0]), total, n_sent,
+            n_not_modified, n_not_acceptable);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_http_server.h"
+
+// The web pages and icon, gzipped at build time by tools/pack_www.py from main/www and sent straight
+// out of flash as they are
+struct www_asset
+{
+    const char *name;       // file name in main/www
+    const char *type;
+    const uint8_t *data;
+    size_t len;
+    const char *etag;       // quoted, a hash of the data
+    const char *version;    // the same hash, added as ?v= where the pages refer to it
+    bool gzipped;
+};
+
+extern const www_asset *www_find(const char *name);
+extern esp_err_t www_send(httpd_req_t *req, const www_asset *asset);
+
+// The page at / and /favicon.ico
+extern void www_add_endpoints(httpd_handle_t server);
+extern void www_print_info(int (*printfn)(const char *format, ...));
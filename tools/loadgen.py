@@ -0,0 +1,596 @@
+#!/usr/bin/env python3
+"""Puts a camera under load from many clients at once and reports what each of them got.
+
+Opens N /stream clients, each reading no faster than its given speed, M /events clients, K
+clients polling /still and clients making quick requests as the web page's sliders do, against a board or the host build (host/build/camera_host, which listens
+on 8080). Reports frames a second, the gaps between frames, bytes a second and missed frames for
+every client, how long the quick requests took, and samples the camera's heap from /metrics as it
+goes.
+
+    tools/loadgen.py http://camera.local --stream 4 --events 2 --still 1 --duration 60
+    tools/loadgen.py http://localhost:8080 --stream 8 --stream-rate 0,200k --json result.json
+    tools/loadgen.py http://camera.local --stream 1 --control 1 --control-interval 0.05 --no-keepalive
+
+With --soak the clients are connected and disconnected over and over, the heap being sampled
+with nobody connected after each round. Free heap that keeps going down across rounds is
+reported as a leak, with how much each connection lost, and the exit status is 1.
+
+    tools/loadgen.py http://localhost:8080 --soak --stream 4 --events 4 --rounds 50
+
+Only uses the standard library.
+"""
+
+import argparse
+import http.client
+import json
+import socket
+import sys
+import threading
+import time
+import urllib.parse
+
+
+def parse_size(text):
+    """Bytes from 1500, 200k or 2m, 0 for no limit"""
+    text = text.strip().lower()
+    scale = 1
+    if text.endswith("k"):
+        scale, text = 1000, text[:-1]
+    elif text.endswith("m"):
+        scale, text = 1000000, text[:-1]
+    return int(float(text) * scale)
+
+
+def percentile(values, p):
+    if not values:
+        return 0.0
+    i = min(len(values) - 1, int(round(p / 100.0 * (len(values) - 1))))
+    return values[i]
+
+
+class ClientStats:
+    def __init__(self, name):
+        self.name = name
+        self.lock = threading.Lock()
+        self.start = time.monotonic()
+        self.end = None
+        self.frames = 0
+        self.bytes = 0
+        self.missed = 0
+        self.errors = 0
+        self.error = None
+        self.gaps = []
+        self.latencies = []
+        self.connects = 0
+        self.last = None
+        self.last_seq = None
+
+    def frame(self, length, seq=None):
+        now = time.monotonic()
+        with self.lock:
+            self.frames += 1
+            self.bytes += length
+            if self.last is not None:
+                self.gaps.append(now - self.last)
+            self.last = now
+            if seq is not None:
+                if self.last_seq is not None and seq > self.last_seq + 1:
+                    self.missed += seq - self.last_seq - 1
+                self.last_seq = seq
+
+    def request(self, length, latency, connected):
+        self.frame(length)
+        with self.lock:
+            self.latencies.append(latency)
+            self.connects += connected
+
+    def fail(self, error):
+        with self.lock:
+            self.errors += 1
+            self.error = str(error)
+
+    def summary(self):
+        with self.lock:
+            elapsed = max((self.end or time.monotonic()) - self.start, 1e-6)
+            gaps = sorted(self.gaps)
+            latencies = sorted(self.latencies)
+            summary = {
+                "client": self.name,
+                "frames": self.frames,
+                "fps": self.frames / elapsed,
+                "bytes_per_second": self.bytes / elapsed,
+                "gap_ms": {
+                    "p50": percentile(gaps, 50) * 1000,
+                    "p90": percentile(gaps, 90) * 1000,
+                    "p99": percentile(gaps, 99) * 1000,
+                    "max": (gaps[-1] if gaps else 0) * 1000,
+                },
+                "missed": self.missed,
+                "errors": self.errors,
+                "last_error": self.error,
+            }
+            if latencies:
+                summary["latency_ms"] = {
+                    "p50": percentile(latencies, 50) * 1000,
+                    "p90": percentile(latencies, 90) * 1000,
+                    "p99": percentile(latencies, 99) * 1000,
+                    "max": latencies[-1] * 1000,
+                }
+                summary["connects"] = self.connects
+            return summary
+
+
+class HttpReader:
+    """Reads a response off a socket, undoing chunked encoding, at no more than rate bytes a second"""
+
+    def __init__(self, sock, rate):
+        self.sock = sock
+        self.rate = rate
+        self.start = time.monotonic()
+        self.received = 0
+        self.raw = bytearray()
+        self.data = bytearray()
+        self.chunked = False
+        self.chunk_left = 0
+        self.need_crlf = False
+        self.eof = False
+
+    def _recv(self):
+        size = 16384
+        if self.rate > 0:
+            allowed = self.rate * (time.monotonic() - self.start) - self.received
+            if allowed < 1024:
+                time.sleep((1024 - allowed) / self.rate)
+                allowed = 1024
+            size = int(min(size, allowed))
+        chunk = self.sock.recv(size)
+        if not chunk:
+            raise EOFError("connection closed")
+        self.received += len(chunk)
+        self.raw += chunk
+
+    def _decode(self):
+        if not self.chunked:
+            self.data += self.raw
+            del self.raw[:]
+            return
+        while True:
+            if self.need_crlf:
+                if len(self.raw) < 2:
+                    return
+                del self.raw[:2]
+                self.need_crlf = False
+            if self.chunk_left == 0:
+                i = self.raw.find(b"\r\n")
+                if i < 0:
+                    return
+                size = int(bytes(self.raw[:i]).split(b";")[0], 16)
+                del self.raw[: i + 2]
+                if size == 0:
+                    self.eof = True
+                    return
+                self.chunk_left = size
+            take = min(self.chunk_left, len(self.raw))
+            if take == 0:
+                return
+            self.data += self.raw[:take]
+            del self.raw[:take]
+            self.chunk_left -= take
+            if self.chunk_left == 0:
+                self.need_crlf = True
+
+    def headers(self):
+        while b"\r\n\r\n" not in self.raw:
+            self._recv()
+        i = self.raw.find(b"\r\n\r\n")
+        lines = bytes(self.raw[:i]).decode("latin-1").split("\r\n")
+        del self.raw[: i + 4]
+        status = int(lines[0].split()[1])
+        fields = {}
+        for line in lines[1:]:
+            key, _, value = line.partition(":")
+            fields[key.strip().lower()] = value.strip()
+        self.chunked = "chunked" in fields.get("transfer-encoding", "").lower()
+        self._decode()
+        return status, fields
+
+    def until(self, delimiter):
+        """Everything up to and including delimiter"""
+        while True:
+            i = self.data.find(delimiter)
+            if i >= 0:
+                out = bytes(self.data[: i + len(delimiter)])
+                del self.data[: i + len(delimiter)]
+                return out
+            if self.eof:
+                raise EOFError("end of response")
+            self._recv()
+            self._decode()
+
+    def exactly(self, n):
+        while len(self.data) < n:
+            if self.eof:
+                raise EOFError("end of response")
+            self._recv()
+            self._decode()
+        out = bytes(self.data[:n])
+        del self.data[:n]
+        return out
+
+
+class Camera:
+    def __init__(self, url):
+        parsed = urllib.parse.urlsplit(url if "//" in url else "http://" + url)
+        self.host = parsed.hostname
+        self.port = parsed.port or 80
+
+    def open(self, path, recv_buffer=0):
+        sock = socket.create_connection((self.host, self.port), timeout=30)
+        if recv_buffer:
+            # a window of its own rather than the kernel's autotuned one, so a slow reader holds the
+            # camera back; much smaller and loopback stalls on delayed acks
+            sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, recv_buffer)
+        request = "GET %s HTTP/1.1\r\nHost: %s\r\n\r\n" % (path, self.host)
+        sock.sendall(request.encode())
+        return sock
+
+    def get(self, path, timeout=15):
+        conn = http.client.HTTPConnection(self.host, self.port, timeout=timeout)
+        try:
+            conn.request("GET", path)
+            response = conn.getresponse()
+            return response.status, dict((k.lower(), v) for k, v in response.getheaders()), response.read()
+        finally:
+            conn.close()
+
+    def metrics(self):
+        _, _, body = self.get("/metrics")
+        values = {}
+        for line in body.decode("utf-8", "replace").splitlines():
+            if line.startswith("#") or " " not in line:
+                continue
+            name, _, value = line.rpartition(" ")
+            try:
+                values[name] = float(value)
+            except ValueError:
+                pass
+        return values
+
+
+class Client(threading.Thread):
+    def __init__(self, camera, stats):
+        super().__init__(daemon=True)
+        self.camera = camera
+        self.stats = stats
+        self.stopping = threading.Event()
+        self.sock = None
+
+    def stop(self):
+        self.stopping.set()
+        sock = self.sock
+        if sock is not None:
+            try:
+                sock.shutdown(socket.SHUT_RDWR)
+            except OSError:
+                pass
+
+    def run(self):
+        try:
+            self.serve()
+        except (OSError, EOFError, ValueError, http.client.HTTPException) as e:
+            if not self.stopping.is_set():
+                self.stats.fail(e)
+        finally:
+            self.stats.end = time.monotonic()
+            if self.sock is not None:
+                self.sock.close()
+
+
+class StreamClient(Client):
+    def __init__(self, camera, stats, query, rate):
+        super().__init__(camera, stats)
+        self.path = "/stream" + ("?" + query if query else "")
+        self.rate = rate
+
+    def serve(self):
+        self.sock = self.camera.open(self.path, 65536 if self.rate else 0)
+        reader = HttpReader(self.sock, self.rate)
+        status, fields = reader.headers()
+        if status != 200:
+            raise ValueError("stream answered %d" % status)
+        boundary = fields.get("content-type", "").partition("boundary=")[2].encode()
+        while not self.stopping.is_set():
+            reader.until(b"--" + boundary + b"\r\n")
+            part = reader.until(b"\r\n\r\n").decode("latin-1")
+            length, seq = 0, None
+            for line in part.split("\r\n"):
+                key, _, value = line.partition(":")
+                if key.lower() == "content-length":
+                    length = int(value)
+                elif key.lower() == "x-frame-seq":
+                    seq = int(value)
+            reader.exactly(length)
+            self.stats.frame(length, seq)
+
+
+class EventsClient(Client):
+    def serve(self):
+        self.sock = self.camera.open("/events")
+        reader = HttpReader(self.sock, 0)
+        status, _ = reader.headers()
+        if status != 200:
+            raise ValueError("events answered %d" % status)
+        while not self.stopping.is_set():
+            event = reader.until(b"\n\n")
+            if b"data:" in event:
+                self.stats.frame(len(event))
+
+
+class StillClient(Client):
+    """Asks for a still every interval, or with --still-after waits on each newer frame in turn"""
+
+    def __init__(self, camera, stats, interval, after):
+        super().__init__(camera, stats)
+        self.interval = interval
+        self.after = after
+
+    def serve(self):
+        seq = None
+        while not self.stopping.is_set():
+            started = time.monotonic()
+            path = "/still" if not self.after or seq is None else "/still?after=%d" % seq
+            status, fields, body = self.camera.get(path)
+            if status == 200:
+                seq = int(fields.get("x-frame-seq", "0"))
+                self.stats.frame(len(body), seq if self.after else None)
+            elif status != 204:
+                self.stats.fail("still answered %d" % status)
+            if not self.after:
+                self.stopping.wait(max(0.0, self.interval - (time.monotonic() - started)))
+
+
+class ControlClient(Client):
+    """Makes a request every interval and times it, as the web page does when a slider moves. With
+    keep_alive the connection is used for as long as the camera keeps it open."""
+
+    def __init__(self, camera, stats, path, interval, keep_alive):
+        super().__init__(camera, stats)
+        self.path = path
+        self.interval = interval
+        self.keep_alive = keep_alive
+
+    def serve(self):
+        conn = http.client.HTTPConnection(self.camera.host, self.camera.port, timeout=15)
+        try:
+            while not self.stopping.is_set():
+                started = time.monotonic()
+                connected = conn.sock is None
+                try:
+                    response, body = self.ask(conn)
+                except (http.client.RemoteDisconnected, ConnectionResetError, BrokenPipeError):
+                    if connected or self.stopping.is_set():
+                        raise
+                    # the camera closed a kept connection to make room, a browser asks again
+                    conn.close()
+                    connected = True
+                    response, body = self.ask(conn)
+                if response.status != 200:
+                    self.stats.fail("%s answered %d" % (self.path, response.status))
+                else:
+                    self.stats.request(len(body), time.monotonic() - started, connected)
+                if not self.keep_alive or response.will_close:
+                    conn.close()
+                self.stopping.wait(max(0.0, self.interval - (time.monotonic() - started)))
+        finally:
+            self.sock = None
+            conn.close()
+
+    def ask(self, conn):
+        if conn.sock is None:
+            conn.connect()
+            self.sock = conn.sock
+        conn.request("GET", self.path, headers={} if self.keep_alive else {"Connection": "close"})
+        response = conn.getresponse()
+        return response, response.read()
+
+
+class HeapSampler(threading.Thread):
+    NAMES = ("camera_heap_free_bytes", "camera_heap_min_free_bytes", "camera_psram_free_bytes")
+
+    def __init__(self, camera, interval):
+        super().__init__(daemon=True)
+        self.camera = camera
+        self.interval = interval
+        self.stopping = threading.Event()
+        self.start_time = time.monotonic()
+        self.samples = []
+
+    def sample(self):
+        try:
+            values = self.camera.metrics()
+        except (OSError, http.client.HTTPException):
+            return None
+        sample = {"t": round(time.monotonic() - self.start_time, 3)}
+        for name in self.NAMES:
+            if name in values:
+                sample[name] = int(values[name])
+        self.samples.append(sample)
+        return sample
+
+    def run(self):
+        while not self.stopping.wait(self.interval):
+            self.sample()
+
+
+def start_clients(camera, args):
+    clients = []
+    rates = [parse_size(r) for r in args.stream_rate.split(",")]
+    for i in range(args.stream):
+        rate = rates[i % len(rates)]
+        name = "stream-%d" % i + (" %s/s" % args.stream_rate.split(",")[i % len(rates)] if rate else "")
+        clients.append(StreamClient(camera, ClientStats(name), args.stream_query, rate))
+    for i in range(args.events):
+        clients.append(EventsClient(camera, ClientStats("events-%d" % i)))
+    for i in range(args.still):
+        clients.append(StillClient(camera, ClientStats("still-%d" % i), args.still_interval, args.still_after))
+    for i in range(args.control):
+        clients.append(ControlClient(camera, ClientStats("control-%d" % i), args.control_path, args.control_interval, args.keepalive))
+    for c in clients:
+        c.start()
+    return clients
+
+
+def stop_clients(clients):
+    for c in clients:
+        c.stop()
+    for c in clients:
+        c.join(5)
+
+
+def print_clients(summaries):
+    print("%-22s %7s %8s %8s %8s %8s %9s %7s %6s" % ("client", "fps", "p50 ms", "p90 ms", "p99 ms", "max ms", "KB/s", "missed", "errors"))
+    for s in summaries:
+        g = s["gap_ms"]
+        print("%-22s %7.2f %8.1f %8.1f %8.1f %8.1f %9.1f %7d %6d" % (
+            s["client"], s["fps"], g["p50"], g["p90"], g["p99"], g["max"], s["bytes_per_second"] / 1000, s["missed"], s["errors"]))
+        if "latency_ms" in s:
+            l = s["latency_ms"]
+            print("    request ms p50 %.1f p90 %.1f p99 %.1f max %.1f, %d requests on %d connections" % (
+                l["p50"], l["p90"], l["p99"], l["max"], s["frames"], s["connects"]))
+        if s["last_error"]:
+            print("    last error: %s" % s["last_error"])
+
+
+def fit_slope(points):
+    """Least squares slope of y on x"""
+    n = len(points)
+    if n < 2:
+        return 0.0
+    mx = sum(x for x, _ in points) / n
+    my = sum(y for _, y in points) / n
+    sxx = sum((x - mx) ** 2 for x, _ in points)
+    return sum((x - mx) * (y - my) for x, y in points) / sxx if sxx else 0.0
+
+
+def run_load(camera, args, heap):
+    clients = start_clients(camera, args)
+    deadline = time.monotonic() + args.duration
+    while time.monotonic() < deadline:
+        time.sleep(min(args.report, max(0.0, deadline - time.monotonic())))
+        sample = heap.sample()
+        frames = sum(c.stats.frames for c in clients)
+        print("%7.1fs  %d clients  %d frames  heap free %s" % (
+            time.monotonic() - heap.start_time, sum(c.is_alive() for c in clients), frames,
+            sample.get("camera_heap_free_bytes", "?") if sample else "?"), flush=True)
+    stop_clients(clients)
+    summaries = [c.stats.summary() for c in clients]
+    print_clients(summaries)
+    return {"clients": summaries}, 0
+
+
+def run_soak(camera, args, heap):
+    connections = args.stream + args.events + args.still + args.control
+    idle = []
+    summaries = []
+    for r in range(args.rounds):
+        clients = start_clients(camera, args)
+        time.sleep(args.round_seconds)
+        busy = heap.sample()
+        stop_clients(clients)
+        summaries = [c.stats.summary() for c in clients]
+        # let the camera notice the closes and free what went with them
+        time.sleep(args.settle)
+        sample = heap.sample()
+        if sample is None or "camera_heap_free_bytes" not in sample:
+            print("round %d: no heap figures from /metrics" % r, flush=True)
+            continue
+        idle.append((r, sample["camera_heap_free_bytes"]))
+        print("round %3d  heap free %d idle, %s busy, %d frames, %d errors" % (
+            r, sample["camera_heap_free_bytes"], busy.get("camera_heap_free_bytes", "?") if busy else "?",
+            sum(s["frames"] for s in summaries), sum(s["errors"] for s in summaries)), flush=True)
+
+    print_clients(summaries)
+    # the first round allocates what stays allocated for good, buffers and tasks
+    steady = idle[1:]
+    slope = fit_slope(steady)
+    lost = steady[0][1] - steady[-1][1] if len(steady) >= 2 else 0
+    per_connection = -slope / connections if connections else 0.0
+    leak = len(steady) >= 3 and lost > args.leak_threshold and slope < 0
+    result = {
+        "rounds": len(idle),
+        "idle_heap_free": [h for _, h in idle],
+        "lost_bytes": lost,
+        "bytes_per_round": -slope,
+        "bytes_per_connection": per_connection,
+        "leak": leak,
+    }
+    print("heap free after each round went from %s to %s, %.0f bytes a round, %.1f a connection" % (
+        steady[0][1] if steady else "?", steady[-1][1] if steady else "?", -slope, per_connection))
+    if leak:
+        print("LEAK: %d bytes lost over %d rounds of %d connections" % (lost, len(steady), connections))
+    return {"clients": summaries, "soak": result}, 1 if leak else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("url", help="the camera, e.g. http://camera.local or http://localhost:8080")
+    parser.add_argument("--stream", type=int, default=1, help="/stream clients")
+    parser.add_argument("--stream-rate", default="0",
+                        help="read speed of each stream client in bytes a second (200k, 1m), a list to share out, 0 for as fast as it comes")
+    parser.add_argument("--stream-query", default="", help="added to /stream, e.g. fps=5 or scale=1/2")
+    parser.add_argument("--events", type=int, default=0, help="/events clients")
+    parser.add_argument("--still", type=int, default=0, help="clients polling /still")
+    parser.add_argument("--still-interval", type=float, default=1.0, help="seconds between /still requests")
+    parser.add_argument("--still-after", action="store_true", help="long poll /still?after=seq for every new frame instead")
+    parser.add_argument("--control", type=int, default=0, help="clients making quick requests")
+    parser.add_argument("--control-path", default="/config", help="what they ask for")
+    parser.add_argument("--control-interval", type=float, default=0.1, help="seconds between their requests")
+    parser.add_argument("--no-keepalive", dest="keepalive", action="store_false", help="a new connection for every quick request")
+    parser.add_argument("--duration", type=float, default=30, help="seconds to run for")
+    parser.add_argument("--report", type=float, default=5, help="seconds between progress lines and heap samples")
+    parser.add_argument("--replay", help="have the camera replay this recording first, see /replay")
+    parser.add_argument("--replay-fps", default="", help="fps for the replay, max for as fast as it can")
+    parser.add_argument("--soak", action="store_true", help="connect and disconnect over and over, looking for heap that is not given back")
+    parser.add_argument("--rounds", type=int, default=20, help="soak rounds")
+    parser.add_argument("--round-seconds", type=float, default=5, help="seconds the clients stay connected each round")
+    parser.add_argument("--settle", type=float, default=2, help="seconds to wait after the clients go before sampling the heap")
+    parser.add_argument("--leak-threshold", type=int, default=4096, help="bytes lost over a soak before it counts as a leak")
+    parser.add_argument("--json", help="write the results here")
+    args = parser.parse_args()
+
+    camera = Camera(args.url)
+    if args.replay:
+        query = {"path": args.replay}
+        if args.replay_fps:
+            query["fps"] = args.replay_fps
+        status, _, body = camera.get("/replay?" + urllib.parse.urlencode(query, safe="/"))
+        print("replay: %d %s" % (status, body.decode("utf-8", "replace")))
+        if status != 200:
+            return 2
+
+    heap = HeapSampler(camera, args.report)
+    first = heap.sample()
+    if first is None:
+        print("no answer from %s/metrics" % args.url)
+        return 2
+    print("heap free %s at start" % first.get("camera_heap_free_bytes", "?"), flush=True)
+
+    try:
+        if args.soak:
+            result, status = run_soak(camera, args, heap)
+        else:
+            result, status = run_load(camera, args, heap)
+    finally:
+        if args.replay:
+            camera.get("/replay")
+
+    if args.json:
+        result["config"] = vars(args)
+        result["heap"] = heap.samples
+        with open(args.json, "w") as f:
+            json.dump(result, f, indent=2)
+    return status
+
+
+if __name__ == "__main__":
+    sys.exit(main())
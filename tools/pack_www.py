@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+"""Packs the web pages in main/www into a header of gzipped blobs for the firmware to serve as they are.
+
+    tools/pack_www.py www_assets.h main/www/index.html main/www/favicon.ico ...
+
+Text is minified a little first: indentation, blank lines, whole line // comments and one line HTML
+comments go, line breaks stay so scripts mean the same. Each asset gets an ETag from a hash of what is
+sent. Quoted references in the pages to the other assets get ?v=<hash> added, so those can be cached
+for good and a new build is fetched as soon as a page that uses it is.
+
+Run by the build, main/CMakeLists.txt and host/CMakeLists.txt. Only uses the standard library.
+"""
+
+import gzip
+import hashlib
+import os
+import re
+import sys
+
+TYPES = {
+    ".html": "text/html",
+    ".js": "application/javascript",
+    ".css": "text/css",
+    ".ico": "image/x-icon",
+    ".png": "image/png",
+    ".svg": "image/svg+xml",
+}
+TEXT = (".html", ".js", ".css", ".svg")
+
+
+def minify(text):
+    lines = []
+    for line in text.splitlines():
+        line = re.sub(r"<!--.*?-->", "", line).strip()
+        if line and not line.startswith("//"):
+            lines.append(line)
+    return "\n".join(lines) + "\n"
+
+
+def c_name(name):
+    return "www_" + re.sub(r"[^0-9A-Za-z]", "_", name)
+
+
+def pack(paths):
+    # the assets the pages refer to are done first so the pages can carry their hashes
+    paths = sorted(paths, key=lambda p: (os.path.splitext(p)[1] in TEXT, os.path.basename(p)))
+    assets = []
+    versions = {}
+    for path in paths:
+        name = os.path.basename(path)
+        ext = os.path.splitext(name)[1].lower()
+        if ext not in TYPES:
+            raise SystemExit("%s: no content type for %s" % (path, ext))
+        with open(path, "rb") as f:
+            data = f.read()
+        if ext in TEXT:
+            text = minify(data.decode("utf-8"))
+            for other, version in versions.items():
+                text = re.sub(r"""(["'])%s\1""" % re.escape(other), r"\g<1>%s?v=%s\g<1>" % (other, version), text)
+            data = text.encode("utf-8")
+        # no time stamp so the same pages always give the same bytes
+        packed = gzip.compress(data, 9, mtime=0)
+        gzipped = len(packed) < len(data) * 0.9
+        if not gzipped:
+            packed = data
+        digest = hashlib.sha256(packed).hexdigest()[:16]
+        versions[name] = digest
+        assets.append((name, TYPES[ext], packed, digest, gzipped, len(data)))
+    return assets
+
+
+def write_header(out, assets):
+    lines = ["// Made by tools/pack_www.py from main/www, do not edit", "#pragma once", ""]
+    for name, _, packed, _, gzipped, size in assets:
+        lines.append("// %s, %u bytes%s" % (name, size, " gzipped to %u" % len(packed) if gzipped else ""))
+        lines.append("static const uint8_t %s[] =" % c_name(name))
+        lines.append("{")
+        for i in range(0, len(packed), 16):
+            lines.append("    " + ", ".join("0x%02x" % b for b in packed[i:i + 16]) + ",")
+        lines.append("};")
+        lines.append("")
+    lines.append("static const www_asset www_assets[] =")
+    lines.append("{")
+    for name, content_type, packed, digest, gzipped, _ in assets:
+        lines.append('    { "%s", "%s", %s, sizeof(%s), "\\"%s\\"", "%s", %s },' % (
+            name, content_type, c_name(name), c_name(name), digest, digest, "true" if gzipped else "false"))
+    lines.append("};")
+    with open(out, "w") as f:
+        f.write("\n".join(lines) + "\n")
+
+
+def main():
+    if len(sys.argv) < 3:
+        print(__doc__.split("\n\n")[1].strip())
+        return 2
+    assets = pack(sys.argv[2:])
+    write_header(sys.argv[1], assets)
+    for name, _, packed, _, gzipped, size in assets:
+        print("www: %s %u bytes%s" % (name, size, ", %u gzipped" % len(packed) if gzipped else ""))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())